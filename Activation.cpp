@@ -2,39 +2,512 @@
 // Created by Yuval Cohen on 01/03/2024.
 //
 #include "Activation.h"
+#include "Reduce.h"
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <vector>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// Range of arguments for which fast_exp stays a finite, normal float
+#define EXP_LO (-87.3F)
+#define EXP_HI 88.0F
+#define LOG2E 1.44269504088896341F
+// ln(2) split in two so that n * ln(2) is subtracted without rounding loss
+#define LN2_HI 0.693359375F
+#define LN2_LO (-2.12194440e-4F)
+// Minimax coefficients for e^r - 1 - r on [-ln(2)/2, ln(2)/2] (Cephes expf)
+#define EXP_P0 1.9875691500E-4F
+#define EXP_P1 1.3981999507E-3F
+#define EXP_P2 8.3334519073E-3F
+#define EXP_P3 4.1665795894E-2F
+#define EXP_P4 1.6666665459E-1F
+#define EXP_P5 5.0000001201E-1F
+// tanh Taylor coefficients (x^3, x^5, x^7) and where the series takes over
+#define TANH_SMALL 0.25F
+#define TANH_C3 (-3.33333343e-1F)
+#define TANH_C5 1.33333340e-1F
+#define TANH_C7 (-5.39682545e-2F)
+// GELU: x * sigmoid (GELU_K * (x + GELU_C * x^3)), GELU_K = 2 sqrt (2 / pi)
+#define GELU_K 1.59576912F
+#define GELU_C 0.044715F
+
+namespace
+{
+    // Scalar e^x, same reduction and polynomial as the SIMD path below so
+    // that vector bodies and their scalar tails agree bit for bit.
+    inline float fast_exp (float x)
+    {
+      x = std::min (std::max (x, EXP_LO), EXP_HI);
+      float fn = static_cast<float> (std::lrint (x * LOG2E));
+      float r = x - fn * LN2_HI - fn * LN2_LO;
+      float p = EXP_P0;
+      p = p * r + EXP_P1;
+      p = p * r + EXP_P2;
+      p = p * r + EXP_P3;
+      p = p * r + EXP_P4;
+      p = p * r + EXP_P5;
+      p = p * r * r + (r + 1.0F);
+
+      // Build 2^n directly in the exponent field
+      uint32_t bits = static_cast<uint32_t> (static_cast<int32_t> (fn) + 127)
+          << 23;
+      float scale;
+      std::memcpy (&scale, &bits, sizeof (scale));
+      return p * scale;
+    }
+
+#if defined(__SSE2__)
+    inline __m128 fast_exp4 (__m128 x)
+    {
+      // _mm_max_ps (a, b) returns b when either is NaN, so with the bound
+      // first these clamp exactly like std::max and std::min, NaN included
+      x = _mm_min_ps (_mm_set1_ps (EXP_HI),
+                      _mm_max_ps (_mm_set1_ps (EXP_LO), x));
+      __m128i n = _mm_cvtps_epi32 (_mm_mul_ps (x, _mm_set1_ps (LOG2E)));
+      __m128 fn = _mm_cvtepi32_ps (n);
+      __m128 r = _mm_sub_ps (x, _mm_mul_ps (fn, _mm_set1_ps (LN2_HI)));
+      r = _mm_sub_ps (r, _mm_mul_ps (fn, _mm_set1_ps (LN2_LO)));
+
+      __m128 p = _mm_set1_ps (EXP_P0);
+      p = _mm_add_ps (_mm_mul_ps (p, r), _mm_set1_ps (EXP_P1));
+      p = _mm_add_ps (_mm_mul_ps (p, r), _mm_set1_ps (EXP_P2));
+      p = _mm_add_ps (_mm_mul_ps (p, r), _mm_set1_ps (EXP_P3));
+      p = _mm_add_ps (_mm_mul_ps (p, r), _mm_set1_ps (EXP_P4));
+      p = _mm_add_ps (_mm_mul_ps (p, r), _mm_set1_ps (EXP_P5));
+      p = _mm_add_ps (_mm_mul_ps (_mm_mul_ps (p, r), r),
+                      _mm_add_ps (r, _mm_set1_ps (1.0F)));
+
+      __m128i e = _mm_slli_epi32 (_mm_add_epi32 (n, _mm_set1_epi32 (127)), 23);
+      return _mm_mul_ps (p, _mm_castsi128_ps (e));
+    }
+
+    inline float horizontal_sum (__m128 v)
+    {
+      __m128 shuf = _mm_shuffle_ps (v, v, _MM_SHUFFLE (2, 3, 0, 1));
+      __m128 sums = _mm_add_ps (v, shuf);
+      shuf = _mm_movehl_ps (shuf, sums);
+      return _mm_cvtss_f32 (_mm_add_ss (sums, shuf));
+    }
+
+    inline float horizontal_max (__m128 v)
+    {
+      __m128 shuf = _mm_shuffle_ps (v, v, _MM_SHUFFLE (2, 3, 0, 1));
+      __m128 maxs = _mm_max_ps (v, shuf);
+      shuf = _mm_movehl_ps (shuf, maxs);
+      return _mm_cvtss_f32 (_mm_max_ss (maxs, shuf));
+    }
+#endif
+
+    // Largest element of a contiguous vector.
+    float vector_max (const float *in, int n)
+    {
+      int i = 0;
+      float max_value = in[0];
+#if defined(__SSE2__)
+      if (n >= 4)
+      {
+        __m128 acc = _mm_loadu_ps (in);
+        for (i = 4; i + 4 <= n; i += 4)
+        {
+          acc = _mm_max_ps (acc, _mm_loadu_ps (in + i));
+        }
+        max_value = horizontal_max (acc);
+      }
+#endif
+      for (; i < n; ++i)
+      {
+        max_value = std::max (max_value, in[i]);
+      }
+      return max_value;
+    }
+
+    // out[i] = e^(in[i] - shift). With SUMMED, also returns the running sum
+    // of the written values; without it, returns 0.
+    template <bool SUMMED>
+    float exp_shifted (const float *in, float *out, int n, float shift)
+    {
+      int i = 0;
+      float sum = 0.0F;
+#if defined(__SSE2__)
+      __m128 acc = _mm_setzero_ps ();
+      __m128 vshift = _mm_set1_ps (shift);
+      for (; i + 4 <= n; i += 4)
+      {
+        __m128 e = fast_exp4 (_mm_sub_ps (_mm_loadu_ps (in + i), vshift));
+        _mm_storeu_ps (out + i, e);
+        if (SUMMED)
+        {
+          acc = _mm_add_ps (acc, e);
+        }
+      }
+      if (SUMMED)
+      {
+        sum = horizontal_sum (acc);
+      }
+#endif
+      for (; i < n; ++i)
+      {
+        out[i] = fast_exp (in[i] - shift);
+        if (SUMMED)
+        {
+          sum += out[i];
+        }
+      }
+      return sum;
+    }
+
+    // exp_shifted, summed in the current reduce mode.
+    float exp_shifted_total (const float *in, float *out, int n, float shift)
+    {
+      if (reduce::get_mode () == reduce::Mode::FAST)
+      {
+        return exp_shifted<true> (in, out, n, shift);
+      }
+      exp_shifted<false> (in, out, n, shift);
+      return reduce::sum (out, size_t (n), reduce::Mode::REPRODUCIBLE);
+    }
+
+    // Softmax of one contiguous vector of n elements.
+    void softmax_vector (const float *in, float *out, int n)
+    {
+      float sum = exp_shifted_total (in, out, n, vector_max (in, n));
+      float inv_sum = 1.0F / sum;
+      for (int i = 0; i < n; ++i)
+      {
+        out[i] *= inv_sum;
+      }
+    }
+
+    // Log-softmax of one contiguous vector of n elements.
+    void log_softmax_vector (const float *in, float *out, int n)
+    {
+      float max_value = vector_max (in, n);
+      // out holds the exponentials until it is overwritten below
+      float shift = max_value
+                    + std::log (exp_shifted_total (in, out, n, max_value));
+      for (int i = 0; i < n; ++i)
+      {
+        out[i] = in[i] - shift;
+      }
+    }
+
+    // Column-wise softmax of a row-major rows x cols block, one column per
+    // sample. Every pass walks whole rows, so it vectorizes across samples.
+    void softmax_columns (const float *in, float *out, int rows, int cols,
+                          bool log_space)
+    {
+      bool fast = reduce::get_mode () == reduce::Mode::FAST;
+      std::vector<float> col_max (in, in + cols);
+      std::vector<float> col_sum (cols, 0.0F);
+      for (int i = 1; i < rows; ++i)
+      {
+        const float *row = in + i * cols;
+        for (int j = 0; j < cols; ++j)
+        {
+          col_max[j] = std::max (col_max[j], row[j]);
+        }
+      }
+
+      for (int i = 0; i < rows; ++i)
+      {
+        const float *row = in + i * cols;
+        float *dst = out + i * cols;
+        for (int j = 0; j < cols; ++j)
+        {
+          dst[j] = row[j] - col_max[j];
+        }
+        exp_shifted<false> (dst, dst, cols, 0.0F);
+        for (int j = 0; fast && j < cols; ++j)
+        {
+          col_sum[j] += dst[j];
+        }
+      }
+      if (!fast)
+      {
+        // Same order as softmax_vector, so a column's denominator does not
+        // depend on whether it is softmaxed alone or in a batch. One tiled
+        // transpose makes every column contiguous
+        std::vector<float> columns (size_t (rows) * cols);
+        Matrix::transpose_copy (out, rows, cols, columns.data ());
+        for (int j = 0; j < cols; ++j)
+        {
+          col_sum[j] = reduce::sum (columns.data () + size_t (j) * rows,
+                                    size_t (rows), reduce::Mode::REPRODUCIBLE);
+        }
+      }
+
+      if (log_space)
+      {
+        for (int j = 0; j < cols; ++j)
+        {
+          col_sum[j] = col_max[j] + std::log (col_sum[j]);
+        }
+        for (int i = 0; i < rows; ++i)
+        {
+          for (int j = 0; j < cols; ++j)
+          {
+            out[i * cols + j] = in[i * cols + j] - col_sum[j];
+          }
+        }
+        return;
+      }
+
+      for (int j = 0; j < cols; ++j)
+      {
+        col_sum[j] = 1.0F / col_sum[j];
+      }
+      for (int i = 0; i < rows; ++i)
+      {
+        float *dst = out + i * cols;
+        for (int j = 0; j < cols; ++j)
+        {
+          dst[j] *= col_sum[j];
+        }
+      }
+    }
+
+    // Element-wise kernels: apply has a scalar and (with SSE2) a 4-wide
+    // overload computing the same operations, so tails match bodies.
+    // _mm_max_ps (a, b) is a > b ? a : b, the same as std::max (b, a)
+    // even for NaN, which both therefore pass through.
+    struct relu_op
+    {
+        static float apply (float x)
+        { return std::max (x, 0.0F); }
+
+#if defined(__SSE2__)
+        static __m128 apply (__m128 x)
+        { return _mm_max_ps (_mm_setzero_ps (), x); }
+#endif
+    };
+
+    // max (x, slope * x) equals the leaky ReLU for any slope below 1
+    struct leaky_relu_op
+    {
+        static float apply (float x)
+        { return std::max (x, x * LEAKY_SLOPE); }
+
+#if defined(__SSE2__)
+        static __m128 apply (__m128 x)
+        { return _mm_max_ps (_mm_mul_ps (x, _mm_set1_ps (LEAKY_SLOPE)), x); }
+#endif
+    };
+
+    struct sigmoid_op
+    {
+        static float apply (float x)
+        { return 1.0F / (1.0F + fast_exp (0.0F - x)); }
+
+#if defined(__SSE2__)
+        static __m128 apply (__m128 x)
+        {
+          __m128 one = _mm_set1_ps (1.0F);
+          __m128 e = fast_exp4 (_mm_sub_ps (_mm_setzero_ps (), x));
+          return _mm_div_ps (one, _mm_add_ps (one, e));
+        }
+#endif
+    };
+
+    // tanh |x| = (1 - e^-2|x|) / (1 + e^-2|x|), with the odd Taylor series
+    // below TANH_SMALL where the subtraction would cancel
+    struct tanh_op
+    {
+        static float apply (float x)
+        {
+          float a = std::abs (x);
+          float y;
+          if (a < TANH_SMALL)
+          {
+            float a2 = a * a;
+            y = a + a * a2 * (TANH_C3 + a2 * (TANH_C5 + a2 * TANH_C7));
+          }
+          else
+          {
+            float e = fast_exp (-2.0F * a);
+            y = (1.0F - e) / (1.0F + e);
+          }
+          return std::copysign (y, x);
+        }
+
+#if defined(__SSE2__)
+        static __m128 apply (__m128 x)
+        {
+          __m128 sign = _mm_and_ps (x, _mm_set1_ps (-0.0F));
+          __m128 a = _mm_xor_ps (x, sign);
+          __m128 one = _mm_set1_ps (1.0F);
+          __m128 a2 = _mm_mul_ps (a, a);
+          __m128 poly = _mm_add_ps (_mm_set1_ps (TANH_C5),
+                                    _mm_mul_ps (a2, _mm_set1_ps (TANH_C7)));
+          poly = _mm_add_ps (_mm_set1_ps (TANH_C3), _mm_mul_ps (a2, poly));
+          poly = _mm_add_ps (a, _mm_mul_ps (_mm_mul_ps (a, a2), poly));
+          __m128 e = fast_exp4 (_mm_mul_ps (_mm_set1_ps (-2.0F), a));
+          __m128 ratio = _mm_div_ps (_mm_sub_ps (one, e), _mm_add_ps (one, e));
+          __m128 small = _mm_cmplt_ps (a, _mm_set1_ps (TANH_SMALL));
+          __m128 y = _mm_or_ps (_mm_and_ps (small, poly),
+                                _mm_andnot_ps (small, ratio));
+          return _mm_or_ps (y, sign);
+        }
+#endif
+    };
+
+    // Tanh approximation of GELU, rewritten as x * sigmoid (2u)
+    struct gelu_op
+    {
+        static float apply (float x)
+        {
+          return x * sigmoid_op::apply (GELU_K * (x + GELU_C * x * x * x));
+        }
+
+#if defined(__SSE2__)
+        static __m128 apply (__m128 x)
+        {
+          __m128 cube = _mm_mul_ps (_mm_mul_ps (x, x), x);
+          __m128 u = _mm_add_ps (x, _mm_mul_ps (_mm_set1_ps (GELU_C), cube));
+          return _mm_mul_ps (x, sigmoid_op::apply (
+              _mm_mul_ps (_mm_set1_ps (GELU_K), u)));
+        }
+#endif
+    };
+
+    template <typename Op>
+    void map_in_place (float *x, int rows, int cols)
+    {
+      int n = rows * cols;
+      int i = 0;
+#if defined(__SSE2__)
+      for (; i + 4 <= n; i += 4)
+      {
+        _mm_storeu_ps (x + i, Op::apply (_mm_loadu_ps (x + i)));
+      }
+#endif
+      for (; i < n; ++i)
+      {
+        x[i] = Op::apply (x[i]);
+      }
+    }
+
+    void identity_in_place (float *, int, int)
+    {}
+
+    void softmax_in_place (float *x, int rows, int cols)
+    {
+      if (rows == 1 || cols == 1)
+      {
+        softmax_vector (x, x, rows * cols);
+      }
+      else
+      {
+        softmax_columns (x, x, rows, cols, false);
+      }
+    }
+
+    // The registry. A deque keeps kernels in place as it grows; built-ins
+    // come first, in Kind order.
+    std::deque<activation::Kernel> &registry ()
+    {
+      static std::deque<activation::Kernel> kernels {
+          {activation::Kind::IDENTITY, "identity", identity_in_place},
+          {activation::Kind::RELU, "relu", map_in_place<relu_op>},
+          {activation::Kind::LEAKY_RELU, "leaky_relu",
+           map_in_place<leaky_relu_op>},
+          {activation::Kind::GELU, "gelu", map_in_place<gelu_op>},
+          {activation::Kind::SIGMOID, "sigmoid", map_in_place<sigmoid_op>},
+          {activation::Kind::TANH, "tanh", map_in_place<tanh_op>},
+          {activation::Kind::SOFTMAX, "softmax", softmax_in_place}};
+      return kernels;
+    }
+
+    std::mutex registry_mutex;
+
+    // Looks a kernel up by name; the caller holds registry_mutex.
+    const activation::Kernel *find_unlocked (const std::string &name)
+    {
+      for (const activation::Kernel &candidate : registry ())
+      {
+        if (candidate.name == name)
+        {
+          return &candidate;
+        }
+      }
+      return nullptr;
+    }
+}
+
 namespace activation
 {
 
     Matrix relu (const Matrix &x)
     {
       Matrix result = x; // Copy x to apply changes
-      for (int i = 0; i < x.get_rows () * x.get_cols (); ++i)
-      {
-        // Apply ReLU treating very small positive numbers as zero
-        result[i] = std::max (0.0F, result[i]);
-      }
+      map_in_place<relu_op> (result.data (), x.get_rows (), x.get_cols ());
       return result;
     }
 
     Matrix softmax (const Matrix &x)
     {
-      Matrix result = x; // Copy x to apply changes
-      float sum_exp = 0.0F;
+      Matrix result (x.get_rows (), x.get_cols ());
+      if (x.get_rows () == 1 || x.get_cols () == 1)
+      {
+        softmax_vector (x.data (), result.data (),
+                        x.get_rows () * x.get_cols ());
+      }
+      else
+      {
+        softmax_columns (x.data (), result.data (), x.get_rows (),
+                         x.get_cols (), false);
+      }
+      return result;
+    }
 
-      // Compute the sum of exponentials
-      for (int i = 0; i < x.get_rows () * x.get_cols (); ++i)
+    Matrix log_softmax (const Matrix &x)
+    {
+      Matrix result (x.get_rows (), x.get_cols ());
+      if (x.get_rows () == 1 || x.get_cols () == 1)
+      {
+        log_softmax_vector (x.data (), result.data (),
+                            x.get_rows () * x.get_cols ());
+      }
+      else
       {
-        result[i] = std::exp (result[i]);
-        sum_exp += result[i];
+        softmax_columns (x.data (), result.data (), x.get_rows (),
+                         x.get_cols (), true);
       }
+      return result;
+    }
+
 
-      //Divide each exponentiated value by the sum of all exponentiated values
-      for (int i = 0; i < x.get_rows () * x.get_cols (); ++i)
+    const Kernel &kernel (Kind kind)
+    {
+      if (kind == Kind::CUSTOM)
       {
-        result[i] /= sum_exp;
+        throw std::exception ();
       }
+      std::lock_guard<std::mutex> lock (registry_mutex);
+      return registry ()[static_cast<size_t> (kind)];
+    }
 
-      return result;
+    const Kernel *find (const std::string &name)
+    {
+      std::lock_guard<std::mutex> lock (registry_mutex);
+      return find_unlocked (name);
     }
 
-}
\ No newline at end of file
+    const Kernel &register_kernel (const std::string &name,
+                                   InPlaceFunction in_place)
+    {
+      // One lock over the lookup and the insert keeps names unique
+      std::lock_guard<std::mutex> lock (registry_mutex);
+      if (in_place == nullptr || find_unlocked (name) != nullptr)
+      {
+        throw std::exception ();
+      }
+      registry ().push_back ({Kind::CUSTOM, name, in_place});
+      return registry ().back ();
+    }
+}
@@ -3,6 +3,9 @@
 #define ACTIVATION_H
 
 #include "Matrix.h"
+#include <string>
+
+#define LEAKY_SLOPE 0.01F
 
 // Insert Activation namespace here...
 namespace activation
@@ -15,12 +18,90 @@ namespace activation
     Matrix relu(const Matrix &x);
 
 /**
- * Applies the softmax activation function to the input matrix,
- * treating it as a single vector.
+ * Applies the softmax activation function to the input matrix.
+ * A row or column vector is treated as a single vector; any other matrix
+ * is treated as a batch with one sample per column.
+ * The maximum is subtracted before exponentiating, so large logits do not
+ * overflow. Exponentials use a polynomial approximation whose relative
+ * error is below 2.5e-7 (about 2 ulp) for arguments in [-87.3, 88].
+ * Arguments are clamped to that range, so exp of anything below -87.3
+ * gives about 1.2e-38 instead of a smaller or zero value; such
+ * probabilities are off by at most that much in absolute terms.
  * @param x The input matrix.
  * @return A matrix representing the softmax probabilities.
  */
     Matrix softmax(const Matrix &x);
+
+/**
+ * Applies log(softmax(x)) with the same vector/batch convention as softmax,
+ * computed as x - max - log(sum(exp(x - max))) so it stays finite where
+ * softmax underflows to zero.
+ * @param x The input matrix.
+ * @return A matrix of log-probabilities.
+ */
+    Matrix log_softmax(const Matrix &x);
+
+/**
+ * Built-in activations. CUSTOM marks kernels added with register_kernel.
+ */
+    enum class Kind
+    {
+        IDENTITY,
+        RELU,
+        LEAKY_RELU,
+        GELU,
+        SIGMOID,
+        TANH,
+        SOFTMAX,
+        CUSTOM
+    };
+
+/**
+ * In-place activation of a row-major rows x cols block holding one sample
+ * per column (a single vector is rows x 1 or 1 x cols).
+ */
+    typedef void (*InPlaceFunction) (float *x, int rows, int cols);
+
+/**
+ * An activation as layers use it: looked up once by name, then applied in
+ * place to whole batches.
+ * Element-wise built-ins are SIMD kernels: leaky ReLU has slope
+ * LEAKY_SLOPE below zero, GELU uses the tanh approximation, and sigmoid,
+ * tanh and GELU share softmax's exponential. softmax follows the vector /
+ * batch convention of activation::softmax.
+ */
+    struct Kernel
+    {
+        Kind kind;
+        std::string name;
+        InPlaceFunction in_place;
+    };
+
+/**
+ * @param kind A built-in activation (not CUSTOM).
+ * @return The kernel of the activation.
+ * @throws std::exception if kind is CUSTOM.
+ */
+    const Kernel &kernel(Kind kind);
+
+/**
+ * Looks an activation up by name: "identity", "relu", "leaky_relu", "gelu",
+ * "sigmoid", "tanh", "softmax" or a registered custom name.
+ * @param name The activation's name.
+ * @return The kernel, or nullptr if the name is unknown.
+ */
+    const Kernel *find(const std::string &name);
+
+/**
+ * Adds an activation to the registry. Kernels live as long as the program
+ * and cannot be replaced, so layers may keep pointers to them.
+ * @param name The name descriptors refer to it by.
+ * @param in_place The kernel function.
+ * @return The registered kernel.
+ * @throws std::exception if the name is taken or in_place is null.
+ */
+    const Kernel &register_kernel(const std::string &name,
+                                  InPlaceFunction in_place);
 }
 
 #endif //ACTIVATION_H
\ No newline at end of file
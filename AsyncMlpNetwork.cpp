@@ -0,0 +1,247 @@
+// AsyncMlpNetwork.cpp
+#include "AsyncMlpNetwork.h"
+#include <algorithm>
+
+#define IMG_SIZE (img_dims.rows * img_dims.cols)
+
+const char *InferenceCancelled::what () const noexcept
+{
+  return "inference request cancelled";
+}
+
+CancelToken::CancelToken () : flag (std::make_shared<std::atomic<bool>> (false))
+{}
+
+void CancelToken::cancel ()
+{
+  flag->store (true);
+}
+
+bool CancelToken::cancelled () const
+{
+  return flag->load ();
+}
+
+AsyncMlpNetwork::AsyncMlpNetwork (const MlpNetwork &mlp, int worker_count,
+                                  int max_batch)
+    : mlp (&mlp), slot (nullptr), max_batch (max_batch), stopping (false)
+{
+  if (worker_count <= 0 || max_batch <= 0)
+  {
+    throw std::exception ();
+  }
+  for (int i = 0; i < worker_count; ++i)
+  {
+    workers.emplace_back (&AsyncMlpNetwork::worker_loop, this, -1);
+  }
+}
+
+AsyncMlpNetwork::AsyncMlpNetwork (const MlpNetwork &mlp, int worker_count,
+                                  int max_batch, const NumaTopology &topology)
+    : mlp (&mlp), slot (nullptr), topology (topology), max_batch (max_batch),
+      stopping (false)
+{
+  if (worker_count <= 0 || max_batch <= 0)
+  {
+    throw std::exception ();
+  }
+  replicas = topology.replicate (mlp);
+  for (int i = 0; i < worker_count; ++i)
+  {
+    workers.emplace_back (&AsyncMlpNetwork::worker_loop, this,
+                          i % topology.node_count ());
+  }
+}
+
+AsyncMlpNetwork::AsyncMlpNetwork (const ModelSlot &slot, int worker_count,
+                                  int max_batch)
+    : mlp (nullptr), slot (&slot), max_batch (max_batch), stopping (false)
+{
+  if (worker_count <= 0 || max_batch <= 0)
+  {
+    throw std::exception ();
+  }
+  for (int i = 0; i < worker_count; ++i)
+  {
+    workers.emplace_back (&AsyncMlpNetwork::worker_loop, this, -1);
+  }
+}
+
+AsyncMlpNetwork::~AsyncMlpNetwork ()
+{
+  {
+    std::lock_guard<std::mutex> lock (queue_mutex);
+    stopping = true;
+  }
+  queue_ready.notify_all ();
+  for (std::thread &worker : workers)
+  {
+    worker.join ();
+  }
+}
+
+// Validates an image and wraps it into a request holding a column vector.
+static Matrix vectorized_copy (const Matrix &image)
+{
+  if (image.get_rows () * image.get_cols () != IMG_SIZE)
+  {
+    throw std::exception ();
+  }
+  Matrix copy = image;
+  return copy.vectorize ();
+}
+
+void AsyncMlpNetwork::enqueue (Request request)
+{
+  {
+    std::lock_guard<std::mutex> lock (queue_mutex);
+    queue.push_back (std::move (request));
+  }
+  queue_ready.notify_one ();
+}
+
+std::future<digit> AsyncMlpNetwork::submit (const Matrix &image,
+                                            CancelToken token)
+{
+  Request request {vectorized_copy (image), std::promise<digit> (),
+                   Callback (), token};
+  std::future<digit> result = request.promise.get_future ();
+  enqueue (std::move (request));
+  return result;
+}
+
+void AsyncMlpNetwork::submit (const Matrix &image, Callback done,
+                              CancelToken token)
+{
+  enqueue ({vectorized_copy (image), std::promise<digit> (), std::move (done),
+            token});
+}
+
+std::vector<std::future<digit>>
+AsyncMlpNetwork::submit_batch (const std::vector<Matrix> &images,
+                               CancelToken token)
+{
+  std::vector<Request> requests;
+  std::vector<std::future<digit>> results;
+  for (const Matrix &image : images)
+  {
+    requests.push_back ({vectorized_copy (image), std::promise<digit> (),
+                         Callback (), token});
+    results.push_back (requests.back ().promise.get_future ());
+  }
+
+  {
+    std::lock_guard<std::mutex> lock (queue_mutex);
+    for (Request &request : requests)
+    {
+      queue.push_back (std::move (request));
+    }
+  }
+  queue_ready.notify_all ();
+  return results;
+}
+
+// Delivers a result or an error to whichever completion the request uses.
+static void complete (digit result, std::exception_ptr error,
+                      std::promise<digit> &promise,
+                      const AsyncMlpNetwork::Callback &callback)
+{
+  if (callback)
+  {
+    callback (result, error);
+  }
+  else if (error)
+  {
+    promise.set_exception (error);
+  }
+  else
+  {
+    promise.set_value (result);
+  }
+}
+
+void AsyncMlpNetwork::worker_loop (int node)
+{
+  // Pin before allocating, so the batch buffers are first touched locally
+  const MlpNetwork *network = node < 0 ? mlp : replicas[node].get ();
+  if (node >= 0)
+  {
+    topology.pin_to_node (node);
+  }
+  std::vector<Request> batch;
+  Matrix images;
+  std::vector<prediction> results (max_batch);
+
+  while (true)
+  {
+    {
+      std::unique_lock<std::mutex> lock (queue_mutex);
+      queue_ready.wait (lock, [this]
+      { return stopping || !queue.empty (); });
+      if (queue.empty ())
+      {
+        return; // Stopping, and every queued request has been served
+      }
+      // Coalesce whatever has queued up into one forward pass
+      while (!queue.empty () && static_cast<int> (batch.size ()) < max_batch)
+      {
+        batch.push_back (std::move (queue.front ()));
+        queue.pop_front ();
+      }
+    }
+    if (slot != nullptr)
+    {
+      // Holding the reader keeps this batch's network alive across a swap
+      ModelSlot::Reader model = slot->acquire ();
+      run_batch (*model, batch, images, results);
+    }
+    else
+    {
+      run_batch (*network, batch, images, results);
+    }
+    batch.clear ();
+  }
+}
+
+void AsyncMlpNetwork::run_batch (const MlpNetwork &network,
+                                 std::vector<Request> &batch, Matrix &images,
+                                 std::vector<prediction> &results)
+{
+  // Drop cancelled requests before spending any work on them
+  auto first_cancelled = std::stable_partition (
+      batch.begin (), batch.end (), [] (const Request &request)
+      { return !request.token.cancelled (); });
+  for (auto it = first_cancelled; it != batch.end (); ++it)
+  {
+    complete ({0, 0.0F}, std::make_exception_ptr (InferenceCancelled ()),
+              it->promise, it->callback);
+  }
+  int count = static_cast<int> (first_cancelled - batch.begin ());
+  if (count == 0)
+  {
+    return;
+  }
+
+  // Stack the images as the columns of one matrix
+  std::vector<const float *> columns (count);
+  for (int j = 0; j < count; ++j)
+  {
+    columns[j] = batch[j].image.data ();
+  }
+  Matrix::stack_columns (columns.data (), count, IMG_SIZE, images);
+
+  std::exception_ptr error;
+  try
+  {
+    network.predict_batch (images, results.data (), 1);
+  }
+  catch (...)
+  {
+    error = std::current_exception ();
+  }
+  for (int j = 0; j < count; ++j)
+  {
+    complete (error ? digit {0, 0.0F} : results[j].top[0], error,
+              batch[j].promise, batch[j].callback);
+  }
+}
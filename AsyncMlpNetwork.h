@@ -0,0 +1,175 @@
+// AsyncMlpNetwork.h
+#ifndef ASYNCMLPNETWORK_H
+#define ASYNCMLPNETWORK_H
+
+#include "MlpNetwork.h"
+#include "ModelSlot.h"
+#include "NumaTopology.h"
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * Thrown through the future (or passed to the callback) of a request whose
+ * token was cancelled before a worker picked it up.
+ */
+class InferenceCancelled : public std::exception
+{
+ public:
+  const char *what () const noexcept override;
+};
+
+/**
+ * Shared cancellation flag. Copies refer to the same flag, so one token can
+ * be handed to several submissions and cancelled at once.
+ */
+class CancelToken
+{
+ private:
+  std::shared_ptr<std::atomic<bool>> flag;
+
+ public:
+  /**
+ * Creates a token that is not cancelled.
+ */
+  CancelToken ();
+
+/**
+ * Cancels every request submitted with this token that has not started.
+ */
+  void cancel ();
+
+/**
+ * @return true once cancel() was called on any copy of the token.
+ */
+  bool cancelled () const;
+};
+
+/**
+ * Non-blocking front end for an MlpNetwork. Submissions are queued and
+ * served by internal worker threads, which coalesce whatever is queued
+ * (up to max_batch images) into a single batched forward pass.
+ * The network must outlive this object and must not be modified
+ * (e.g. set_storage) while requests are in flight.
+ * Given a NumaTopology, workers are spread over its nodes and pinned there,
+ * and each one runs batches on its node's replica of the network.
+ * Given a ModelSlot, each batch runs on whichever network the slot holds
+ * when the batch starts, so models can be swapped under load.
+ */
+class AsyncMlpNetwork
+{
+ public:
+  /**
+ * Completion callback. Runs on a worker thread with either the result or,
+ * when error is set, the exception the request failed with.
+ * It must not throw.
+ */
+  typedef std::function<void (const digit &result,
+                              std::exception_ptr error)> Callback;
+
+ private:
+  struct Request
+  {
+      Matrix image;
+      std::promise<digit> promise;
+      Callback callback;
+      CancelToken token;
+  };
+
+  const MlpNetwork *mlp;
+  const ModelSlot *slot;
+  NumaTopology topology;
+  std::vector<std::unique_ptr<const MlpNetwork>> replicas; // One per node
+  int max_batch;
+  std::deque<Request> queue;
+  std::mutex queue_mutex;
+  std::condition_variable queue_ready;
+  bool stopping;
+  std::vector<std::thread> workers;
+
+  void enqueue (Request request);
+  void worker_loop (int node);
+  void run_batch (const MlpNetwork &network, std::vector<Request> &batch,
+                  Matrix &images, std::vector<prediction> &results);
+
+ public:
+  /**
+ * Starts the worker threads.
+ * @param mlp The network to run requests on.
+ * @param worker_count Number of worker threads, at least 1.
+ * @param max_batch Largest number of queued images run in one pass.
+ * @throws std::exception if worker_count or max_batch is not positive.
+ */
+  AsyncMlpNetwork (const MlpNetwork &mlp, int worker_count, int max_batch);
+
+/**
+ * Replicates the network on every node of the topology, then starts the
+ * worker threads, worker i pinned to node i % node_count. The network is
+ * only read while replicating.
+ * @param mlp The network to replicate.
+ * @param worker_count Number of worker threads, at least 1.
+ * @param max_batch Largest number of queued images run in one pass.
+ * @param topology Nodes to replicate on and pin workers to.
+ * @throws std::exception if worker_count or max_batch is not positive.
+ */
+  AsyncMlpNetwork (const MlpNetwork &mlp, int worker_count, int max_batch,
+                   const NumaTopology &topology);
+
+/**
+ * Starts the worker threads on a hot-swappable network.
+ * @param slot Slot holding the network; it must outlive this object.
+ * @param worker_count Number of worker threads, at least 1.
+ * @param max_batch Largest number of queued images run in one pass.
+ * @throws std::exception if worker_count or max_batch is not positive.
+ */
+  AsyncMlpNetwork (const ModelSlot &slot, int worker_count, int max_batch);
+
+/**
+ * Finishes every queued request, then joins the workers.
+ */
+  ~AsyncMlpNetwork ();
+
+  AsyncMlpNetwork (const AsyncMlpNetwork &) = delete;
+  AsyncMlpNetwork &operator= (const AsyncMlpNetwork &) = delete;
+
+/**
+ * Queues one image.
+ * @param image Matrix representing an image; it is copied.
+ * @param token Optional cancellation token.
+ * @return Future receiving the predicted digit, or InferenceCancelled.
+ * @throws std::exception if the image does not have img_dims elements.
+ */
+  std::future<digit> submit (const Matrix &image,
+                             CancelToken token = CancelToken ());
+
+/**
+ * Queues one image and reports the result through a callback instead of
+ * a future.
+ * @param image Matrix representing an image; it is copied.
+ * @param done Callback invoked on a worker thread on completion.
+ * @param token Optional cancellation token.
+ * @throws std::exception if the image does not have img_dims elements.
+ */
+  void submit (const Matrix &image, Callback done,
+               CancelToken token = CancelToken ());
+
+/**
+ * Queues several images at once, under a single lock.
+ * @param images Matrices representing images; they are copied.
+ * @param token Optional cancellation token shared by the whole batch.
+ * @return One future per image, in the same order.
+ * @throws std::exception if an image does not have img_dims elements.
+ */
+  std::vector<std::future<digit>>
+  submit_batch (const std::vector<Matrix> &images,
+                CancelToken token = CancelToken ());
+};
+
+#endif //ASYNCMLPNETWORK_H
@@ -5,27 +5,131 @@
 #include "Dense.h"
 
 Dense::Dense (const Matrix &weights, const Matrix &bias,
-              ActivationFunction activationFunction)
-    : weights (weights), bias (bias), activation (activationFunction)
+              const activation::Kernel &activation)
+    : Dense (std::make_shared<const Matrix> (weights),
+             std::make_shared<const Matrix> (bias), activation)
 {}
 
+Dense::Dense (std::shared_ptr<const Matrix> weights,
+              std::shared_ptr<const Matrix> bias,
+              const activation::Kernel &activation)
+    : weights (std::move (weights)), bias (std::move (bias)),
+      activation (&activation), storage (WeightStorage::DENSE)
+{
+  if (!this->weights || !this->bias)
+  {
+    throw std::exception ();
+  }
+}
+
 const Matrix &Dense::get_weights () const
 {
-  return weights;
+  return *weights;
 }
 
 const Matrix &Dense::get_bias () const
+{
+  return *bias;
+}
+
+std::shared_ptr<const Matrix> Dense::share_weights () const
+{
+  return weights;
+}
+
+std::shared_ptr<const Matrix> Dense::share_bias () const
 {
   return bias;
 }
 
-ActivationFunction Dense::get_activation () const
+const activation::Kernel &Dense::get_activation () const
+{
+  return *activation;
+}
+
+WeightStorage Dense::get_storage () const
+{
+  return storage;
+}
+
+void Dense::set_storage (WeightStorage new_storage)
+{
+  switch (new_storage)
+  {
+    case WeightStorage::DENSE:
+      sparse_weights.reset ();
+      break;
+    case WeightStorage::CSR:
+      sparse_weights = std::make_shared<const SparseMatrix> (*weights);
+      break;
+    case WeightStorage::CSC:
+      sparse_weights = std::make_shared<const SparseMatrix> (
+          SparseMatrix (*weights).transposed ());
+      break;
+  }
+  storage = new_storage;
+}
+
+void Dense::detach ()
+{
+  weights = std::make_shared<const Matrix> (*weights);
+  bias = std::make_shared<const Matrix> (*bias);
+  if (sparse_weights)
+  {
+    sparse_weights = std::make_shared<const SparseMatrix> (*sparse_weights);
+  }
+}
+
+// Wx with the layer's current weight storage
+static Matrix multiply_weights (WeightStorage storage, const Matrix &weights,
+                                const SparseMatrix *sparse_weights,
+                                const Matrix &input)
+{
+  switch (storage)
+  {
+    case WeightStorage::CSR:
+      return *sparse_weights * input;
+    case WeightStorage::CSC:
+      return sparse_weights->transposed_multiply (input);
+    default:
+      return weights * input;
+  }
+}
+
+Matrix Dense::affine (const Matrix &input) const
+{
+  if (storage == WeightStorage::DENSE && input.get_cols () == 1)
+  {
+    // Single sample: bias is written first and Wx accumulated onto it
+    return *weights * input + *bias;
+  }
+
+  // Perform Wx
+  Matrix weighted_input = multiply_weights (storage, *weights,
+                                            sparse_weights.get (), input);
+  int rows = weighted_input.get_rows ();
+  int cols = weighted_input.get_cols ();
+  float *out = weighted_input.data ();
+  const float *b = bias->data ();
+  // Add b to every sample (column) of the batch
+  for (int i = 0; i < rows; ++i)
+  {
+    for (int j = 0; j < cols; ++j)
+    {
+      out[i * cols + j] += b[i];
+    }
+  }
+  return weighted_input;
+}
+
+Matrix Dense::activate (Matrix weighted_input) const
 {
-  return activation;
+  activation->in_place (weighted_input.data (), weighted_input.get_rows (),
+                        weighted_input.get_cols ());
+  return weighted_input;
 }
 
 Matrix Dense::operator() (const Matrix &input) const
 {
-  Matrix weighted_input = weights * input + bias; // Perform Wx + b
-  return activation (weighted_input); // Apply the activation function
+  return activate (affine (input)); // Apply the activation function
 }
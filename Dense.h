@@ -3,15 +3,36 @@
 #define DENSE_H
 
 #include "Activation.h"
-typedef Matrix (*ActivationFunction) (const Matrix &);
+#include "SparseMatrix.h"
+#include <memory>
+
+/**
+ * How a Dense layer stores and multiplies its weights.
+ * DENSE - the full weight matrix
+ * CSR - only the non-zero weights, row by row; pays off for pruned weights
+ * CSC - only the non-zero weights, column by column; additionally skips
+ *       the columns met by zero inputs, which suits the first layer on
+ *       mostly-blank images
+ */
+enum class WeightStorage
+{
+    DENSE,
+    CSR,
+    CSC
+};
 
 // Insert Dense class here...
+// Parameters are immutable and held through shared pointers, so copies of a
+// layer (and layers of different networks) share them without copying.
 class Dense
 {
  private:
-  Matrix weights;
-  Matrix bias;
-  ActivationFunction activation;
+  std::shared_ptr<const Matrix> weights;
+  std::shared_ptr<const Matrix> bias;
+  const activation::Kernel *activation;
+  WeightStorage storage;
+  // CSR or CSC copy of weights, if in use
+  std::shared_ptr<const SparseMatrix> sparse_weights;
 
  public:
   /**
@@ -19,10 +40,21 @@ class Dense
    * bias, and activation function.
  * @param weights The weight matrix for the layer.
  * @param bias The bias vector for the layer.
- * @param activationFunction The activation function to apply in the layer.
+ * @param activation The activation to apply in the layer.
  */
   Dense (const Matrix &weights, const Matrix &bias,
-         ActivationFunction activationFunction);
+         const activation::Kernel &activation);
+
+/**
+ * Constructs a Dense layer sharing existing parameters.
+ * @param weights The weight matrix for the layer.
+ * @param bias The bias vector for the layer.
+ * @param activation The activation to apply in the layer.
+ * @throws std::exception if weights or bias is empty.
+ */
+  Dense (std::shared_ptr<const Matrix> weights,
+         std::shared_ptr<const Matrix> bias,
+         const activation::Kernel &activation);
 
   // Getters
   /**
@@ -38,13 +70,64 @@ class Dense
   const Matrix &get_bias () const;
 
 /**
- * Gets the layer's activation function.
- * @return The activation function.
+ * Gets the layer's weights for sharing with other layers.
+ * @return Shared pointer to the weights matrix.
+ */
+  std::shared_ptr<const Matrix> share_weights () const;
+
+/**
+ * Gets the layer's bias for sharing with other layers.
+ * @return Shared pointer to the bias vector.
+ */
+  std::shared_ptr<const Matrix> share_bias () const;
+
+/**
+ * Gets the layer's activation.
+ * @return The activation kernel.
+ */
+  const activation::Kernel &get_activation () const;
+
+/**
+ * Gets the layer's weight storage.
+ * @return The storage used by affine().
+ */
+  WeightStorage get_storage () const;
+
+/**
+ * Selects how the weights are stored for the layer's multiplication.
+ * Sparse forms keep every non-zero weight, so results only differ from
+ * the dense product by summation order.
+ * @param new_storage The storage to switch to.
+ */
+  void set_storage (WeightStorage new_storage);
+
+/**
+ * Replaces the shared parameters with private copies, e.g. to place them
+ * in memory local to the calling thread.
+ */
+  void detach ();
+
+/**
+ * Computes the layer's pre-activation output Wx + b.
+ * The input may hold a batch with one sample per column, in which case the
+ * bias is added to every column.
+ * @param input The input matrix.
+ * @return The weighted input, before the activation function.
+ */
+  Matrix affine (const Matrix &input) const;
+
+/**
+ * Applies the layer's activation to a pre-activation output, in place.
+ * Pass a temporary (or std::move) so that the buffer is moved in and
+ * back out rather than copied.
+ * @param weighted_input Output of affine ().
+ * @return weighted_input, activated.
  */
-  ActivationFunction get_activation () const;
+  Matrix activate (Matrix weighted_input) const;
 
 /**
- * Applies the layer operations to the input.
+ * Applies the layer operations to the input: affine () followed by the
+ * activation kernel, run in place on the affine result.
  * @param input The input matrix.
  * @return The result of the layer's computations.
  */
@@ -0,0 +1,223 @@
+// Ensemble.cpp
+#include "Ensemble.h"
+#include <algorithm>
+#include <cmath>
+
+#define IMG_SIZE (img_dims.rows * img_dims.cols)
+#define TTA_SHIFT 1
+#define TTA_DEGREES 10.0F
+
+Ensemble::Ensemble (std::vector<std::shared_ptr<const MlpNetwork>> members,
+                    std::vector<augmentation> augmentations)
+    : members (std::move (members)),
+      augmentations (std::move (augmentations))
+{
+  if (this->members.empty () || this->augmentations.empty ())
+  {
+    throw std::exception ();
+  }
+
+  // Give each distinct first layer a slice of rows in the stacked layer
+  int rows = 0;
+  for (size_t m = 0; m < this->members.size (); ++m)
+  {
+    const Dense &first = this->members[m]->get_layer (0);
+    int row = rows;
+    for (int owner : distinct)
+    {
+      const Dense &other = this->members[owner]->get_layer (0);
+      if (&other.get_weights () == &first.get_weights ()
+          && &other.get_bias () == &first.get_bias ()
+          && &other.get_activation () == &first.get_activation ())
+      {
+        row = first_rows[owner];
+        break;
+      }
+    }
+    first_rows.push_back (row);
+    if (row == rows)
+    {
+      distinct.push_back (static_cast<int> (m));
+      rows += first.get_weights ().get_rows ();
+    }
+  }
+
+  Matrix weights (rows, IMG_SIZE);
+  Matrix bias (rows, 1);
+  for (int owner : distinct)
+  {
+    const Dense &first = this->members[owner]->get_layer (0);
+    const Matrix &w = first.get_weights ();
+    const Matrix &b = first.get_bias ();
+    std::copy (w.data (), w.data () + w.get_rows () * IMG_SIZE,
+               weights.data () + first_rows[owner] * IMG_SIZE);
+    std::copy (b.data (), b.data () + b.get_rows (),
+               bias.data () + first_rows[owner]);
+  }
+  // Activations differ per slice, so they are applied after the GEMM
+  stacked.reset (new Dense (weights, bias,
+                            activation::kernel (activation::Kind::IDENTITY)));
+
+  for (const augmentation &aug : this->augmentations)
+  {
+    for (int y = 0; y < img_dims.rows; ++y)
+    {
+      for (int x = 0; x < img_dims.cols; ++x)
+      {
+        sources.push_back (source_of (aug, x, y));
+      }
+    }
+  }
+}
+
+std::vector<augmentation> Ensemble::default_augmentations ()
+{
+  return {{0, 0, 0.0F},
+          {TTA_SHIFT, 0, 0.0F},
+          {-TTA_SHIFT, 0, 0.0F},
+          {0, TTA_SHIFT, 0.0F},
+          {0, -TTA_SHIFT, 0.0F},
+          {0, 0, TTA_DEGREES},
+          {0, 0, -TTA_DEGREES}};
+}
+
+int Ensemble::member_count () const
+{
+  return static_cast<int> (members.size ());
+}
+
+int Ensemble::augmentation_count () const
+{
+  return static_cast<int> (augmentations.size ());
+}
+
+// Inverse mapping of output pixel (x, y) into the input image. Plain
+// shifts land on one pixel with zero weights, so they copy it exactly.
+Ensemble::pixel_source Ensemble::source_of (const augmentation &aug, int x,
+                                            int y)
+{
+  const int width = img_dims.cols, height = img_dims.rows;
+  float sx = float (x - aug.dx), sy = float (y - aug.dy);
+  if (aug.degrees != 0.0F)
+  {
+    float radians = aug.degrees * static_cast<float> (M_PI) / 180.0F;
+    float c = std::cos (radians), s = std::sin (radians);
+    float cx = (width - 1) / 2.0F, cy = (height - 1) / 2.0F;
+    float u = x - aug.dx - cx, v = y - aug.dy - cy;
+    sx = c * u + s * v + cx;
+    sy = -s * u + c * v + cy;
+  }
+  int x0 = static_cast<int> (std::floor (sx));
+  int y0 = static_cast<int> (std::floor (sy));
+  auto index = [&] (int px, int py)
+  {
+    return px >= 0 && px < width && py >= 0 && py < height
+           ? py * width + px : -1;
+  };
+  return {{index (x0, y0), index (x0 + 1, y0), index (x0, y0 + 1),
+           index (x0 + 1, y0 + 1)}, sx - x0, sy - y0};
+}
+
+void Ensemble::augment (const Matrix &images, Matrix &batch) const
+{
+  int count = images.get_cols ();
+  int variants = augmentation_count ();
+  int cols = count * variants;
+  // The augmented copies are written straight into the batch, one row
+  // (pixel) at a time, reading the matching input rows of all images in
+  // order. Variants of an image sit in adjacent columns; taps outside the
+  // image read a blank row.
+  std::vector<float> blank (count, 0.0F);
+  for (int p = 0; p < IMG_SIZE; ++p)
+  {
+    float *dst = batch.data () + p * cols;
+    for (int a = 0; a < variants; ++a)
+    {
+      const pixel_source &source = sources[a * IMG_SIZE + p];
+      const float *tap[4];
+      for (int t = 0; t < 4; ++t)
+      {
+        tap[t] = source.taps[t] < 0 ? blank.data ()
+                                    : images.data () + source.taps[t] * count;
+      }
+      float fx = source.fx, fy = source.fy;
+      for (int j = 0; j < count; ++j)
+      {
+        float top = tap[0][j] * (1 - fx) + tap[1][j] * fx;
+        float bottom = tap[2][j] * (1 - fx) + tap[3][j] * fx;
+        dst[j * variants + a] = top * (1 - fy) + bottom * fy;
+      }
+    }
+  }
+}
+
+prediction Ensemble::predict (const Matrix &input, unsigned int k) const
+{
+  if (input.get_rows () * input.get_cols () != IMG_SIZE)
+  {
+    throw std::exception ();
+  }
+  Matrix image = input;
+  prediction result;
+  predict_batch (image.vectorize (), &result, k);
+  return result;
+}
+
+void Ensemble::predict_batch (const Matrix &images, prediction results[],
+                              unsigned int k) const
+{
+  if (k == 0 || k > DIGITS_COUNT || images.get_rows () != IMG_SIZE)
+  {
+    throw std::exception ();
+  }
+  int count = images.get_cols ();
+  int variants = augmentation_count ();
+  int cols = count * variants;
+
+  Matrix batch (IMG_SIZE, cols);
+  augment (images, batch);
+  Matrix hidden = stacked->affine (batch);
+  for (int owner : distinct)
+  {
+    const Dense &first = members[owner]->get_layer (0);
+    first.get_activation ().in_place (
+        hidden.data () + first_rows[owner] * cols,
+        first.get_weights ().get_rows (), cols);
+  }
+
+  // Sum every member's output over its variants of each image
+  std::vector<float> average (DIGITS_COUNT * count, 0.0F);
+  for (size_t m = 0; m < members.size (); ++m)
+  {
+    const MlpNetwork &member = *members[m];
+    int rows = member.get_layer (0).get_weights ().get_rows ();
+    Matrix output (rows, cols);
+    const float *slice = hidden.data () + first_rows[m] * cols;
+    std::copy (slice, slice + rows * cols, output.data ());
+    for (int i = 1; i < member.layer_count (); ++i)
+    {
+      output = member.get_layer (i) (output);
+    }
+    for (int d = 0; d < DIGITS_COUNT; ++d)
+    {
+      const float *row = output.data () + d * cols;
+      for (int j = 0; j < count; ++j)
+      {
+        for (int a = 0; a < variants; ++a)
+        {
+          average[d * count + j] += row[j * variants + a];
+        }
+      }
+    }
+  }
+
+  float scale = 1.0F / static_cast<float> (member_count () * variants);
+  for (float &value : average)
+  {
+    value *= scale;
+  }
+  for (int j = 0; j < count; ++j)
+  {
+    fill_prediction (average.data () + j, count, k, results[j]);
+  }
+}
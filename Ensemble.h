@@ -0,0 +1,107 @@
+// Ensemble.h
+#ifndef ENSEMBLE_H
+#define ENSEMBLE_H
+
+#include "MlpNetwork.h"
+#include <memory>
+#include <vector>
+
+/**
+ * @struct augmentation
+ * @brief A test-time variant of the input image: rotated about the image
+ *        center, then shifted.
+ * @var dx - shift to the right, in pixels
+ * @var dy - shift downwards, in pixels
+ * @var degrees - clockwise rotation
+ */
+typedef struct augmentation
+{
+    int dx;
+    int dy;
+    float degrees;
+} augmentation;
+
+/**
+ * Averages the output distributions of several networks over several
+ * augmented copies of every image.
+ * A batch of N images becomes one batch of N * augmentation_count ()
+ * columns, the augmented copies written straight into it. The distinct
+ * first layers of all members are stacked into one wider layer, so the
+ * first (and by far the largest) GEMM runs once for the whole ensemble;
+ * members whose first layer shares its parameters (see ModelRegistry)
+ * are stacked only once. The deeper layers run per member on the same
+ * wide batch. Members must not be modified while the ensemble is in use;
+ * the stacked layer always uses dense weight storage.
+ */
+class Ensemble
+{
+ private:
+  // Where one augmented pixel samples its input: the input pixels at
+  // (x0, y0), (x0 + 1, y0), (x0, y0 + 1) and (x0 + 1, y0 + 1), -1 where
+  // outside the image, blended bilinearly by fx and fy
+  struct pixel_source
+  {
+      int taps[4];
+      float fx, fy;
+  };
+
+  std::vector<std::shared_ptr<const MlpNetwork>> members;
+  std::vector<augmentation> augmentations;
+  std::vector<pixel_source> sources; // Every pixel, per augmentation
+  std::unique_ptr<Dense> stacked; // Distinct first layers, one above another
+  std::vector<int> first_rows;    // Row of each member's slice in stacked
+  std::vector<int> distinct;      // Members owning a slice, in row order
+
+  static pixel_source source_of (const augmentation &aug, int x, int y);
+  void augment (const Matrix &images, Matrix &batch) const;
+
+ public:
+  /**
+ * @param members The networks to average, owned jointly with the caller.
+ * @param augmentations Variants of each image to average over; the
+ *        default only uses the image itself.
+ * @throws std::exception if members or augmentations is empty.
+ */
+  Ensemble (std::vector<std::shared_ptr<const MlpNetwork>> members,
+            std::vector<augmentation> augmentations = {{0, 0, 0.0F}});
+
+/**
+ * The image itself, one-pixel shifts in every direction and rotations of
+ * +-10 degrees.
+ */
+  static std::vector<augmentation> default_augmentations ();
+
+/**
+ * @return Number of member networks.
+ */
+  int member_count () const;
+
+/**
+ * @return Number of variants each image is evaluated on.
+ */
+  int augmentation_count () const;
+
+/**
+ * Predicts one image, averaging over members and augmentations.
+ * @param input Matrix representing an image.
+ * @param k Number of top digits to report, between 1 and DIGITS_COUNT.
+ * @return prediction struct for the image.
+ * @throws std::exception if k is out of range or the image does not have
+ *         img_dims elements.
+ */
+  prediction predict (const Matrix &input, unsigned int k) const;
+
+/**
+ * Predicts a batch of images, averaging over members and augmentations.
+ * @param images Matrix holding one vectorized image per column.
+ * @param results Caller-provided array with room for one prediction per
+ *        column of images.
+ * @param k Number of top digits to report, between 1 and DIGITS_COUNT.
+ * @throws std::exception if k is out of range or images do not have
+ *         img_dims rows.
+ */
+  void predict_batch (const Matrix &images, prediction results[],
+                      unsigned int k) const;
+};
+
+#endif //ENSEMBLE_H
\ No newline at end of file
@@ -0,0 +1,725 @@
+// KernelCheck.cpp
+#include "KernelCheck.h"
+#include "MlpIO.h"
+#include "Reduce.h"
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstring>
+#include <functional>
+#include <numeric>
+#include <random>
+#include <sstream>
+
+#define MAX_RANDOM_DIM 67
+#define MAX_RREF_DIM 24
+#define RREF_EPSILON 0.001
+#define SPARSE_FRACTION 0.5F
+#define LOADER_SEED_IMAGES 3
+
+namespace
+{
+    typedef std::function<bool (float got, float expected, int index)> Within;
+
+    // Counts one case: every element of got must be within its tolerance
+    void record (kernel_check::result &tally, const Matrix &got,
+                 const Matrix &expected, const Within &within)
+    {
+      ++tally.cases;
+      if (got.get_rows () != expected.get_rows ()
+          || got.get_cols () != expected.get_cols ())
+      {
+        ++tally.failures;
+        return;
+      }
+      bool failed = false;
+      for (int i = 0; i < got.get_rows () * got.get_cols (); ++i)
+      {
+        float g = got.data ()[i], e = expected.data ()[i];
+        if (std::isnan (g) && std::isnan (e))
+        {
+          continue; // NaN where the reference has NaN agrees
+        }
+        tally.max_ulp = std::max (tally.max_ulp,
+                                  kernel_check::ulp_distance (g, e));
+        tally.max_error = std::max (tally.max_error, std::abs (g - e));
+        failed = failed || !within (g, e, i);
+      }
+      tally.failures += failed;
+    }
+
+    bool exact (float got, float expected, int)
+    {
+      return kernel_check::ulp_distance (got, expected) == 0;
+    }
+
+    bool close_activation (float got, float expected, int)
+    {
+      return kernel_check::ulp_distance (got, expected) <= CHECK_ACTIVATION_ULPS
+             || std::abs (got - expected) <= CHECK_ACTIVATION_ABS;
+    }
+
+    Matrix random_matrix (int rows, int cols, std::mt19937 &random,
+                          float zero_fraction = 0.0F)
+    {
+      std::uniform_real_distribution<float> value (-1.0F, 1.0F);
+      std::uniform_real_distribution<float> unit (0.0F, 1.0F);
+      Matrix m (rows, cols);
+      for (int i = 0; i < rows * cols; ++i)
+      {
+        m.data ()[i] = unit (random) < zero_fraction ? 0.0F : value (random);
+      }
+      return m;
+    }
+
+    Matrix absolute (const Matrix &m)
+    {
+      Matrix result = m;
+      for (int i = 0; i < m.get_rows () * m.get_cols (); ++i)
+      {
+        result.data ()[i] = std::abs (m.data ()[i]);
+      }
+      return result;
+    }
+
+    // Shape of product case c: every fourth one is a layer of the network
+    void product_shape (int c, std::mt19937 &random, int &m, int &k, int &n)
+    {
+      std::uniform_int_distribution<int> dim (1, MAX_RANDOM_DIM);
+      const int batches[] = {1, 8, 64};
+      if (c % 4 == 0)
+      {
+        m = weights_dims[(c / 4) % MLP_SIZE].rows;
+        k = weights_dims[(c / 4) % MLP_SIZE].cols;
+        n = batches[(c / 4 / MLP_SIZE) % 3];
+      }
+      else
+      {
+        m = dim (random);
+        k = dim (random);
+        n = dim (random);
+      }
+    }
+
+    // Error bound of a k-term float dot product, for any summation order
+    Within product_bound (const Matrix &magnitudes, int k)
+    {
+      return [&magnitudes, k] (float got, float expected, int index)
+      {
+        return std::abs (got - expected)
+               <= (k + 2) * FLT_EPSILON * magnitudes.data ()[index];
+      };
+    }
+
+    void check_products (int cases, std::mt19937 &random,
+                         std::vector<kernel_check::result> &results)
+    {
+      kernel_check::result gemm {"gemm", 0, 0, 0, 0.0F};
+      kernel_check::result gemm_add {"gemm + matrix", 0, 0, 0, 0.0F};
+      kernel_check::result csr {"csr multiply", 0, 0, 0, 0.0F};
+      kernel_check::result csc {"csc multiply", 0, 0, 0, 0.0F};
+      for (int c = 0; c < cases; ++c)
+      {
+        int m, k, n;
+        product_shape (c, random, m, k, n);
+        Matrix a = random_matrix (m, k, random, c % 2 ? SPARSE_FRACTION : 0.0F);
+        Matrix b = random_matrix (k, n, random, c % 3 ? 0.0F : SPARSE_FRACTION);
+        Matrix addend = random_matrix (m, n, random);
+        Matrix expected = kernel_check::multiply (a, b);
+        Matrix magnitudes = kernel_check::multiply (absolute (a), absolute (b));
+        Within bound = product_bound (magnitudes, k);
+
+        record (gemm, a * b, expected, bound);
+        Matrix sum = a * b + addend;
+        Matrix expected_sum = expected;
+        Matrix magnitudes_sum = magnitudes;
+        for (int i = 0; i < m * n; ++i)
+        {
+          expected_sum.data ()[i] += addend.data ()[i];
+          magnitudes_sum.data ()[i] += std::abs (addend.data ()[i]);
+        }
+        record (gemm_add, sum, expected_sum,
+                product_bound (magnitudes_sum, k + 1));
+
+        SparseMatrix sparse (a);
+        record (csr, sparse * b, expected, bound);
+        record (csc, sparse.transposed ().transposed_multiply (b), expected,
+                bound);
+      }
+      results.insert (results.end (), {gemm, gemm_add, csr, csc});
+    }
+
+    void check_elementwise (int cases, std::mt19937 &random,
+                            std::vector<kernel_check::result> &results)
+    {
+      kernel_check::result dot {"dot", 0, 0, 0, 0.0F};
+      kernel_check::result transpose {"transpose", 0, 0, 0, 0.0F};
+      kernel_check::result in_place {"transpose_in_place", 0, 0, 0, 0.0F};
+      kernel_check::result copy {"transpose_copy", 0, 0, 0, 0.0F};
+      kernel_check::result sum {"sum / norm", 0, 0, 0, 0.0F};
+      std::uniform_int_distribution<int> dim (1, MAX_RANDOM_DIM);
+      for (int c = 0; c < cases; ++c)
+      {
+        int rows = dim (random), cols = dim (random);
+        if (c % 4 == 0)
+        {
+          rows = weights_dims[(c / 4) % MLP_SIZE].rows;
+          cols = weights_dims[(c / 4) % MLP_SIZE].cols;
+        }
+        Matrix a = random_matrix (rows, cols, random);
+        Matrix b = random_matrix (rows, cols, random);
+
+        Matrix expected (rows, cols);
+        for (int i = 0; i < rows * cols; ++i)
+        {
+          expected.data ()[i] = a.data ()[i] * b.data ()[i];
+        }
+        record (dot, a.dot (b), expected, exact);
+
+        Matrix transposed = kernel_check::transpose (a);
+        Matrix t = a;
+        record (transpose, t.transpose (), transposed, exact);
+        t = a;
+        record (in_place, t.transpose_in_place (), transposed, exact);
+        Matrix raw (cols, rows);
+        Matrix::transpose_copy (a.data (), rows, cols, raw.data ());
+        record (copy, raw, transposed, exact);
+
+        double total = 0.0, magnitude = 0.0, squares = 0.0;
+        for (int i = 0; i < rows * cols; ++i)
+        {
+          total += a.data ()[i];
+          magnitude += std::abs (a.data ()[i]);
+          squares += double (a.data ()[i]) * a.data ()[i];
+        }
+        float tolerance = (rows * cols + 2) * FLT_EPSILON;
+        Matrix got (1, 2), reference (1, 2);
+        got[0] = a.sum ();
+        got[1] = a.norm ();
+        reference[0] = static_cast<float> (total);
+        reference[1] = static_cast<float> (std::sqrt (squares));
+        record (sum, got, reference, [=] (float g, float e, int index)
+        {
+          return std::abs (g - e) <= tolerance * (index == 0 ? magnitude : e);
+        });
+      }
+      results.insert (results.end (), {dot, transpose, in_place, copy, sum});
+    }
+
+    void check_rref (int cases, std::mt19937 &random,
+                     std::vector<kernel_check::result> &results)
+    {
+      kernel_check::result tally {"rref", 0, 0, 0, 0.0F};
+      std::uniform_int_distribution<int> dim (1, MAX_RREF_DIM);
+      for (int c = 0; c < cases; ++c)
+      {
+        // Dominant diagonals keep every pivot far from the threshold; a
+        // duplicated row makes some cases rank deficient
+        int rows = dim (random), cols = dim (random);
+        Matrix m = random_matrix (rows, cols, random);
+        for (int i = 0; i < std::min (rows, cols); ++i)
+        {
+          m (i, i) += m (i, i) < 0.0F ? -float (cols) : float (cols);
+        }
+        if (rows > 1 && c % 2)
+        {
+          std::copy (m.data (), m.data () + cols, m.data () + (rows - 1) * cols);
+        }
+        record (tally, m.rref (), kernel_check::rref (m),
+                [] (float got, float expected, int)
+                { return std::abs (got - expected) <= CHECK_RREF_ABS; });
+      }
+      results.push_back (tally);
+    }
+
+    void check_ranking (int cases, std::mt19937 &random,
+                        std::vector<kernel_check::result> &results)
+    {
+      kernel_check::result tally {"top_k", 0, 0, 0, 0.0F};
+      // Few distinct values, so most cases rank tied digits
+      const float values[] = {0.1F, 0.3F, 0.5F};
+      std::uniform_int_distribution<int> pick (0, 2);
+      std::uniform_int_distribution<unsigned int> top (1, DIGITS_COUNT);
+      for (int c = 0; c < cases; ++c)
+      {
+        float probabilities[DIGITS_COUNT];
+        for (float &p : probabilities)
+        {
+          p = values[pick (random)];
+        }
+        unsigned int k = top (random);
+        prediction ranked;
+        fill_prediction (probabilities, 1, k, ranked);
+
+        // Reference: digits by descending probability, ties by digit
+        unsigned int order[DIGITS_COUNT];
+        std::iota (order, order + DIGITS_COUNT, 0U);
+        std::stable_sort (order, order + DIGITS_COUNT,
+                          [&] (unsigned int a, unsigned int b)
+                          { return probabilities[a] > probabilities[b]; });
+        Matrix got (1, int (k)), expected (1, int (k));
+        for (unsigned int i = 0; i < k; ++i)
+        {
+          got[int (i)] = float (ranked.top[i].value);
+          expected[int (i)] = float (order[i]);
+        }
+        record (tally, got, expected, exact);
+        tally.failures += ranked.k != k;
+      }
+      results.push_back (tally);
+    }
+
+    void check_activations (int cases, std::mt19937 &random,
+                            std::vector<kernel_check::result> &results)
+    {
+      const activation::Kind kinds[] = {
+          activation::Kind::IDENTITY, activation::Kind::RELU,
+          activation::Kind::LEAKY_RELU, activation::Kind::GELU,
+          activation::Kind::SIGMOID, activation::Kind::TANH,
+          activation::Kind::SOFTMAX};
+      std::uniform_int_distribution<int> dim (1, MAX_RANDOM_DIM);
+      std::uniform_real_distribution<float> scale (0.01F, 40.0F);
+      for (activation::Kind kind : kinds)
+      {
+        const activation::Kernel &kernel = activation::kernel (kind);
+        kernel_check::result tally {kernel.name, 0, 0, 0, 0.0F};
+        bool bit_exact = kind == activation::Kind::IDENTITY
+                         || kind == activation::Kind::RELU;
+        for (int c = 0; c < cases; ++c)
+        {
+          // Spread the inputs over a random range, tails included
+          Matrix x = random_matrix (dim (random), dim (random), random);
+          float range = scale (random);
+          for (int i = 0; i < x.get_rows () * x.get_cols (); ++i)
+          {
+            x.data ()[i] *= range;
+          }
+          Matrix got = x;
+          kernel.in_place (got.data (), got.get_rows (), got.get_cols ());
+          record (tally, got, kernel_check::activate (kind, x),
+                  bit_exact ? Within (exact) : Within (close_activation));
+        }
+
+        // A NaN in the SIMD body and one in the scalar tail must both come
+        // out as the reference has them
+        Matrix x = random_matrix (3, 11, random);
+        x (0, 1) = NAN;
+        x (2, 9) = NAN;
+        Matrix got = x;
+        kernel.in_place (got.data (), got.get_rows (), got.get_cols ());
+        record (tally, got, kernel_check::activate (kind, x),
+                bit_exact ? Within (exact) : Within (close_activation));
+        results.push_back (tally);
+      }
+    }
+
+    void check_network (int cases, std::mt19937 &random,
+                        const MlpNetwork &mlp,
+                        std::vector<kernel_check::result> &results)
+    {
+      kernel_check::result tally {"network", 0, 0, 0, 0.0F};
+      std::uniform_real_distribution<float> pixel (0.0F, 1.0F);
+      const int batches[] = {1, 7, 64};
+      int size = img_dims.rows * img_dims.cols;
+      for (int c = 0; c < cases; ++c)
+      {
+        int count = batches[c % 3];
+        Matrix images (size, count);
+        for (int i = 0; i < size * count; ++i)
+        {
+          images.data ()[i] = pixel (random);
+        }
+        std::vector<prediction> predictions (count);
+        mlp.predict_batch (images, predictions.data (), 1);
+        Matrix expected = kernel_check::forward (mlp, images);
+
+        Matrix got (DIGITS_COUNT, count);
+        for (int j = 0; j < count; ++j)
+        {
+          for (int d = 0; d < DIGITS_COUNT; ++d)
+          {
+            got (d, j) = predictions[j].probabilities[d];
+          }
+        }
+        record (tally, got, expected, [] (float g, float e, int)
+        { return std::abs (g - e) <= CHECK_NETWORK_ABS; });
+
+        // The top digit must agree unless the reference's top two tie
+        for (int j = 0; j < count && tally.failures < tally.cases; ++j)
+        {
+          unsigned int top = predictions[j].top[0].value;
+          float best = expected (top, j);
+          for (int d = 0; d < DIGITS_COUNT; ++d)
+          {
+            if (expected (d, j) > best + CHECK_NETWORK_ABS)
+            {
+              ++tally.failures;
+              break;
+            }
+          }
+        }
+      }
+      results.push_back (tally);
+    }
+
+    void append_big_endian (std::string &bytes, uint32_t value)
+    {
+      for (int shift = 24; shift >= 0; shift -= 8)
+      {
+        bytes += static_cast<char> ((value >> shift) & 0xFF);
+      }
+    }
+
+    // Randomly truncates, corrupts or rewrites header words of a file
+    std::string mutate (std::string bytes, std::mt19937 &random)
+    {
+      std::uniform_int_distribution<int> choice (0, 2);
+      std::uniform_int_distribution<size_t> position (0, bytes.size () - 1);
+      switch (choice (random))
+      {
+        case 0:
+          bytes.resize (position (random));
+          break;
+        case 1:
+          for (int flips = 1 + choice (random); flips > 0; --flips)
+          {
+            bytes[position (random)] ^= static_cast<char> (1 + random () % 255);
+          }
+          break;
+        default:
+        {
+          size_t at = std::min (bytes.size (), size_t (4 + 4 * choice (random)));
+          std::string word;
+          append_big_endian (word, static_cast<uint32_t> (random ()));
+          bytes.replace (at, std::min (size_t (4), bytes.size () - at), word);
+          break;
+        }
+      }
+      return bytes;
+    }
+
+    void check_loaders (int cases, std::mt19937 &random,
+                        std::vector<kernel_check::result> &results)
+    {
+      int size = img_dims.rows * img_dims.cols;
+      std::string idx_images, idx_labels, pgm, raw;
+      append_big_endian (idx_images, 0x00000803U);
+      append_big_endian (idx_images, LOADER_SEED_IMAGES);
+      append_big_endian (idx_images, img_dims.rows);
+      append_big_endian (idx_images, img_dims.cols);
+      append_big_endian (idx_labels, 0x00000801U);
+      append_big_endian (idx_labels, LOADER_SEED_IMAGES);
+      pgm = "P5\n# seed\n" + std::to_string (img_dims.cols) + " "
+            + std::to_string (img_dims.rows) + "\n255\n";
+      for (int i = 0; i < LOADER_SEED_IMAGES * size; ++i)
+      {
+        idx_images += static_cast<char> (random () % 256);
+      }
+      for (int i = 0; i < LOADER_SEED_IMAGES; ++i)
+      {
+        idx_labels += static_cast<char> (random () % DIGITS_COUNT);
+      }
+      for (int i = 0; i < size; ++i)
+      {
+        pgm += static_cast<char> (random () % 256);
+      }
+      Matrix values = random_matrix (img_dims.rows, img_dims.cols, random);
+      raw.assign (reinterpret_cast<const char *> (values.data ()),
+                  size * sizeof (float));
+      // Indexed by kernel_check::Loader
+      const std::string *seeds[] = {&idx_images, &idx_labels, &pgm, &pgm,
+                                    &raw};
+
+      kernel_check::result tally {"loaders", 0, 0, 0, 0.0F};
+      std::streambuf *log = std::cerr.rdbuf (nullptr); // Silence rejections
+      int loaders = static_cast<int> (kernel_check::Loader::COUNT);
+      for (int c = 0; c < cases; ++c)
+      {
+        kernel_check::Loader loader = static_cast<kernel_check::Loader> (
+            c % loaders);
+        // The unmutated seeds must load, the mutations must not break
+        std::string bytes = c < loaders ? *seeds[c]
+                                        : mutate (*seeds[c % loaders], random);
+        ++tally.cases;
+        if (!kernel_check::feed_loader (loader, bytes, c < loaders))
+        {
+          ++tally.failures;
+        }
+      }
+      std::cerr.rdbuf (log);
+      results.push_back (tally);
+    }
+}
+
+namespace kernel_check
+{
+    int64_t ulp_distance (float a, float b)
+    {
+      if (std::isnan (a) || std::isnan (b))
+      {
+        return INT64_MAX;
+      }
+      // Map the floats onto a monotonic integer line, -0 and +0 together
+      auto line = [] (float f)
+      {
+        int32_t bits;
+        std::memcpy (&bits, &f, sizeof (bits));
+        return bits < 0 ? int64_t (INT32_MIN) - bits : int64_t (bits);
+      };
+      return std::abs (line (a) - line (b));
+    }
+
+    Matrix multiply (const Matrix &a, const Matrix &b)
+    {
+      if (a.get_cols () != b.get_rows ())
+      {
+        throw std::exception ();
+      }
+      Matrix c (a.get_rows (), b.get_cols ());
+      for (int i = 0; i < a.get_rows (); ++i)
+      {
+        for (int j = 0; j < b.get_cols (); ++j)
+        {
+          double sum = 0.0;
+          for (int k = 0; k < a.get_cols (); ++k)
+          {
+            sum += double (a (i, k)) * b (k, j);
+          }
+          c (i, j) = static_cast<float> (sum);
+        }
+      }
+      return c;
+    }
+
+    Matrix transpose (const Matrix &m)
+    {
+      Matrix t (m.get_cols (), m.get_rows ());
+      for (int i = 0; i < m.get_rows (); ++i)
+      {
+        for (int j = 0; j < m.get_cols (); ++j)
+        {
+          t (j, i) = m (i, j);
+        }
+      }
+      return t;
+    }
+
+    Matrix rref (const Matrix &m)
+    {
+      int rows = m.get_rows (), cols = m.get_cols ();
+      std::vector<double> a (m.data (), m.data () + rows * cols);
+      int rank = 0;
+      for (int col = 0; col < cols && rank < rows; ++col)
+      {
+        int pivot = rank;
+        for (int i = rank + 1; i < rows; ++i)
+        {
+          if (std::abs (a[i * cols + col]) > std::abs (a[pivot * cols + col]))
+          {
+            pivot = i;
+          }
+        }
+        if (std::abs (a[pivot * cols + col]) < RREF_EPSILON)
+        {
+          continue;
+        }
+        for (int j = 0; j < cols; ++j)
+        {
+          std::swap (a[rank * cols + j], a[pivot * cols + j]);
+        }
+        double scale = a[rank * cols + col];
+        for (int j = 0; j < cols; ++j)
+        {
+          a[rank * cols + j] /= scale;
+        }
+        for (int i = 0; i < rows; ++i)
+        {
+          double factor = a[i * cols + col];
+          if (i != rank && factor != 0.0)
+          {
+            for (int j = 0; j < cols; ++j)
+            {
+              a[i * cols + j] -= factor * a[rank * cols + j];
+            }
+          }
+        }
+        ++rank;
+      }
+      std::fill (a.begin () + rank * cols, a.end (), 0.0);
+      Matrix result (rows, cols);
+      std::copy (a.begin (), a.end (), result.data ());
+      return result;
+    }
+
+    Matrix activate (activation::Kind kind, const Matrix &x)
+    {
+      int rows = x.get_rows (), cols = x.get_cols ();
+      Matrix y (rows, cols);
+      if (kind == activation::Kind::SOFTMAX)
+      {
+        // A vector is one sample, anything else one sample per column
+        bool vector = rows == 1 || cols == 1;
+        int samples = vector ? 1 : cols, length = vector ? rows * cols : rows;
+        int step = vector ? 1 : cols;
+        for (int s = 0; s < samples; ++s)
+        {
+          double max = -INFINITY, total = 0.0;
+          for (int i = 0; i < length; ++i)
+          {
+            max = std::max (max, double (x.data ()[s + i * step]));
+          }
+          for (int i = 0; i < length; ++i)
+          {
+            total += std::exp (x.data ()[s + i * step] - max);
+          }
+          for (int i = 0; i < length; ++i)
+          {
+            y.data ()[s + i * step] =
+                static_cast<float> (std::exp (x.data ()[s + i * step] - max)
+                                    / total);
+          }
+        }
+        return y;
+      }
+
+      for (int i = 0; i < rows * cols; ++i)
+      {
+        double v = x.data ()[i], out;
+        switch (kind)
+        {
+          case activation::Kind::IDENTITY:
+            out = v;
+            break;
+          case activation::Kind::RELU:
+            out = v < 0.0 ? 0.0 : v; // NaN stays NaN
+            break;
+          case activation::Kind::LEAKY_RELU:
+            out = v > 0.0 ? v : double (LEAKY_SLOPE) * v;
+            break;
+          case activation::Kind::GELU:
+            out = 0.5 * v * (1.0 + std::tanh (std::sqrt (2.0 / M_PI)
+                                              * (v + 0.044715 * v * v * v)));
+            break;
+          case activation::Kind::SIGMOID:
+            out = 1.0 / (1.0 + std::exp (-v));
+            break;
+          case activation::Kind::TANH:
+            out = std::tanh (v);
+            break;
+          default:
+            throw std::exception ();
+        }
+        y.data ()[i] = static_cast<float> (out);
+      }
+      return y;
+    }
+
+    Matrix forward (const MlpNetwork &mlp, const Matrix &input)
+    {
+      Matrix current = input;
+      for (int l = 0; l < mlp.layer_count (); ++l)
+      {
+        const Dense &layer = mlp.get_layer (l);
+        Matrix z = multiply (layer.get_weights (), current);
+        for (int i = 0; i < z.get_rows (); ++i)
+        {
+          for (int j = 0; j < z.get_cols (); ++j)
+          {
+            z (i, j) += layer.get_bias ()[i];
+          }
+        }
+        current = activate (layer.get_activation ().kind, z);
+      }
+      return current;
+    }
+
+    bool feed_loader (Loader loader, const std::string &bytes,
+                      bool must_accept)
+    {
+      std::istringstream in (bytes);
+      int size = img_dims.rows * img_dims.cols;
+      bool accepted;
+      bool valid = true;
+      try
+      {
+        switch (loader)
+        {
+          case Loader::IDX_IMAGES:
+          {
+            Matrix images;
+            accepted = readIdxImages (in, images);
+            valid = !accepted
+                    || (images.get_cols () == size
+                        && size_t (images.get_rows ()) * size + 16
+                           <= bytes.size ()
+                        && *std::min_element (images.data (), images.data ()
+                                              + images.get_rows () * size)
+                           >= 0.0F
+                        && *std::max_element (images.data (), images.data ()
+                                              + images.get_rows () * size)
+                           <= 1.0F);
+            break;
+          }
+          case Loader::IDX_LABELS:
+          {
+            std::vector<unsigned int> labels;
+            accepted = readIdxLabels (in, labels);
+            valid = !accepted
+                    || (labels.size () + 8 <= bytes.size ()
+                        && std::all_of (labels.begin (), labels.end (),
+                                        [] (unsigned int label)
+                                        { return label < DIGITS_COUNT; }));
+            break;
+          }
+          case Loader::PGM:
+          {
+            std::vector<unsigned char> pixels;
+            int width = 0, height = 0;
+            accepted = readPgm (in, pixels, width, height);
+            valid = !accepted
+                    || (width > 0 && height > 0
+                        && pixels.size () == size_t (width) * height
+                        && pixels.size () < bytes.size ());
+            break;
+          }
+          case Loader::PGM_IMAGE:
+          {
+            Matrix img (img_dims.rows, img_dims.cols);
+            accepted = readPgmToMatrix (in, img, bytes.size () % 2 == 0);
+            valid = !accepted
+                    || std::all_of (img.data (), img.data () + size,
+                                    [] (float x)
+                                    { return std::isfinite (x); });
+            break;
+          }
+          default:
+          {
+            Matrix img (img_dims.rows, img_dims.cols);
+            accepted = readFileToMatrix (in, img);
+            valid = accepted == (bytes.size () == size * sizeof (float));
+            break;
+          }
+        }
+      }
+      catch (...)
+      {
+        return false;
+      }
+      return valid && (accepted || !must_accept);
+    }
+
+    std::vector<result> run (int cases, unsigned int seed,
+                             const MlpNetwork &mlp)
+    {
+      std::mt19937 random (seed);
+      std::vector<result> results;
+      check_products (cases, random, results);
+      check_elementwise (cases, random, results);
+      check_rref (cases, random, results);
+      check_ranking (cases, random, results);
+      check_activations (cases, random, results);
+      check_network (cases, random, mlp, results);
+      check_loaders (cases, random, results);
+      return results;
+    }
+}
@@ -0,0 +1,132 @@
+// KernelCheck.h
+#ifndef KERNELCHECK_H
+#define KERNELCHECK_H
+
+#include "MlpNetwork.h"
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/**
+ * Differential checks of the optimized kernels against plain scalar
+ * references, on random shapes and values (the layer shapes of
+ * weights_dims included). The references accumulate in double; results
+ * must match within per-kernel tolerances:
+ * - products: |c - ref| <= (k + 2) * FLT_EPSILON * sum |a_ik * b_kj|,
+ *   a bound that holds for any summation order
+ * - transposes, Hadamard products and ReLU: bit-exact
+ * - other activations: CHECK_ACTIVATION_ULPS ulp, or CHECK_ACTIVATION_ABS
+ *   absolute where the output is tiny
+ * - sums: n * FLT_EPSILON relative to the sum of magnitudes
+ * - rref: CHECK_RREF_ABS absolute, on well-conditioned inputs
+ * - top-k ranking of fill_prediction: exact, ties by ascending digit
+ * - networks: CHECK_NETWORK_ABS per probability, and the same top digit
+ *   unless the reference's top two are within CHECK_NETWORK_ABS
+ * The parameter and image loaders are also fed randomly truncated and
+ * corrupted files, through their stream overloads. They must reject them
+ * or return output that keeps their contract. Without a sanitizer this
+ * catches exceptions, unbounded allocations and bad output but not
+ * silent memory errors: for those, run the same feed_loader under
+ * libFuzzer (make fuzz) or --verify in an AddressSanitizer build.
+ */
+#define CHECK_ACTIVATION_ULPS 16
+#define CHECK_ACTIVATION_ABS 1e-7F
+#define CHECK_RREF_ABS 1e-3F
+#define CHECK_NETWORK_ABS 1e-5F
+
+namespace kernel_check
+{
+    /**
+ * @struct result
+ * @brief Outcome of one checked kernel.
+ * @var kernel - name of the kernel
+ * @var cases - number of random cases
+ * @var failures - cases with an element outside the tolerance
+ * @var max_ulp - largest distance in ulp from the reference
+ * @var max_error - largest absolute difference from the reference
+ */
+    typedef struct result
+    {
+        std::string kernel;
+        long cases;
+        long failures;
+        int64_t max_ulp;
+        float max_error;
+    } result;
+
+/**
+ * Distance between two floats in units in the last place: the number of
+ * representable floats between them. 0 for equal values (and for +0 and
+ * -0); INT64_MAX if either is NaN.
+ */
+    int64_t ulp_distance (float a, float b);
+
+/**
+ * Reference a * b, one dot product per element, accumulated in double.
+ * @throws std::exception if the inner dimensions differ.
+ */
+    Matrix multiply (const Matrix &a, const Matrix &b);
+
+/**
+ * Reference element-by-element transpose.
+ */
+    Matrix transpose (const Matrix &m);
+
+/**
+ * Reference Gauss-Jordan elimination with partial pivoting, in double,
+ * treating pivots below the same threshold as Matrix::rref as zero.
+ */
+    Matrix rref (const Matrix &m);
+
+/**
+ * Reference activation of one sample per column, in double: the
+ * definitions of the activation::Kernel built-ins.
+ * @throws std::exception for custom kernels.
+ */
+    Matrix activate (activation::Kind kind, const Matrix &x);
+
+/**
+ * Reference forward pass of a network through all its layers.
+ * @param input One image per column.
+ * @return The last layer's output, one column per image.
+ */
+    Matrix forward (const MlpNetwork &mlp, const Matrix &input);
+
+/**
+ * Loaders feed_loader can drive, in the order fuzz inputs select them.
+ */
+    enum class Loader
+    {
+        IDX_IMAGES,
+        IDX_LABELS,
+        PGM,
+        PGM_IMAGE, // readPgmToMatrix, preprocessing included
+        RAW_MATRIX, // readFileToMatrix into an img_dims matrix
+        COUNT
+    };
+
+/**
+ * Runs one loader on bytes from memory and checks its output: images in
+ * [0, 1] and no more of them than the bytes hold, labels below
+ * DIGITS_COUNT, width * height PGM pixels, finite preprocessed images,
+ * raw matrices accepted exactly when the size matches.
+ * @param loader The loader to run.
+ * @param bytes The file contents.
+ * @param must_accept Whether bytes are a valid file the loader must read.
+ * @return false if the loader threw or its result broke the contract.
+ */
+    bool feed_loader (Loader loader, const std::string &bytes,
+                      bool must_accept = false);
+
+/**
+ * Runs every check.
+ * @param cases Random cases per kernel.
+ * @param seed Seed of the generated shapes and values.
+ * @param mlp Network of the end-to-end check.
+ * @return One result per kernel.
+ */
+    std::vector<result> run (int cases, unsigned int seed,
+                             const MlpNetwork &mlp);
+}
+
+#endif //KERNELCHECK_H
\ No newline at end of file
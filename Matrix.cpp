@@ -2,8 +2,29 @@
 // Created by Yuval Cohen on 29/02/2024.
 //
 #include "Matrix.h"
+#include "Reduce.h"
+#include <algorithm>
+#include <vector>
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 #define EPSILON 0.001F
 #define THRESHOLD 0.1F
+// Pivots gathered before the trailing rows are updated, and the number of
+// columns each row update touches at a time
+#define RREF_BLOCK 32
+#define RREF_CHUNK 512
+// Side below which a transpose block is small enough to sweep directly
+#define TRANSPOSE_LEAF 64
+// GEMM blocking: rows of b per pass, and columns of b and c per pass
+#define GEMM_BLOCK_K 128
+#define GEMM_BLOCK_N 256
+// Rows of a and c held in registers by the GEMM micro-kernel
+#define GEMM_TILE_ROWS 4
 
 Matrix::Matrix (int rows, int cols)
 {
@@ -39,53 +60,197 @@ Matrix::Matrix (const Matrix &m)
   }
 }
 
+// Move constructor
+Matrix::Matrix (Matrix &&m) noexcept
+    : elements (m.elements), dimensions (m.dimensions)
+{
+  m.elements = nullptr;
+  m.dimensions = {0, 0};
+}
+
 // Destructor
 Matrix::~Matrix ()
 {
   delete[] this->elements; // Release the allocated memory
 }
 
-// Getters
-// Returns the number of rows in the matrix.
-int Matrix::get_rows () const
+namespace
 {
-  return this->dimensions.rows;
+    // dst (cols x rows, row stride dst_stride) = transpose of the 8x8 block
+    // at src (row stride src_stride), done in registers.
+    inline void transpose_8x8 (const float *src, int src_stride, float *dst,
+                               int dst_stride)
+    {
+#if defined(__AVX__)
+      __m256 r[8], t[8];
+      for (int i = 0; i < 8; ++i)
+      {
+        r[i] = _mm256_loadu_ps (src + i * src_stride);
+      }
+      for (int i = 0; i < 8; i += 2)
+      {
+        t[i] = _mm256_unpacklo_ps (r[i], r[i + 1]);
+        t[i + 1] = _mm256_unpackhi_ps (r[i], r[i + 1]);
+      }
+      for (int i = 0; i < 8; i += 4)
+      {
+        r[i] = _mm256_shuffle_ps (t[i], t[i + 2], _MM_SHUFFLE (1, 0, 1, 0));
+        r[i + 1] = _mm256_shuffle_ps (t[i], t[i + 2], _MM_SHUFFLE (3, 2, 3, 2));
+        r[i + 2] = _mm256_shuffle_ps (t[i + 1], t[i + 3],
+                                      _MM_SHUFFLE (1, 0, 1, 0));
+        r[i + 3] = _mm256_shuffle_ps (t[i + 1], t[i + 3],
+                                      _MM_SHUFFLE (3, 2, 3, 2));
+      }
+      for (int i = 0; i < 4; ++i)
+      {
+        _mm256_storeu_ps (dst + i * dst_stride,
+                          _mm256_permute2f128_ps (r[i], r[i + 4], 0x20));
+        _mm256_storeu_ps (dst + (i + 4) * dst_stride,
+                          _mm256_permute2f128_ps (r[i], r[i + 4], 0x31));
+      }
+#elif defined(__SSE__)
+      // Four 4x4 in-register transposes; quadrant (a, b) lands on (b, a)
+      for (int a = 0; a < 8; a += 4)
+      {
+        for (int b = 0; b < 8; b += 4)
+        {
+          const float *s = src + a * src_stride + b;
+          __m128 r0 = _mm_loadu_ps (s);
+          __m128 r1 = _mm_loadu_ps (s + src_stride);
+          __m128 r2 = _mm_loadu_ps (s + 2 * src_stride);
+          __m128 r3 = _mm_loadu_ps (s + 3 * src_stride);
+          _MM_TRANSPOSE4_PS (r0, r1, r2, r3);
+          float *d = dst + b * dst_stride + a;
+          _mm_storeu_ps (d, r0);
+          _mm_storeu_ps (d + dst_stride, r1);
+          _mm_storeu_ps (d + 2 * dst_stride, r2);
+          _mm_storeu_ps (d + 3 * dst_stride, r3);
+        }
+      }
+#else
+      for (int i = 0; i < 8; ++i)
+      {
+        for (int j = 0; j < 8; ++j)
+        {
+          dst[j * dst_stride + i] = src[i * src_stride + j];
+        }
+      }
+#endif
+    }
+
+    // Cache-oblivious out-of-place transpose of the rows x cols block at
+    // src: halve the longer side until the block fits in L1, then sweep it
+    // with 8x8 micro-transposes and scalar edges.
+    void transpose_recursive (const float *src, int src_stride, float *dst,
+                              int dst_stride, int rows, int cols)
+    {
+      if (rows > TRANSPOSE_LEAF || cols > TRANSPOSE_LEAF)
+      {
+        if (rows >= cols)
+        {
+          int half = (rows / 2 + 7) & ~7;
+          transpose_recursive (src, src_stride, dst, dst_stride, half, cols);
+          transpose_recursive (src + half * src_stride, src_stride, dst + half,
+                               dst_stride, rows - half, cols);
+        }
+        else
+        {
+          int half = (cols / 2 + 7) & ~7;
+          transpose_recursive (src, src_stride, dst, dst_stride, rows, half);
+          transpose_recursive (src + half, src_stride,
+                               dst + half * dst_stride, dst_stride, rows,
+                               cols - half);
+        }
+        return;
+      }
+
+      int full_rows = rows & ~7;
+      int full_cols = cols & ~7;
+      for (int i = 0; i < full_rows; i += 8)
+      {
+        for (int j = 0; j < full_cols; j += 8)
+        {
+          transpose_8x8 (src + i * src_stride + j, src_stride,
+                         dst + j * dst_stride + i, dst_stride);
+        }
+      }
+      for (int i = 0; i < rows; ++i)
+      {
+        for (int j = (i < full_rows ? full_cols : 0); j < cols; ++j)
+        {
+          dst[j * dst_stride + i] = src[i * src_stride + j];
+        }
+      }
+    }
 }
 
-// Returns the number of columns in the matrix.
-int Matrix::get_cols () const
+void Matrix::transpose_copy (const float *src, int rows, int cols, float *dst)
 {
-  return this->dimensions.cols;
+  transpose_recursive (src, cols, dst, rows, rows, cols);
+}
+
+void Matrix::stack_columns (const float *const columns[], int count, int size,
+                            Matrix &dst)
+{
+  if (dst.dimensions.rows != size || dst.dimensions.cols != count)
+  {
+    dst = Matrix (size, count);
+  }
+  thread_local std::vector<float> packed;
+  packed.resize (size_t (count) * size);
+  for (int j = 0; j < count; ++j)
+  {
+    std::copy (columns[j], columns[j] + size,
+               packed.data () + size_t (j) * size);
+  }
+  transpose_copy (packed.data (), count, size, dst.elements);
 }
 
 // Transforms a matrix into its transpose matrix.
 Matrix &Matrix::transpose ()
 {
-  // If the matrix is square, we can transpose without allocating new memory.
-  if (this->dimensions.rows == this->dimensions.cols)
+  int rows = this->dimensions.rows;
+  int cols = this->dimensions.cols;
+  if (rows == 1 || cols == 1)
   {
-    for (int i = 0; i < this->dimensions.rows; ++i)
+    // A vector's transpose has the same memory layout
+    std::swap (this->dimensions.rows, this->dimensions.cols);
+    return *this;
+  }
+
+  // If the matrix is square, we can transpose without allocating new memory:
+  // swap mirrored 8x8 tiles through two register-sized buffers.
+  if (rows == cols)
+  {
+    float *a = this->elements;
+    float upper[64], lower[64];
+    int full = rows & ~7;
+    for (int i = 0; i < full; i += 8)
     {
-      for (int j = i + 1; j < this->dimensions.cols; ++j)
+      for (int j = i; j < full; j += 8)
       {
-        std::swap (this->elements[i * this->dimensions.cols + j],
-                   this->elements[j * this->dimensions.cols + i]);
+        transpose_8x8 (a + i * cols + j, cols, upper, 8);
+        transpose_8x8 (a + j * cols + i, cols, lower, 8);
+        for (int k = 0; k < 8; ++k)
+        {
+          std::copy (upper + k * 8, upper + k * 8 + 8, a + (j + k) * cols + i);
+          std::copy (lower + k * 8, lower + k * 8 + 8, a + (i + k) * cols + j);
+        }
       }
     }
-  }
-  else
-  { // The matrix is not square
-    // Allocate new memory for the transposed matrix
-    float *new_elements = new float[this->dimensions.rows
-                                    * this->dimensions.cols];
-    for (int i = 0; i < this->dimensions.rows; ++i)
+    for (int i = 0; i < rows; ++i)
     {
-      for (int j = 0; j < this->dimensions.cols; ++j)
+      for (int j = std::max (i + 1, i < full ? full : 0); j < cols; ++j)
       {
-        new_elements[j * this->dimensions.rows + i] = this->elements[
-            i * this->dimensions.cols + j];
+        std::swap (a[i * cols + j], a[j * cols + i]);
       }
     }
+  }
+  else
+  { // The matrix is not square
+    // Allocate new memory for the transposed matrix
+    float *new_elements = new float[rows * cols];
+    transpose_copy (this->elements, rows, cols, new_elements);
     // Delete the old elements array
     delete[] this->elements;
     // Swap the dimensions
@@ -96,6 +261,62 @@ Matrix &Matrix::transpose ()
   return *this;
 }
 
+Matrix &Matrix::transpose_in_place ()
+{
+  int rows = this->dimensions.rows;
+  int cols = this->dimensions.cols;
+  if (rows == cols || rows == 1 || cols == 1)
+  {
+    return transpose ();
+  }
+
+  // Element k = i * cols + j moves to j * rows + i = k * rows mod (size - 1);
+  // the first and last elements stay put. Follow each permutation cycle
+  // once, marking visited positions in a bit vector.
+  int last = rows * cols - 1;
+  std::vector<bool> visited (last + 1, false);
+  for (int start = 1; start < last; ++start)
+  {
+    if (visited[start])
+    {
+      continue;
+    }
+    float carried = this->elements[start];
+    int position = start;
+    do
+    {
+      int next = static_cast<int> (
+          static_cast<long long> (position) * rows % last);
+      std::swap (carried, this->elements[next]);
+      visited[next] = true;
+      position = next;
+    }
+    while (position != start);
+  }
+  std::swap (this->dimensions.rows, this->dimensions.cols);
+  return *this;
+}
+
+Matrix &Matrix::transpose_to (Matrix &dst) const
+{
+  if (&dst == this)
+  {
+    return dst.transpose ();
+  }
+  int size = this->dimensions.rows * this->dimensions.cols;
+  if (dst.dimensions.rows * dst.dimensions.cols != size)
+  {
+    // Allocate first, so dst stays intact if the allocation throws
+    float *elements = new float[size];
+    delete[] dst.elements;
+    dst.elements = elements;
+  }
+  dst.dimensions = {this->dimensions.cols, this->dimensions.rows};
+  transpose_copy (this->elements, this->dimensions.rows,
+                  this->dimensions.cols, dst.elements);
+  return dst;
+}
+
 Matrix &Matrix::vectorize ()
 {
   this->dimensions.rows = this->dimensions.rows * this->dimensions.cols;
@@ -115,35 +336,10 @@ void Matrix::plain_print () const
   }
 }
 
-Matrix Matrix::dot (const Matrix &m) const
-{
-  if (this->dimensions.rows != m.dimensions.rows
-      || this->dimensions.cols != m.dimensions.cols)
-  {
-    throw std::exception ();
-  }
-
-  Matrix result (this->dimensions.rows, this->dimensions.cols);
-  for (int i = 0; i < this->dimensions.rows; ++i)
-  {
-    for (int j = 0; j < this->dimensions.cols; ++j)
-    {
-      result.elements[i * dimensions.cols + j] =
-          this->elements[i * dimensions.cols + j]
-          * m.elements[i * dimensions.cols + j];
-    }
-  }
-  return result;
-}
-
 float Matrix::norm () const
 {
-  float sum = 0.0;
-  for (int i = 0; i < dimensions.rows * dimensions.cols; ++i)
-  {
-    sum += (elements[i] * elements[i]);
-  }
-  return std::sqrt (sum);
+  return std::sqrt (reduce::sum_squares (
+      elements, size_t (dimensions.rows) * dimensions.cols));
 }
 
 int Matrix::argmax () const
@@ -165,166 +361,317 @@ int Matrix::argmax () const
 
 float Matrix::sum () const
 {
-  float sum = 0;
-  for (int i = 0; i < dimensions.rows * dimensions.cols; ++i)
-  {
-    sum += elements[i];
-  }
-  return sum;
+  return reduce::sum (elements, size_t (dimensions.rows) * dimensions.cols);
 }
 
-Matrix Matrix::rref () const
+namespace
 {
-  Matrix result (*this);
-  float epsilon = EPSILON;
-  int lead = 0;
-
-  for (int r = 0; r < result.dimensions.rows; ++r)
-  {
-    if (lead >= result.dimensions.cols)
-    { break; }
+    // dst[0, n) += factor * src[0, n), the row update of elimination and
+    // of the GEMM kernel
+    void add_scaled_row (float *dst, const float *src, float factor, int n)
+    {
+      int j = 0;
+#if defined(__SSE2__)
+      __m128 f = _mm_set1_ps (factor);
+      for (; j + 4 <= n; j += 4)
+      {
+        __m128 scaled = _mm_mul_ps (f, _mm_loadu_ps (src + j));
+        _mm_storeu_ps (dst + j, _mm_add_ps (_mm_loadu_ps (dst + j), scaled));
+      }
+#endif
+      for (; j < n; ++j)
+      {
+        dst[j] += factor * src[j];
+      }
+    }
 
-    if (!result.find_pivot_row_and_make_lead_one (r, lead, epsilon))
+    // Inner product of two contiguous vectors, the GEMV kernel
+    float dot_product (const float *a, const float *b, int n)
     {
-      ++lead;
-      if (lead == result.dimensions.cols)
+      int j = 0;
+      float sum = 0.0F;
+#if defined(__SSE2__)
+      __m128 acc0 = _mm_setzero_ps ();
+      __m128 acc1 = _mm_setzero_ps ();
+      for (; j + 8 <= n; j += 8)
       {
-        result.move_zero_rows_to_bottom ();
-        break;
+        acc0 = _mm_add_ps (acc0, _mm_mul_ps (_mm_loadu_ps (a + j),
+                                             _mm_loadu_ps (b + j)));
+        acc1 = _mm_add_ps (acc1, _mm_mul_ps (_mm_loadu_ps (a + j + 4),
+                                             _mm_loadu_ps (b + j + 4)));
       }
-      --r; // Retry the same row with the next lead
-      continue;
+      float lanes[4];
+      _mm_storeu_ps (lanes, _mm_add_ps (acc0, acc1));
+      sum = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+#endif
+      for (; j < n; ++j)
+      {
+        sum += a[j] * b[j];
+      }
+      return sum;
     }
 
-    result.process_column (r, lead, epsilon);
-    ++lead;
-  }
+    // The widest float vector the build targets, for the GEMM micro-kernel
+#if defined(__AVX__)
+    typedef __m256 lanes_t;
+    const int LANES = 8;
 
-  result.move_zero_rows_to_bottom ();
-  return result;
-}
+    inline lanes_t lanes_load (const float *p)
+    { return _mm256_loadu_ps (p); }
 
-void Matrix::swap_rows (int i, int j)
-{
-  if (i >= dimensions.rows || j >= dimensions.rows || i < 0 || j < 0)
-  {
-    throw std::exception ();
-  }
+    inline void lanes_store (float *p, lanes_t v)
+    { _mm256_storeu_ps (p, v); }
 
-  for (int k = 0; k < dimensions.cols; ++k)
-  {
-    std::swap (elements[i * dimensions.cols + k],
-               elements[j * dimensions.cols + k]);
-  }
-}
+    inline lanes_t lanes_broadcast (float x)
+    { return _mm256_set1_ps (x); }
 
-void Matrix::scale_row (int i, float factor)
-{
-  if (i >= dimensions.rows || i < 0)
-  {
-    throw std::exception ();
-  }
-  if (factor == 0.0F)
-  {
-    throw std::exception ();
-  }
+    inline lanes_t lanes_add_product (lanes_t acc, lanes_t a, lanes_t b)
+    { return _mm256_add_ps (acc, _mm256_mul_ps (a, b)); }
+#elif defined(__SSE2__)
+    typedef __m128 lanes_t;
+    const int LANES = 4;
 
-  for (int j = 0; j < dimensions.cols; ++j)
-  {
-    elements[i * dimensions.cols + j] *= factor;
-  }
-}
+    inline lanes_t lanes_load (const float *p)
+    { return _mm_loadu_ps (p); }
 
-void Matrix::add_multiple_of_row (int source_row, int target_row, float factor)
-{
-  if (source_row >= dimensions.rows || target_row >= dimensions.rows
-      || source_row < 0 || target_row < 0)
-  {
-    throw std::exception ();
-  }
+    inline void lanes_store (float *p, lanes_t v)
+    { _mm_storeu_ps (p, v); }
 
-  for (int k = 0; k < dimensions.cols; ++k)
-  {
-    elements[target_row * dimensions.cols + k] +=
-        factor * elements[source_row * dimensions.cols + k];
-  }
-}
+    inline lanes_t lanes_broadcast (float x)
+    { return _mm_set1_ps (x); }
 
-bool Matrix::is_row_zero (int row_index) const
-{
-  // Check each element in the row.
-  for (int j = 0; j < dimensions.cols; ++j)
-  {
-    // If any element is not approximately zero, the row is not a zero row.
-    if (std::abs (elements[row_index * dimensions.cols + j]) > EPSILON)
+    inline lanes_t lanes_add_product (lanes_t acc, lanes_t a, lanes_t b)
+    { return _mm_add_ps (acc, _mm_mul_ps (a, b)); }
+#else
+    typedef float lanes_t;
+    const int LANES = 1;
+
+    inline lanes_t lanes_load (const float *p)
+    { return *p; }
+
+    inline void lanes_store (float *p, lanes_t v)
+    { *p = v; }
+
+    inline lanes_t lanes_broadcast (float x)
+    { return x; }
+
+    inline lanes_t lanes_add_product (lanes_t acc, lanes_t a, lanes_t b)
+    { return acc + a * b; }
+#endif
+
+    // c[ROWS x width] += a[ROWS x depth] * b[depth x width], where rows of
+    // a are k apart and rows of b and c are n apart. Each c tile of ROWS
+    // rows by VECTORS vectors stays in registers for the whole depth, so
+    // every loaded element of b feeds ROWS multiply-adds.
+    template <int ROWS, int VECTORS>
+    void gemm_tile (const float *a, int k, const float *b, int n, float *c,
+                    int depth)
     {
-      return false;
+      lanes_t acc[ROWS][VECTORS];
+      for (int r = 0; r < ROWS; ++r)
+      {
+        for (int v = 0; v < VECTORS; ++v)
+        {
+          acc[r][v] = lanes_load (c + r * n + v * LANES);
+        }
+      }
+      for (int p = 0; p < depth; ++p)
+      {
+        lanes_t b_row[VECTORS];
+        for (int v = 0; v < VECTORS; ++v)
+        {
+          b_row[v] = lanes_load (b + p * n + v * LANES);
+        }
+        for (int r = 0; r < ROWS; ++r)
+        {
+          lanes_t a_value = lanes_broadcast (a[r * k + p]);
+          for (int v = 0; v < VECTORS; ++v)
+          {
+            acc[r][v] = lanes_add_product (acc[r][v], a_value, b_row[v]);
+          }
+        }
+      }
+      for (int r = 0; r < ROWS; ++r)
+      {
+        for (int v = 0; v < VECTORS; ++v)
+        {
+          lanes_store (c + r * n + v * LANES, acc[r][v]);
+        }
+      }
     }
-  }
-  // If all elements are approximately zero, return true.
-  return true;
-}
 
-void Matrix::move_zero_rows_to_bottom ()
-{
-  int last_nonzero_row = dimensions.rows - 1;
+    // Runs the micro-kernel across a block of ROWS rows and width columns;
+    // the columns past the last whole vector are summed one at a time.
+    template <int ROWS>
+    void gemm_rows (const float *a, int k, const float *b, int n, float *c,
+                    int depth, int width)
+    {
+      int j = 0;
+      for (; j + 2 * LANES <= width; j += 2 * LANES)
+      {
+        gemm_tile<ROWS, 2> (a, k, b + j, n, c + j, depth);
+      }
+      for (; j + LANES <= width; j += LANES)
+      {
+        gemm_tile<ROWS, 1> (a, k, b + j, n, c + j, depth);
+      }
+      for (; j < width; ++j)
+      {
+        float acc[ROWS];
+        for (int r = 0; r < ROWS; ++r)
+        {
+          acc[r] = c[r * n + j];
+        }
+        for (int p = 0; p < depth; ++p)
+        {
+          for (int r = 0; r < ROWS; ++r)
+          {
+            acc[r] += a[r * k + p] * b[p * n + j];
+          }
+        }
+        for (int r = 0; r < ROWS; ++r)
+        {
+          c[r * n + j] = acc[r];
+        }
+      }
+    }
 
-  for (int i = 0; i <= last_nonzero_row; ++i)
-  {
-    bool is_zero_row = true;
-    for (int j = 0; j < dimensions.cols && is_zero_row; ++j)
+    void swap_row_ranges (float *a, float *b, int n)
     {
-      if (std::abs (elements[i * dimensions.cols + j]) > EPSILON)
+      for (int j = 0; j < n; ++j)
       {
-        is_zero_row = false;
+        std::swap (a[j], b[j]);
       }
     }
 
-    if (is_zero_row)
+    // Eliminates every lead of the panel from one row. The panel rows are
+    // mutually reduced (1 at their own lead, 0 at the other leads), so the
+    // multipliers can all be read before the row is touched and the update
+    // is a single rank-k pass, done in column chunks that stay in cache.
+    void apply_panel (float *row, const float *a, int cols, int first_col,
+                      const std::vector<int> &panel_rows,
+                      const std::vector<int> &leads)
     {
-      // Find the last non-zero row to swap with
-      while (last_nonzero_row > i && is_row_zero (last_nonzero_row))
+      float factors[RREF_BLOCK];
+      bool any = false;
+      for (size_t p = 0; p < leads.size (); ++p)
+      {
+        factors[p] = row[leads[p]];
+        any = any || factors[p] != 0.0F;
+      }
+      if (!any)
+      {
+        return;
+      }
+      for (int j0 = first_col; j0 < cols; j0 += RREF_CHUNK)
       {
-        --last_nonzero_row;
+        int len = std::min (RREF_CHUNK, cols - j0);
+        for (size_t p = 0; p < leads.size (); ++p)
+        {
+          if (factors[p] != 0.0F)
+          {
+            add_scaled_row (row + j0, a + panel_rows[p] * cols + j0,
+                            -factors[p], len);
+          }
+        }
       }
-      if (last_nonzero_row > i)
+      for (int lead : leads)
       {
-        swap_rows (i, last_nonzero_row);
-        --last_nonzero_row; // Update the position of the last non-zero row
+        row[lead] = 0.0F; // Exact zeros where the pivots cancelled
       }
     }
-  }
 }
 
-bool
-Matrix::find_pivot_row_and_make_lead_one (int &r, int &lead, float epsilon)
+// Blocked Gauss-Jordan elimination with partial pivoting. Pivots are found
+// RREF_BLOCK at a time; within a panel the candidate column is evaluated
+// lazily against the panel's pivots, and only the chosen pivot row is
+// brought up to date. Once the panel is complete it is applied to all other
+// rows in one pass, so each row is streamed once per panel instead of once
+// per pivot.
+Matrix Matrix::rref () const
 {
-  for (int i = r; i < dimensions.rows; ++i)
+  Matrix result (*this);
+  int rows = result.dimensions.rows;
+  int cols = result.dimensions.cols;
+  float *a = result.elements;
+  std::vector<int> panel_rows, leads;
+  int rank = 0; // Rows [0, rank) hold pivots
+  int col = 0;
+
+  while (rank < rows && col < cols)
   {
-    if (std::abs (elements[i * dimensions.cols + lead]) >= epsilon)
+    int panel_start = rank;
+    panel_rows.clear ();
+    leads.clear ();
+
+    for (; col < cols && rank < rows && rank - panel_start < RREF_BLOCK; ++col)
     {
-      if (i != r)
+      // Partial pivoting: largest candidate of this column
+      int pivot = -1;
+      float pivot_value = 0.0F;
+      for (int i = rank; i < rows; ++i)
+      {
+        const float *row = a + i * cols;
+        float value = row[col];
+        for (size_t p = 0; p < leads.size (); ++p)
+        {
+          value -= row[leads[p]] * a[panel_rows[p] * cols + col];
+        }
+        if (std::abs (value) > std::abs (pivot_value))
+        {
+          pivot = i;
+          pivot_value = value;
+        }
+      }
+      if (std::abs (pivot_value) < EPSILON)
+      {
+        continue; // No pivot in this column
+      }
+
+      float *pivot_row = a + rank * cols;
+      if (pivot != rank)
+      {
+        swap_row_ranges (pivot_row, a + pivot * cols, cols);
+      }
+      apply_panel (pivot_row, a, cols, leads.empty () ? col : leads[0],
+                   panel_rows, leads);
+
+      float scale = 1.0F / pivot_row[col];
+      for (int j = col; j < cols; ++j)
+      {
+        pivot_row[j] *= scale;
+      }
+      pivot_row[col] = 1.0F;
+
+      // Keep the panel mutually reduced
+      for (int p : panel_rows)
       {
-        swap_rows (i, r);
+        float *row = a + p * cols;
+        float factor = row[col];
+        add_scaled_row (row + col, pivot_row + col, -factor, cols - col);
+        row[col] = 0.0F;
       }
-      scale_row (r, 1.0F / elements[r * dimensions.cols + lead]);
-      return true;
+      panel_rows.push_back (rank);
+      leads.push_back (col);
+      ++rank;
     }
-  }
-  return false; // No valid pivot found
-}
 
-void Matrix::process_column (int r, int lead, float epsilon)
-{
-  for (int i = 0; i < dimensions.rows; ++i)
-  {
-    if (i != r && std::abs (elements[i * dimensions.cols + lead])
-                  >= epsilon)
+    if (leads.empty ())
     {
-      add_multiple_of_row (r, i,
-                           -elements[i * dimensions.cols + lead]);
+      break;
+    }
+    for (int i = 0; i < rows; ++i)
+    {
+      if (i < panel_start || i >= rank)
+      {
+        apply_panel (a + i * cols, a, cols, leads[0], panel_rows, leads);
+      }
     }
   }
+
+  // Whatever is left below the pivots is below EPSILON: the zero rows
+  std::fill (a + rank * cols, a + rows * cols, 0.0F);
+  return result;
 }
 
 Matrix &Matrix::operator+= (const Matrix &rhs)
@@ -341,11 +688,11 @@ Matrix &Matrix::operator+= (const Matrix &rhs)
   return *this;
 }
 
-Matrix Matrix::operator+ (const Matrix &rhs) const
+Matrix &Matrix::operator= (Matrix &&rhs) noexcept
 {
-  Matrix result = *this; // Copy current matrix
-  result += rhs;         // Use addition assignment to add rhs to the copy
-  return result;
+  std::swap (this->elements, rhs.elements);
+  std::swap (this->dimensions, rhs.dimensions);
+  return *this;
 }
 
 Matrix &Matrix::operator= (const Matrix &rhs)
@@ -371,96 +718,69 @@ Matrix &Matrix::operator= (const Matrix &rhs)
   return *this;
 }
 
-Matrix Matrix::operator* (const Matrix &rhs) const
+// Blocked GEMM. Batches narrower than one vector are computed as dot
+// products against the transposed columns of b. Wider ones run the
+// register-tiled micro-kernel over GEMM_TILE_ROWS rows of c at a time.
+// Blocking k and n keeps the panel of b the tiles share in cache.
+void Matrix::gemm (const float *a, const float *b, float *c, int m, int k,
+                   int n, bool accumulate)
 {
-  if (this->dimensions.cols != rhs.dimensions.rows)
+  if (n < LANES)
   {
-    throw std::exception ();
-  }
-  // Initialize result matrix with zeros
-  Matrix result (this->dimensions.rows, rhs.dimensions.cols);
-
-  for (int i = 0; i < result.dimensions.rows; ++i)
-  {
-    for (int j = 0; j < result.dimensions.cols; ++j)
+    thread_local std::vector<float> columns;
+    const float *b_t = b;
+    if (n > 1)
     {
-      for (int k = 0; k < this->dimensions.cols; ++k)
+      columns.resize (size_t (k) * n);
+      transpose_copy (b, k, n, columns.data ());
+      b_t = columns.data ();
+    }
+    for (int i = 0; i < m; ++i)
+    {
+      for (int j = 0; j < n; ++j)
       {
-        result.elements[i * result.dimensions.cols + j] +=
-            this->elements[i * this->dimensions.cols + k]
-            * rhs.elements[k * rhs.dimensions.cols + j];
+        float value = dot_product (a + i * k, b_t + j * k, k);
+        c[i * n + j] = accumulate ? c[i * n + j] + value : value;
       }
     }
+    return;
   }
-  return result;
-}
 
-// Scalar multiplication on the right: Matrix * float
-Matrix Matrix::operator* (float scalar) const
-{
-  Matrix result (this->dimensions.rows, this->dimensions.cols);
-  for (int i = 0; i < this->dimensions.rows * this->dimensions.cols; ++i)
+  if (!accumulate)
   {
-    result.elements[i] = this->elements[i] * scalar;
+    std::fill (c, c + m * n, 0.0F);
   }
-  return result;
-}
-
-// Scalar multiplication on the left: float * Matrix
-Matrix operator* (float scalar, const Matrix &m)
-{
-  return m * scalar; // Reuse the implementation of scalar multiplication on
-  // the right
-}
-
-// Parenthesis indexing for non-const objects
-float &Matrix::operator() (int row, int col)
-{
-  if (row >= dimensions.rows || col >= dimensions.cols || row < 0 || col < 0)
-  {
-    throw std::exception ();
-  }
-  return elements[row * dimensions.cols + col];
-}
-
-// Parenthesis indexing for const objects
-const float &Matrix::operator() (int row, int col) const
-{
-  if (row >= dimensions.rows || col >= dimensions.cols || row < 0 || col < 0)
-  {
-    throw std::exception ();
-  }
-  return elements[row * dimensions.cols + col];
-}
-
-// Bracket indexing for non-const objects
-float &Matrix::operator[] (int index)
-{
-  if (index >= dimensions.rows * dimensions.cols || index < 0)
-  {
-    throw std::exception ();
-  }
-  return elements[index];
-}
-
-// Bracket indexing for const objects
-const float &Matrix::operator[] (int index) const
-{
-  if (index >= dimensions.rows * dimensions.cols || index < 0)
+  for (int j0 = 0; j0 < n; j0 += GEMM_BLOCK_N)
   {
-    throw std::exception ();
+    int width = std::min (GEMM_BLOCK_N, n - j0);
+    for (int k0 = 0; k0 < k; k0 += GEMM_BLOCK_K)
+    {
+      int depth = std::min (GEMM_BLOCK_K, k - k0);
+      const float *b_panel = b + k0 * n + j0;
+      int i = 0;
+      for (; i + GEMM_TILE_ROWS <= m; i += GEMM_TILE_ROWS)
+      {
+        gemm_rows<GEMM_TILE_ROWS> (a + i * k + k0, k, b_panel, n,
+                                   c + i * n + j0, depth, width);
+      }
+      for (; i < m; ++i)
+      {
+        gemm_rows<1> (a + i * k + k0, k, b_panel, n, c + i * n + j0, depth,
+                      width);
+      }
+    }
   }
-  return elements[index];
 }
 
 std::ostream &operator<< (std::ostream &os, const Matrix &m)
 {
   for (int i = 0; i < m.get_rows (); ++i)
   {
+    const float *row = m.row (i);
     for (int j = 0; j < m.get_cols (); ++j)
     {
       //if the element is greater than 0.1, print '**'
-      if (m (i, j) > THRESHOLD)
+      if (row[j] > THRESHOLD)
       {
         os << "**";
       }
@@ -4,6 +4,18 @@
 
 #include <cmath>
 #include <iostream>
+#include "MatrixExpr.h"
+
+// Element accessors check their indices (and throw std::exception when out
+// of range) unless MATRIX_BOUNDS_CHECK is 0. By default checking follows
+// the build mode: on in debug builds, off when NDEBUG is defined.
+#ifndef MATRIX_BOUNDS_CHECK
+#ifdef NDEBUG
+#define MATRIX_BOUNDS_CHECK 0
+#else
+#define MATRIX_BOUNDS_CHECK 1
+#endif
+#endif
 
 // You don't have to use the struct. Can help you with MlpNetwork.h
 struct matrix_dims
@@ -12,22 +24,13 @@ struct matrix_dims
 };
 
 // Insert Matrix class here...
-class Matrix
+class Matrix : public matrix_expr::Expr<Matrix>
 {
  private:
   // Pointer to the one-dimensional dynamic array of matrix elements
   float *elements;
   matrix_dims dimensions; // Using the provided struct for dimensions
 
-  // Helping methods for rref
-  void swap_rows (int i, int j);
-  void scale_row (int i, float factor);
-  void add_multiple_of_row (int source_row, int target_row, float factor);
-  bool is_row_zero (int row_index) const;
-  void move_zero_rows_to_bottom ();
-  bool find_pivot_row_and_make_lead_one (int &r, int &lead, float epsilon);
-  void process_column (int r, int lead, float epsilon);
-
  public:
   // Constructors
   /**
@@ -52,6 +55,21 @@ class Matrix
  */
   Matrix (const Matrix &m);
 
+/**
+ * Move constructor. Takes over the elements of m without copying them;
+ * m is left empty (0x0) and may only be assigned to or destroyed.
+ * @param m The Matrix object to move from.
+ */
+  Matrix (Matrix &&m) noexcept;
+
+/**
+ * Constructs a Matrix by evaluating an arithmetic expression, e.g.
+ * Matrix y = w * x + b.
+ * @param expr The expression to evaluate.
+ */
+  template <typename E>
+  Matrix (const matrix_expr::Expr<E> &expr);
+
   /**
  * Destructor. Releases any resources allocated by the Matrix object.
  */
@@ -70,12 +88,83 @@ class Matrix
  */
   int get_cols () const;
 
+/**
+ * Returns a pointer to the contiguous, row-major element storage.
+ * Intended for kernels that walk the whole matrix; no bounds checking.
+ * @return Pointer to the first element.
+ */
+  float *data ();
+
+/**
+ * Returns a read-only pointer to the contiguous, row-major element storage.
+ * @return Const pointer to the first element.
+ */
+  const float *data () const;
+
+/**
+ * Returns a pointer to the first element of a row; never bounds checked.
+ * @param row The row index.
+ * @return Pointer to the row's cols contiguous elements.
+ */
+  float *row (int row);
+
+/**
+ * Returns a read-only pointer to the first element of a row; never bounds
+ * checked.
+ * @param row The row index.
+ * @return Const pointer to the row's cols contiguous elements.
+ */
+  const float *row (int row) const;
+
   /**
  * Transposes the matrix in-place, swapping rows with columns.
+ * Square matrices are transposed within their own storage; other shapes
+ * are written, tile by tile, into a newly allocated buffer.
  * @return Reference to the current matrix.
  */
   Matrix &transpose ();
 
+/**
+ * Transposes the matrix without allocating a second element buffer, by
+ * following the cycles of the transpose permutation. Slower than
+ * transpose() for non-square shapes, but needs only one bit per element.
+ * @return Reference to the current matrix.
+ */
+  Matrix &transpose_in_place ();
+
+/**
+ * Writes the transpose of this matrix into dst, reusing dst's storage when
+ * it already holds the right number of elements.
+ * @param dst The matrix to overwrite with the transpose.
+ * @return Reference to dst.
+ */
+  Matrix &transpose_to (Matrix &dst) const;
+
+/**
+ * Transposes a raw row-major rows x cols block into dst (cols x rows).
+ * Used to convert image batches between one-image-per-row and
+ * one-image-per-column layouts.
+ * @param src The source elements.
+ * @param rows The number of rows of the source block.
+ * @param cols The number of columns of the source block.
+ * @param dst Destination with room for rows * cols elements; must not
+ *        overlap src.
+ */
+  static void transpose_copy (const float *src, int rows, int cols,
+                              float *dst);
+
+/**
+ * Stacks vectors as the columns of dst, as batches of images are built:
+ * packs them into one row-major block, then transposes it with
+ * transpose_copy.
+ * @param columns The count vectors, size elements each.
+ * @param count The number of vectors.
+ * @param size The number of elements of each vector.
+ * @param dst Reshaped to size x count unless it already is.
+ */
+  static void stack_columns (const float *const columns[], int count,
+                             int size, Matrix &dst);
+
 /**
  * Reshapes the matrix into a column vector.
  * @return Reference to the current matrix.
@@ -90,19 +179,24 @@ class Matrix
 /**
  * Performs element-wise multiplication (Hadamard product) with another matrix.
  * @param m The matrix to multiply with.
- * @return A new matrix that is the result of the element-wise multiplication.
+ * @return An expression evaluating to the element-wise multiplication.
+ * @throws std::exception if the dimensions differ.
  */
-  Matrix dot (const Matrix &m) const;
+  matrix_expr::Hadamard<matrix_expr::Ref, matrix_expr::Ref>
+  dot (const Matrix &m) const;
 
   /**
  * Calculates the Frobenius norm of the matrix,
    * which is the square root of the sum of the squares of its elements.
+ * Summed in the default reduce::Mode.
  * @return The Frobenius norm of the matrix.
  */
   float norm () const;
 
 /**
  * Transforms the matrix into its Reduced Row Echelon Form (RREF).
+ * Uses blocked Gauss-Jordan elimination with partial pivoting; columns
+ * whose best pivot is below EPSILON are treated as zero.
  * @return A new matrix that is the RREF of the original matrix.
  */
   Matrix rref () const;
@@ -115,7 +209,8 @@ class Matrix
   int argmax () const;
 
 /**
- * Calculates the sum of all elements in the matrix.
+ * Calculates the sum of all elements in the matrix, in the default
+ * reduce::Mode.
  * @return The sum of all elements.
  */
   float sum () const;
@@ -128,11 +223,12 @@ class Matrix
   Matrix &operator+= (const Matrix &rhs);
 
 /**
- * Creates a new matrix by adding another matrix to this matrix element-wise.
- * @param rhs The right-hand side matrix to add.
- * @return A new matrix that is the sum of this matrix and rhs.
+ * Adds an arithmetic expression to this matrix element-wise, in one pass.
+ * @param rhs The expression to add.
+ * @return A reference to this matrix after addition.
  */
-  Matrix operator+ (const Matrix &rhs) const;
+  template <typename E>
+  Matrix &operator+= (const matrix_expr::Expr<E> &rhs);
 
 /**
  * Copies the elements of another matrix to this matrix.
@@ -142,23 +238,38 @@ class Matrix
   Matrix &operator= (const Matrix &rhs);
 
 /**
- * Multiplies this matrix with another matrix (matrix multiplication).
- * @param rhs The right-hand side matrix to multiply with.
- * @return A new matrix that is the product of this matrix and rhs.
+ * Takes over the elements of another matrix without copying them.
+ * @param rhs The right-hand side matrix to move from; left holding this
+ *        matrix's previous elements.
+ * @return A reference to this matrix after the move.
  */
-  Matrix operator* (const Matrix &rhs) const;
+  Matrix &operator= (Matrix &&rhs) noexcept;
 
 /**
- * Multiplies this matrix by a scalar value element-wise.
- * @param scalar The scalar value to multiply with.
- * @return A new matrix that is the product of this matrix and the scalar.
+ * Evaluates an arithmetic expression into this matrix. The storage is
+ * reused when the shape matches and no product reads from it.
+ * @param expr The expression to evaluate.
+ * @return A reference to this matrix after assignment.
  */
-  Matrix operator* (float scalar) const;
+  template <typename E>
+  Matrix &operator= (const matrix_expr::Expr<E> &expr);
+
+/**
+ * General matrix multiplication on raw row-major storage:
+ * c = a * b, or c += a * b when accumulate is set.
+ * A single-column b takes a dedicated GEMV path.
+ * @param a The m x k left operand.
+ * @param b The k x n right operand.
+ * @param c The m x n result; must not overlap a or b.
+ */
+  static void gemm (const float *a, const float *b, float *c, int m, int k,
+                    int n, bool accumulate);
 
   /**
  * Accesses the element at the specified row and column for modification.
  * @param row The row index of the element.
  * @param col The column index of the element.
+ * @throws std::exception if out of range and MATRIX_BOUNDS_CHECK is set.
  * @return A reference to the element at the specified location.
  */
   float &operator() (int row, int col);
@@ -168,6 +279,7 @@ class Matrix
  * without allowing modification.
  * @param row The row index of the element.
  * @param col The column index of the element.
+ * @throws std::exception if out of range and MATRIX_BOUNDS_CHECK is set.
  * @return A const reference to the element at the specified location.
  */
   const float &operator() (int row, int col) const;
@@ -176,6 +288,7 @@ class Matrix
  * Accesses the element at the specified index for modification,
  * treating the matrix as a 1D array.
  * @param index The index of the element in the array.
+ * @throws std::exception if out of range and MATRIX_BOUNDS_CHECK is set.
  * @return A reference to the element at the specified index.
  */
   float &operator[] (int index);
@@ -184,6 +297,7 @@ class Matrix
  * Accesses the element at the specified index without
  * allowing modification, treating the matrix as a 1D array.
  * @param index The index of the element in the array.
+ * @throws std::exception if out of range and MATRIX_BOUNDS_CHECK is set.
  * @return A const reference to the element at the specified index.
  */
   const float &operator[] (int index) const;
@@ -207,6 +321,375 @@ class Matrix
 
 };
 
-Matrix operator* (float scalar, const Matrix &m);
+std::ostream &operator<< (std::ostream &os, const Matrix &m);
+std::istream &operator>> (std::istream &is, Matrix &m);
+
+// Accessors are defined inline so element loops in other translation units
+// compile down to plain loads and stores.
+inline int Matrix::get_rows () const
+{
+  return this->dimensions.rows;
+}
+
+inline int Matrix::get_cols () const
+{
+  return this->dimensions.cols;
+}
+
+inline float *Matrix::data ()
+{
+  return this->elements;
+}
+
+inline const float *Matrix::data () const
+{
+  return this->elements;
+}
+
+inline float *Matrix::row (int row)
+{
+  return this->elements + row * this->dimensions.cols;
+}
+
+inline const float *Matrix::row (int row) const
+{
+  return this->elements + row * this->dimensions.cols;
+}
+
+// Parenthesis indexing for non-const objects
+inline float &Matrix::operator() (int row, int col)
+{
+#if MATRIX_BOUNDS_CHECK
+  if (row >= dimensions.rows || col >= dimensions.cols || row < 0 || col < 0)
+  {
+    throw std::exception ();
+  }
+#endif
+  return elements[row * dimensions.cols + col];
+}
+
+// Parenthesis indexing for const objects
+inline const float &Matrix::operator() (int row, int col) const
+{
+#if MATRIX_BOUNDS_CHECK
+  if (row >= dimensions.rows || col >= dimensions.cols || row < 0 || col < 0)
+  {
+    throw std::exception ();
+  }
+#endif
+  return elements[row * dimensions.cols + col];
+}
+
+// Bracket indexing for non-const objects
+inline float &Matrix::operator[] (int index)
+{
+#if MATRIX_BOUNDS_CHECK
+  if (index >= dimensions.rows * dimensions.cols || index < 0)
+  {
+    throw std::exception ();
+  }
+#endif
+  return elements[index];
+}
+
+// Bracket indexing for const objects
+inline const float &Matrix::operator[] (int index) const
+{
+#if MATRIX_BOUNDS_CHECK
+  if (index >= dimensions.rows * dimensions.cols || index < 0)
+  {
+    throw std::exception ();
+  }
+#endif
+  return elements[index];
+}
+
+// Expression evaluation and arithmetic operators (see MatrixExpr.h)
+namespace matrix_expr
+{
+    // Operands of element-wise nodes: matrices become views, element-wise
+    // nodes nest as they are, products are materialized.
+    inline Ref as_operand (const Matrix &m)
+    {
+      return Ref (m.data (), m.get_rows (), m.get_cols ());
+    }
+
+    inline Ref as_operand (const Ref &ref)
+    {
+      return ref;
+    }
+
+    template <typename L, typename R>
+    Sum<L, R> as_operand (const Sum<L, R> &e)
+    {
+      return e;
+    }
+
+    template <typename L, typename R>
+    Hadamard<L, R> as_operand (const Hadamard<L, R> &e)
+    {
+      return e;
+    }
+
+    template <typename E>
+    Scaled<E> as_operand (const Scaled<E> &e)
+    {
+      return e;
+    }
+
+    // Evaluates any expression into a new, shared matrix and views it.
+    template <typename E>
+    Ref materialize (const E &e)
+    {
+      auto m = std::make_shared<const Matrix> (e);
+      return Ref (m->data (), m->get_rows (), m->get_cols (), m);
+    }
+
+    inline Ref as_operand (const Product &e)
+    {
+      return materialize (e);
+    }
+
+    template <typename X>
+    Ref as_operand (const GemmSum<X> &e)
+    {
+      return materialize (e);
+    }
+
+    // Operands of products must be plain element storage.
+    inline Ref as_leaf (const Matrix &m)
+    {
+      return as_operand (m);
+    }
+
+    inline Ref as_leaf (const Ref &ref)
+    {
+      return ref;
+    }
+
+    template <typename E>
+    Ref as_leaf (const E &e)
+    {
+      return materialize (e);
+    }
+
+    // Writes an element-wise expression into dst in a single fused loop.
+    template <typename E>
+    void evaluate (const E &e, float *dst)
+    {
+      int size = e.get_rows () * e.get_cols ();
+      for (int i = 0; i < size; ++i)
+      {
+        dst[i] = e[i];
+      }
+    }
+
+    inline void evaluate (const Product &p, float *dst)
+    {
+      Matrix::gemm (p.lhs.elements, p.rhs.elements, dst, p.lhs.rows,
+                    p.lhs.cols, p.rhs.cols, false);
+    }
+
+    template <typename X>
+    void evaluate (const GemmSum<X> &s, float *dst)
+    {
+      evaluate (s.addend, dst);
+      Matrix::gemm (s.product.lhs.elements, s.product.rhs.elements, dst,
+                    s.product.lhs.rows, s.product.lhs.cols,
+                    s.product.rhs.cols, true);
+    }
+
+    // Whether evaluating e into dst would overwrite a product's operand.
+    template <typename E>
+    bool product_reads (const E &, const float *)
+    {
+      return false;
+    }
+
+    inline bool product_reads (const Product &p, const float *dst)
+    {
+      return p.lhs.elements == dst || p.rhs.elements == dst;
+    }
+
+    template <typename X>
+    bool product_reads (const GemmSum<X> &s, const float *dst)
+    {
+      return product_reads (s.product, dst);
+    }
+
+    template <typename L, typename R>
+    void check_same_dims (const L &lhs, const R &rhs)
+    {
+      if (lhs.get_rows () != rhs.get_rows ()
+          || lhs.get_cols () != rhs.get_cols ())
+      {
+        throw std::exception ();
+      }
+    }
+
+    /**
+   * Element-wise addition.
+   * @throws std::exception if the dimensions differ.
+   */
+    template <typename L, typename R>
+    auto operator+ (const Expr<L> &lhs, const Expr<R> &rhs)
+    {
+      check_same_dims (lhs.self (), rhs.self ());
+      return Sum<decltype (as_operand (lhs.self ())),
+                 decltype (as_operand (rhs.self ()))> (
+          as_operand (lhs.self ()), as_operand (rhs.self ()));
+    }
+
+    template <typename R>
+    auto operator+ (const Product &lhs, const Expr<R> &rhs)
+    {
+      check_same_dims (lhs, rhs.self ());
+      return GemmSum<decltype (as_operand (rhs.self ()))> (
+          lhs, as_operand (rhs.self ()));
+    }
+
+    template <typename L>
+    auto operator+ (const Expr<L> &lhs, const Product &rhs)
+    {
+      return rhs + lhs;
+    }
+
+    inline GemmSum<Ref> operator+ (const Product &lhs, const Product &rhs)
+    {
+      check_same_dims (lhs, rhs);
+      return GemmSum<Ref> (lhs, materialize (rhs));
+    }
+
+    /**
+   * Matrix multiplication, evaluated by Matrix::gemm.
+   * @throws std::exception if lhs columns differ from rhs rows.
+   */
+    template <typename L, typename R>
+    Product operator* (const Expr<L> &lhs, const Expr<R> &rhs)
+    {
+      if (lhs.self ().get_cols () != rhs.self ().get_rows ())
+      {
+        throw std::exception ();
+      }
+      return Product (as_leaf (lhs.self ()), as_leaf (rhs.self ()));
+    }
+
+    /**
+   * Element-wise multiplication by a scalar, on either side.
+   */
+    template <typename E>
+    auto operator* (const Expr<E> &expr, float scalar)
+    {
+      return Scaled<decltype (as_operand (expr.self ()))> (
+          as_operand (expr.self ()), scalar);
+    }
+
+    template <typename E>
+    auto operator* (float scalar, const Expr<E> &expr)
+    {
+      return expr * scalar;
+    }
+}
+
+template <typename E>
+Matrix::Matrix (const matrix_expr::Expr<E> &expr)
+{
+  const E &e = expr.self ();
+  this->dimensions = {e.get_rows (), e.get_cols ()};
+  this->elements = new float[this->dimensions.rows * this->dimensions.cols];
+  matrix_expr::evaluate (e, this->elements);
+}
+
+template <typename E>
+Matrix &Matrix::operator= (const matrix_expr::Expr<E> &expr)
+{
+  const E &e = expr.self ();
+  if (this->dimensions.rows == e.get_rows ()
+      && this->dimensions.cols == e.get_cols ()
+      && !matrix_expr::product_reads (e, this->elements))
+  {
+    matrix_expr::evaluate (e, this->elements);
+    return *this;
+  }
+  // Evaluate into fresh storage while the expression may still read ours
+  float *new_elements = new float[e.get_rows () * e.get_cols ()];
+  matrix_expr::evaluate (e, new_elements);
+  delete[] this->elements;
+  this->elements = new_elements;
+  this->dimensions = {e.get_rows (), e.get_cols ()};
+  return *this;
+}
+
+// Accessors of unevaluated expressions: evaluate, then defer to Matrix
+template <typename E>
+Matrix matrix_expr::Expr<E>::eval () const
+{
+  return Matrix (self ());
+}
+
+template <typename E>
+Matrix matrix_expr::Expr<E>::transpose () const
+{
+  Matrix m = eval ();
+  m.transpose ();
+  return m;
+}
+
+template <typename E>
+Matrix matrix_expr::Expr<E>::vectorize () const
+{
+  Matrix m = eval ();
+  m.vectorize ();
+  return m;
+}
+
+template <typename E>
+void matrix_expr::Expr<E>::plain_print () const
+{
+  eval ().plain_print ();
+}
+
+template <typename E>
+Matrix matrix_expr::Expr<E>::dot (const Matrix &m) const
+{
+  return eval ().dot (m);
+}
+
+template <typename E>
+float matrix_expr::Expr<E>::norm () const
+{
+  return eval ().norm ();
+}
+
+template <typename E>
+Matrix matrix_expr::Expr<E>::rref () const
+{
+  return eval ().rref ();
+}
+
+template <typename E>
+int matrix_expr::Expr<E>::argmax () const
+{
+  return eval ().argmax ();
+}
+
+template <typename E>
+float matrix_expr::Expr<E>::sum () const
+{
+  return eval ().sum ();
+}
+
+template <typename E>
+Matrix &Matrix::operator+= (const matrix_expr::Expr<E> &rhs)
+{
+  return *this = *this + rhs.self ();
+}
+
+inline matrix_expr::Hadamard<matrix_expr::Ref, matrix_expr::Ref>
+Matrix::dot (const Matrix &m) const
+{
+  matrix_expr::check_same_dims (*this, m);
+  return {matrix_expr::as_operand (*this), matrix_expr::as_operand (m)};
+}
 
 #endif //MATRIX_H
\ No newline at end of file
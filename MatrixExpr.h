@@ -0,0 +1,212 @@
+// MatrixExpr.h
+#ifndef MATRIXEXPR_H
+#define MATRIXEXPR_H
+
+#include <exception>
+#include <memory>
+
+class Matrix;
+
+/**
+ * Expression templates behind Matrix arithmetic.
+ * operator+, operator*(float), dot and operator*(Matrix) build lightweight
+ * nodes instead of temporary matrices. Assigning a node to a Matrix
+ * evaluates every element-wise operation in one fused loop. A product
+ * runs on Matrix::gemm, and a product plus a matrix accumulates straight
+ * into the destination.
+ * Every expression converts implicitly to a Matrix and offers the
+ * whole-matrix accessors ((a + b).argmax (), (a * b).transpose (), ...),
+ * which evaluate it into a temporary first, so code written against
+ * Matrix-returning operators keeps compiling. Element-wise nodes also read
+ * single elements ((a + b)(i, j), (a + b)[k]) without evaluating anything
+ * else. Products have no element access: assign them to a Matrix first
+ * rather than recomputing the product per element.
+ * Nodes only reference their operands: auto x = a * b; keeps pointers to
+ * a and b and dangles once they go away. Assign to a Matrix instead.
+ */
+namespace matrix_expr
+{
+    /**
+   * CRTP base of every expression (and of Matrix itself).
+   */
+    template <typename E>
+    class Expr
+    {
+     public:
+      const E &self () const
+      {
+        return static_cast<const E &> (*this);
+      }
+
+      // Evaluating accessors, defined in Matrix.h. Matrix and the
+      // element-wise nodes hide the ones they implement directly.
+      Matrix eval () const;
+      Matrix transpose () const;
+      Matrix vectorize () const;
+      void plain_print () const;
+      Matrix dot (const Matrix &m) const;
+      float norm () const;
+      Matrix rref () const;
+      int argmax () const;
+      float sum () const;
+    };
+
+    /**
+   * Leaf node: a view of row-major elements. When the elements belong to a
+   * temporary (a materialized product), owner keeps it alive.
+   */
+    class Ref : public Expr<Ref>
+    {
+     public:
+      const float *elements;
+      int rows, cols;
+      std::shared_ptr<const Matrix> owner;
+
+      Ref (const float *elements, int rows, int cols,
+           std::shared_ptr<const Matrix> owner = nullptr)
+          : elements (elements), rows (rows), cols (cols),
+            owner (std::move (owner))
+      {}
+
+      int get_rows () const
+      { return rows; }
+
+      int get_cols () const
+      { return cols; }
+
+      float operator[] (int i) const
+      { return elements[i]; }
+
+      float operator() (int row, int col) const
+      { return elements[row * cols + col]; }
+    };
+
+    /**
+   * Element-wise lhs + rhs.
+   */
+    template <typename L, typename R>
+    class Sum : public Expr<Sum<L, R>>
+    {
+     public:
+      L lhs;
+      R rhs;
+
+      Sum (L lhs, R rhs) : lhs (std::move (lhs)), rhs (std::move (rhs))
+      {}
+
+      int get_rows () const
+      { return lhs.get_rows (); }
+
+      int get_cols () const
+      { return lhs.get_cols (); }
+
+      float operator[] (int i) const
+      { return lhs[i] + rhs[i]; }
+
+      float operator() (int row, int col) const
+      { return lhs (row, col) + rhs (row, col); }
+    };
+
+    /**
+   * Element-wise (Hadamard) lhs * rhs.
+   */
+    template <typename L, typename R>
+    class Hadamard : public Expr<Hadamard<L, R>>
+    {
+     public:
+      L lhs;
+      R rhs;
+
+      Hadamard (L lhs, R rhs) : lhs (std::move (lhs)), rhs (std::move (rhs))
+      {}
+
+      int get_rows () const
+      { return lhs.get_rows (); }
+
+      int get_cols () const
+      { return lhs.get_cols (); }
+
+      float operator[] (int i) const
+      { return lhs[i] * rhs[i]; }
+
+      float operator() (int row, int col) const
+      { return lhs (row, col) * rhs (row, col); }
+    };
+
+    /**
+   * Element-wise expr * scalar.
+   */
+    template <typename E>
+    class Scaled : public Expr<Scaled<E>>
+    {
+     public:
+      E expr;
+      float scalar;
+
+      Scaled (E expr, float scalar) : expr (std::move (expr)), scalar (scalar)
+      {}
+
+      int get_rows () const
+      { return expr.get_rows (); }
+
+      int get_cols () const
+      { return expr.get_cols (); }
+
+      float operator[] (int i) const
+      { return expr[i] * scalar; }
+
+      float operator() (int row, int col) const
+      { return expr (row, col) * scalar; }
+    };
+
+    /**
+   * Matrix product of two materialized operands. Not element-wise: it is
+   * evaluated by Matrix::gemm, or materialized when used as an operand.
+   */
+    class Product : public Expr<Product>
+    {
+     public:
+      Ref lhs;
+      Ref rhs;
+
+      Product (Ref lhs, Ref rhs) : lhs (std::move (lhs)), rhs (std::move (rhs))
+      {}
+
+      int get_rows () const
+      { return lhs.rows; }
+
+      int get_cols () const
+      { return rhs.cols; }
+
+      // Each element costs a full row-by-column pass; materialize instead
+      float operator[] (int i) const = delete;
+      float operator() (int row, int col) const = delete;
+    };
+
+    /**
+   * product + addend, evaluated by writing the addend into the destination
+   * and letting gemm accumulate the product on top of it.
+   */
+    template <typename X>
+    class GemmSum : public Expr<GemmSum<X>>
+    {
+     public:
+      Product product;
+      X addend;
+
+      GemmSum (Product product, X addend)
+          : product (std::move (product)), addend (std::move (addend))
+      {}
+
+      int get_rows () const
+      { return product.get_rows (); }
+
+      int get_cols () const
+      { return product.get_cols (); }
+
+      float operator[] (int i) const = delete;
+      float operator() (int row, int col) const = delete;
+    };
+}
+
+#endif //MATRIXEXPR_H
@@ -0,0 +1,373 @@
+// MlpIO.cpp
+#include "MlpIO.h"
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <fstream>
+#include <limits>
+#include <sstream>
+
+#define IDX_IMAGES_MAGIC 0x00000803U
+#define IDX_LABELS_MAGIC 0x00000801U
+// Bytes a loader reads (and allocates) at a time
+#define READ_CHUNK (1 << 20)
+
+bool readFileToMatrix (const std::string &filePath, Matrix &mat)
+{
+  std::ifstream inFile (filePath, std::ios::binary);
+  if (!inFile)
+  {
+    std::cerr << "Could not open file for reading: " << filePath << std::endl;
+    return false;
+  }
+  return readFileToMatrix (inFile, mat);
+}
+
+bool readFileToMatrix (std::istream &in, Matrix &mat)
+{
+  // The stream must hold exactly the matrix's floats; read into a buffer
+  // so that mat is left untouched on failure
+  size_t count = size_t (mat.get_rows ()) * mat.get_cols ();
+  std::vector<float> elements (count);
+  std::streamsize expectedSize = std::streamsize (count * sizeof (float));
+  in.read (reinterpret_cast<char *> (elements.data ()), expectedSize);
+  if (in.gcount () != expectedSize
+      || in.peek () != std::char_traits<char>::eof ())
+  {
+    std::cerr << "File size does not match matrix dimensions." << std::endl;
+    return false;
+  }
+  std::copy (elements.begin (), elements.end (), mat.data ());
+  return true;
+}
+
+// Skips whitespace and '#' comments between PGM header fields.
+static void skipPgmSeparators (std::istream &in)
+{
+  while (in)
+  {
+    int c = in.peek ();
+    if (c == '#')
+    {
+      in.ignore (std::numeric_limits<std::streamsize>::max (), '\n');
+    }
+    else if (std::isspace (c))
+    {
+      in.get ();
+    }
+    else
+    {
+      return;
+    }
+  }
+}
+
+// Reads count bytes, growing the buffer chunk by chunk as data arrives. A
+// header claiming more than the stream holds then costs no more memory
+// than the stream's actual contents, seekable or not (pipes, FIFOs).
+static bool readChunked (std::istream &in, std::vector<unsigned char> &bytes,
+                         size_t count)
+{
+  bytes.clear ();
+  while (bytes.size () < count)
+  {
+    size_t offset = bytes.size ();
+    size_t chunk = std::min (count - offset, size_t (READ_CHUNK));
+    bytes.resize (offset + chunk);
+    if (!in.read (reinterpret_cast<char *> (bytes.data () + offset),
+                  std::streamsize (chunk)))
+    {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool readPgm (std::istream &in, std::vector<unsigned char> &pixels,
+              int &width, int &height, const std::string &source)
+{
+  char magic[2] = {};
+  int maxValue = 0;
+  in.read (magic, 2);
+  skipPgmSeparators (in);
+  in >> width;
+  skipPgmSeparators (in);
+  in >> height;
+  skipPgmSeparators (in);
+  in >> maxValue;
+  if (!in || magic[0] != 'P' || magic[1] != '5' || width <= 0
+      || height <= 0 || size_t (width) * size_t (height) > MAX_INPUT_PIXELS
+      || maxValue <= 0 || maxValue > 255 || !std::isspace (in.get ()))
+  {
+    std::cerr << "Invalid PGM file: " << source << std::endl;
+    return false;
+  }
+
+  if (!readChunked (in, pixels, size_t (width) * height))
+  {
+    std::cerr << "Truncated PGM file: " << source << std::endl;
+    return false;
+  }
+  if (maxValue != 255)
+  {
+    for (unsigned char &pixel : pixels)
+    {
+      pixel = static_cast<unsigned char> (
+          std::min (255, pixel * 255 / maxValue));
+    }
+  }
+  return true;
+}
+
+bool readPgm (const std::string &filePath, std::vector<unsigned char> &pixels,
+              int &width, int &height)
+{
+  std::ifstream inFile (filePath, std::ios::binary);
+  return readPgm (inFile, pixels, width, height, filePath);
+}
+
+bool readImageToMatrix (const std::string &filePath, Matrix &img, bool deskew)
+{
+  const std::string extension = ".pgm";
+  if (filePath.size () < extension.size ()
+      || filePath.compare (filePath.size () - extension.size (),
+                           extension.size (), extension) != 0)
+  {
+    return readFileToMatrix (filePath, img);
+  }
+
+  std::ifstream inFile (filePath, std::ios::binary);
+  return readPgmToMatrix (inFile, img, deskew, filePath);
+}
+
+bool readPgmToMatrix (std::istream &in, Matrix &img, bool deskew,
+                      const std::string &source)
+{
+  std::vector<unsigned char> pixels;
+  int width, height;
+  if (!readPgm (in, pixels, width, height, source)
+      || img.get_rows () * img.get_cols () != img_dims.rows * img_dims.cols)
+  {
+    return false;
+  }
+  preprocess::options opts;
+  opts.invert = preprocess::light_background (pixels.data (), width, height);
+  opts.deskew = deskew;
+  preprocess::to_network_input (pixels.data (), width, height, img.data (), 1,
+                                opts);
+  return true;
+}
+
+bool writeMatrixToFile (const std::string &filePath, const Matrix &mat)
+{
+  std::ofstream outFile (filePath, std::ios::binary | std::ios::trunc);
+  if (!outFile)
+  {
+    std::cerr << "Could not open file for writing: " << filePath << std::endl;
+    return false;
+  }
+  outFile.write (reinterpret_cast<const char *> (mat.data ()),
+                 mat.get_rows () * mat.get_cols () * sizeof (float));
+  return static_cast<bool> (outFile);
+}
+
+void loadParameters (char *paths[MLP_SIZE * 2], Matrix weights[MLP_SIZE],
+                     Matrix biases[MLP_SIZE]) noexcept (false)
+{
+  for (int i = 0; i < MLP_SIZE; i++)
+  {
+    weights[i] = Matrix (weights_dims[i].rows, weights_dims[i].cols);
+    biases[i] = Matrix (bias_dims[i].rows, bias_dims[i].cols);
+
+    std::string weightsPath (paths[i]);
+    std::string biasPath (paths[MLP_SIZE + i]);
+
+    if (!(readFileToMatrix (weightsPath, weights[i]) &&
+          readFileToMatrix (biasPath, biases[i])))
+    {
+      auto msg = ERROR_INAVLID_PARAMETER + std::to_string (i + 1);
+      throw std::invalid_argument (msg);
+    }
+
+  }
+}
+
+MlpNetwork loadModel (const std::string &modelPath) noexcept (false)
+{
+  std::ifstream inFile (modelPath);
+  if (!inFile)
+  {
+    throw std::invalid_argument (ERROR_INVALID_MODEL + modelPath);
+  }
+
+  std::string::size_type slash = modelPath.find_last_of ('/');
+  std::string baseDir = slash == std::string::npos
+                        ? "" : modelPath.substr (0, slash + 1);
+
+  std::vector<Dense> layers;
+  std::string line;
+  while (std::getline (inFile, line))
+  {
+    if (line.empty () || line[0] == '#')
+    {
+      continue;
+    }
+    std::istringstream fields (line);
+    std::string type, weightsPath, biasPath, activationName;
+    int rows, cols;
+    if (!(fields >> type >> rows >> cols >> weightsPath >> biasPath
+                 >> activationName) || type != "dense" || rows <= 0
+        || cols <= 0)
+    {
+      throw std::invalid_argument (ERROR_INVALID_MODEL + line);
+    }
+    const activation::Kernel *kernel = activation::find (activationName);
+    if (kernel == nullptr)
+    {
+      throw std::invalid_argument (std::string (ERROR_INVALID_MODEL)
+                                   + "unknown activation " + activationName);
+    }
+
+    Matrix weights (rows, cols);
+    Matrix bias (rows, 1);
+    if (!(readFileToMatrix (weightsPath[0] == '/' ? weightsPath
+                                                  : baseDir + weightsPath,
+                            weights)
+          && readFileToMatrix (biasPath[0] == '/' ? biasPath
+                                                  : baseDir + biasPath, bias)))
+    {
+      auto msg = ERROR_INAVLID_PARAMETER + std::to_string (layers.size () + 1);
+      throw std::invalid_argument (msg);
+    }
+    layers.emplace_back (weights, bias, *kernel);
+  }
+
+  try
+  {
+    return MlpNetwork (std::move (layers));
+  }
+  catch (const std::exception &)
+  {
+    throw std::invalid_argument (ERROR_INVALID_MODEL
+                                 "layers do not chain from an image to the "
+                                 "digits");
+  }
+}
+
+bool readLabelList (const std::string &listPath,
+                    std::vector<std::string> &imagePaths,
+                    std::vector<unsigned int> &labels)
+{
+  std::ifstream inFile (listPath);
+  if (!inFile)
+  {
+    std::cerr << "Could not open file for reading: " << listPath << std::endl;
+    return false;
+  }
+
+  std::string::size_type slash = listPath.find_last_of ('/');
+  std::string baseDir = slash == std::string::npos
+                        ? "" : listPath.substr (0, slash + 1);
+
+  std::string line;
+  while (std::getline (inFile, line))
+  {
+    if (line.empty () || line[0] == '#')
+    {
+      continue;
+    }
+    std::istringstream fields (line);
+    std::string path;
+    unsigned int label;
+    if (!(fields >> path >> label) || label >= DIGITS_COUNT)
+    {
+      std::cerr << "Malformed label line: " << line << std::endl;
+      return false;
+    }
+    imagePaths.push_back (path[0] == '/' ? path : baseDir + path);
+    labels.push_back (label);
+  }
+  return true;
+}
+
+// Reads one big-endian 32 bit integer, as used by IDX headers.
+static bool readBigEndian (std::istream &in, uint32_t &value)
+{
+  unsigned char bytes[4];
+  if (!in.read (reinterpret_cast<char *> (bytes), sizeof (bytes)))
+  {
+    return false;
+  }
+  value = (uint32_t (bytes[0]) << 24) | (uint32_t (bytes[1]) << 16)
+          | (uint32_t (bytes[2]) << 8) | uint32_t (bytes[3]);
+  return true;
+}
+
+bool readIdxImages (std::istream &in, Matrix &images,
+                    const std::string &source)
+{
+  uint32_t magic, count, rows, cols;
+  if (!(in && readBigEndian (in, magic) && magic == IDX_IMAGES_MAGIC
+        && readBigEndian (in, count) && readBigEndian (in, rows)
+        && readBigEndian (in, cols) && count > 0
+        && rows == uint32_t (img_dims.rows) && cols == uint32_t (img_dims.cols)))
+  {
+    std::cerr << "Invalid IDX image file: " << source << std::endl;
+    return false;
+  }
+
+  int size = img_dims.rows * img_dims.cols;
+  std::vector<unsigned char> pixels;
+  if (count > uint32_t (std::numeric_limits<int>::max () / size)
+      || !readChunked (in, pixels, size_t (count) * size))
+  {
+    std::cerr << "Truncated IDX image file: " << source << std::endl;
+    return false;
+  }
+  images = Matrix (int (count), size);
+  preprocess::to_unit_floats (pixels.data (), int (pixels.size ()),
+                              images.data ());
+  return true;
+}
+
+bool readIdxImages (const std::string &filePath, Matrix &images)
+{
+  std::ifstream inFile (filePath, std::ios::binary);
+  return readIdxImages (inFile, images, filePath);
+}
+
+bool readIdxLabels (std::istream &in, std::vector<unsigned int> &labels,
+                    const std::string &source)
+{
+  uint32_t magic, count;
+  if (!(in && readBigEndian (in, magic) && magic == IDX_LABELS_MAGIC
+        && readBigEndian (in, count)))
+  {
+    std::cerr << "Invalid IDX label file: " << source << std::endl;
+    return false;
+  }
+
+  std::vector<unsigned char> bytes;
+  if (!readChunked (in, bytes, count))
+  {
+    std::cerr << "Truncated IDX label file: " << source << std::endl;
+    return false;
+  }
+  for (unsigned char label : bytes)
+  {
+    if (label >= DIGITS_COUNT)
+    {
+      std::cerr << "Invalid label in IDX file: " << source << std::endl;
+      return false;
+    }
+    labels.push_back (label);
+  }
+  return true;
+}
+
+bool readIdxLabels (const std::string &filePath,
+                    std::vector<unsigned int> &labels)
+{
+  std::ifstream inFile (filePath, std::ios::binary);
+  return readIdxLabels (inFile, labels, filePath);
+}
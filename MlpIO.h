@@ -0,0 +1,169 @@
+// MlpIO.h
+#ifndef MLPIO_H
+#define MLPIO_H
+
+#include "MlpNetwork.h"
+#include "Preprocess.h"
+#include <istream>
+#include <string>
+#include <vector>
+
+#define ERROR_INAVLID_PARAMETER "Error: invalid Parameters file for layer: "
+#define ERROR_INVALID_MODEL "Error: invalid model descriptor: "
+
+/**
+ * Given a binary file path and a matrix,
+ * reads the content of the file into the matrix.
+ * file must match matrix in size in order to read successfully.
+ * @param filePath - path of the binary file to read
+ * @param mat -  matrix to read the file into.
+ * @return boolean status
+ *          true - success
+ *          false - failure
+ */
+bool readFileToMatrix (const std::string &filePath, Matrix &mat);
+
+/**
+ * Reads raw floats from a stream into the matrix; the stream must hold
+ * exactly the matrix's elements. Works on non-seekable streams.
+ * @param in - binary stream positioned at the first float
+ * @param mat - matrix to read into; left unchanged on failure
+ * @return boolean status
+ */
+bool readFileToMatrix (std::istream &in, Matrix &mat);
+
+/**
+ * Reads a binary PGM (P5) grayscale image with a maximum value of at most
+ * 255; values are rescaled to 0..255 when the maximum is lower.
+ * @param filePath - path of the PGM file
+ * @param pixels - receives width * height row-major pixels
+ * @param width - receives the image width
+ * @param height - receives the image height
+ * @return boolean status
+ *          true - success
+ *          false - failure (unreadable, not P5, larger than
+ *                  MAX_INPUT_PIXELS or truncated)
+ */
+bool readPgm (const std::string &filePath, std::vector<unsigned char> &pixels,
+              int &width, int &height);
+
+/**
+ * Reads a binary PGM image from a stream, as readPgm does from a file.
+ * @param source - name of the stream in error messages
+ */
+bool readPgm (std::istream &in, std::vector<unsigned char> &pixels,
+              int &width, int &height, const std::string &source = "stream");
+
+/**
+ * Reads an image into an img_dims matrix. Files ending in ".pgm" are 8-bit
+ * images of any size and go through preprocess::to_network_input, with
+ * invert chosen by preprocess::light_background; anything else is read as
+ * raw normalized floats by readFileToMatrix.
+ * @param filePath - path of the image file
+ * @param img - img_dims-sized matrix receiving the image
+ * @param deskew - deskew PGM images
+ * @return boolean status
+ *          true - success
+ *          false - failure
+ */
+bool readImageToMatrix (const std::string &filePath, Matrix &img,
+                        bool deskew = false);
+
+/**
+ * Reads a PGM image from a stream into an img_dims matrix, with the
+ * preprocessing readImageToMatrix applies to ".pgm" files.
+ * @param source - name of the stream in error messages
+ */
+bool readPgmToMatrix (std::istream &in, Matrix &img, bool deskew = false,
+                      const std::string &source = "stream");
+
+/**
+ * Writes the matrix elements as raw floats, the format read by
+ * readFileToMatrix.
+ * @param filePath - path of the binary file to write
+ * @param mat - matrix to write.
+ * @return boolean status
+ *          true - success
+ *          false - failure
+ */
+bool writeMatrixToFile (const std::string &filePath, const Matrix &mat);
+
+/**
+ * Loads MLP parameters from weights & biases paths
+ * to Weights[] and Biases[].
+ * Throws an exception upon failures.
+ * @param paths MLP_SIZE weights paths followed by MLP_SIZE biases paths.
+ * @param weights array of matrix, weigths[i] is the i'th layer weights matrix
+ * @param biases array of matrix, biases[i] is the i'th layer bias matrix
+ *          (which is actually a vector)
+ *  @throw std::invalid_argument in case of problem with a certain argument
+ */
+void loadParameters (char *paths[MLP_SIZE * 2], Matrix weights[MLP_SIZE],
+                     Matrix biases[MLP_SIZE]) noexcept (false);
+
+/**
+ * Loads a network from a model descriptor: one line per layer, input layer
+ * first, of the form
+ *     dense <rows> <cols> <weights path> <bias path> <activation>
+ * where the activation is any name activation::find knows. Blank lines and
+ * lines starting with '#' are skipped, and relative parameter paths are
+ * resolved against the descriptor's directory.
+ * @param modelPath - path of the model descriptor
+ * @return the network
+ * @throw std::invalid_argument in case of an unreadable or malformed
+ *          descriptor, unreadable parameters or layers that do not chain
+ */
+MlpNetwork loadModel (const std::string &modelPath) noexcept (false);
+
+/**
+ * Reads a label list: one "<image path> <digit>" pair per line.
+ * Relative image paths are resolved against the list file's directory.
+ * @param listPath - path of the label list
+ * @param imagePaths - receives the image paths, in file order
+ * @param labels - receives the matching digits
+ * @return boolean status
+ *          true - success
+ *          false - failure (unreadable file or malformed line)
+ */
+bool readLabelList (const std::string &listPath,
+                    std::vector<std::string> &imagePaths,
+                    std::vector<unsigned int> &labels);
+
+/**
+ * Reads an IDX image file (the MNIST distribution format, magic 0x803)
+ * of img_dims-sized unsigned byte images, normalized to [0, 1].
+ * @param filePath - path of the IDX image file
+ * @param images - receives one image per row, img_dims flattened row-major
+ * @return boolean status
+ *          true - success
+ *          false - failure (unreadable, wrong magic or image size)
+ */
+bool readIdxImages (const std::string &filePath, Matrix &images);
+
+/**
+ * Reads IDX images from a stream, as readIdxImages does from a file.
+ * Header counts are not trusted: memory grows only as data arrives.
+ * @param source - name of the stream in error messages
+ */
+bool readIdxImages (std::istream &in, Matrix &images,
+                    const std::string &source = "stream");
+
+/**
+ * Reads an IDX label file (the MNIST distribution format, magic 0x801).
+ * @param filePath - path of the IDX label file
+ * @param labels - receives one digit per image
+ * @return boolean status
+ *          true - success
+ *          false - failure (unreadable, wrong magic or label out of range)
+ */
+bool readIdxLabels (const std::string &filePath,
+                    std::vector<unsigned int> &labels);
+
+/**
+ * Reads IDX labels from a stream, as readIdxLabels does from a file.
+ * @param source - name of the stream in error messages
+ */
+bool readIdxLabels (std::istream &in, std::vector<unsigned int> &labels,
+                    const std::string &source = "stream");
+
+#endif //MLPIO_H
@@ -2,52 +2,232 @@
 // Created by Yuval Cohen on 01/03/2024.
 //
 #include "MlpNetwork.h"
+#include "PerfCounters.h"
+#include <algorithm>
 
 // Constructor implementation
-MlpNetwork::MlpNetwork (const Matrix weights[], const Matrix biases[]) :
-layers {
-    Dense(weights[0], biases[0], activation::relu),
-    Dense(weights[1], biases[1], activation::relu),
-    Dense(weights[2], biases[2], activation::relu),
-    Dense(weights[3], biases[3], activation::softmax)
+MlpNetwork::MlpNetwork (const Matrix weights[], const Matrix biases[])
+{
+  const activation::Kernel &relu = activation::kernel (activation::Kind::RELU);
+  for (int i = 0; i < MLP_SIZE - 1; ++i)
+  {
+    layers.emplace_back (weights[i], biases[i], relu);
+  }
+  layers.emplace_back (weights[MLP_SIZE - 1], biases[MLP_SIZE - 1],
+                       activation::kernel (activation::Kind::SOFTMAX));
+  check_dims ();
+}
+
+MlpNetwork::MlpNetwork (const std::shared_ptr<const Matrix> weights[],
+                        const std::shared_ptr<const Matrix> biases[])
+{
+  const activation::Kernel &relu = activation::kernel (activation::Kind::RELU);
+  for (int i = 0; i < MLP_SIZE - 1; ++i)
+  {
+    layers.emplace_back (weights[i], biases[i], relu);
+  }
+  layers.emplace_back (weights[MLP_SIZE - 1], biases[MLP_SIZE - 1],
+                       activation::kernel (activation::Kind::SOFTMAX));
+  check_dims ();
+}
+
+MlpNetwork::MlpNetwork (std::vector<Dense> layers) : layers (std::move (layers))
+{
+  if (this->layers.empty ())
+  {
+    throw std::exception ();
+  }
+  // Each layer must consume what the previous one produces
+  int inputs = img_dims.rows * img_dims.cols;
+  for (const Dense &layer : this->layers)
+  {
+    const Matrix &weights = layer.get_weights ();
+    const Matrix &bias = layer.get_bias ();
+    if (weights.get_cols () != inputs || bias.get_cols () != 1
+        || bias.get_rows () != weights.get_rows ())
+    {
+      throw std::exception ();
+    }
+    inputs = weights.get_rows ();
+  }
+  if (inputs != DIGITS_COUNT)
+  {
+    throw std::exception ();
+  }
 }
+
+void MlpNetwork::check_dims () const
 {
   // Verify that the weights and biases arrays are the correct size
   for (int i = 0; i < MLP_SIZE; ++i)
   {
-    if (weights[i].get_rows () != weights_dims[i].rows
-        || weights[i].get_cols () != weights_dims[i].cols)
+    const Matrix &weights = layers[i].get_weights ();
+    const Matrix &bias = layers[i].get_bias ();
+    if (weights.get_rows () != weights_dims[i].rows
+        || weights.get_cols () != weights_dims[i].cols)
     {
       throw std::exception ();
     }
-    if (biases[i].get_rows () != bias_dims[i].rows
-        || biases[i].get_cols () != bias_dims[i].cols)
+    if (bias.get_rows () != bias_dims[i].rows
+        || bias.get_cols () != bias_dims[i].cols)
     {
       throw std::exception ();
     }
+  }
+}
+
+int MlpNetwork::layer_count () const
+{
+  return static_cast<int> (layers.size ());
+}
+
+const Dense &MlpNetwork::get_layer (int layer) const
+{
+  if (layer < 0 || layer >= layer_count ())
+  {
+    throw std::exception ();
+  }
+  return layers[layer];
+}
 
+void MlpNetwork::detach ()
+{
+  for (Dense &layer : layers)
+  {
+    layer.detach ();
   }
 }
 
 
-digit MlpNetwork::operator()(const Matrix& input) const {
-  Matrix current_output = input;
+void fill_prediction (const float *probabilities, int stride, unsigned int k,
+                      prediction &result)
+{
+  unsigned int order[DIGITS_COUNT];
+  for (unsigned int i = 0; i < DIGITS_COUNT; ++i)
+  {
+    result.probabilities[i] = probabilities[i * stride];
+    order[i] = i;
+  }
+
+  // Partial selection sort: only the first k positions need to be ordered.
+  // The chosen digit is shifted into place rather than swapped, so the
+  // unselected digits stay in ascending order and ties keep the lower
+  // digit first, matching Matrix::argmax.
+  for (unsigned int i = 0; i < k; ++i)
+  {
+    unsigned int best = i;
+    for (unsigned int j = i + 1; j < DIGITS_COUNT; ++j)
+    {
+      if (result.probabilities[order[j]] > result.probabilities[order[best]])
+      {
+        best = j;
+      }
+    }
+    unsigned int chosen = order[best];
+    std::copy_backward (order + i, order + best, order + best + 1);
+    order[i] = chosen;
+    result.top[i] = {chosen, result.probabilities[chosen]};
+  }
+  result.k = k;
+}
+
+Matrix MlpNetwork::run_layers (const Matrix &input, size_t count) const
+{
+  if (count == 0)
+  {
+    return input;
+  }
+  // Each layer's output is moved into place, never copied
+  const Matrix *current_input = &input;
+  Matrix current_output;
+  for (size_t i = 0; i < count; ++i)
+  {
+    perf::Scope scope (layers[i], input.get_cols ());
+    current_output = layers[i] (*current_input);
+    current_input = &current_output;
+  }
+  return current_output;
+}
 
+digit MlpNetwork::operator() (const Matrix &input) const
+{
+  perf::Scope scope ("network", input.get_cols ());
   // Apply each layer in the network to the input
-  for (int i = 0; i < MLP_SIZE; ++i) {
-    current_output = layers[i](current_output);
+  Matrix current_output = run_layers (input, layers.size ());
+
+  // Return the digit with the associated probability
+  int max_index = current_output.argmax ();
+  return {static_cast<unsigned int>(max_index), current_output[max_index]};
+}
+
+void MlpNetwork::set_storage (int layer, WeightStorage storage)
+{
+  if (layer < 0 || layer >= layer_count ())
+  {
+    throw std::exception ();
+  }
+  layers[layer].set_storage (storage);
+}
+
+Matrix MlpNetwork::logits (const Matrix &input) const
+{
+  Matrix current_output = run_layers (input, layers.size () - 1);
+  perf::Scope scope (layers.back (), input.get_cols ());
+  return layers.back ().affine (current_output);
+}
+
+prediction MlpNetwork::predict (const Matrix &input, unsigned int k) const
+{
+  prediction result;
+  predict_batch (input, &result, k);
+  return result;
+}
+
+void MlpNetwork::predict_batch (const Matrix &images, prediction results[],
+                                unsigned int k) const
+{
+  if (k == 0 || k > DIGITS_COUNT)
+  {
+    throw std::exception ();
+  }
+
+  perf::Scope scope ("network", images.get_cols ());
+  Matrix probabilities = run_layers (images, layers.size ());
+  int batch_size = probabilities.get_cols ();
+  for (int j = 0; j < batch_size; ++j)
+  {
+    fill_prediction (probabilities.data () + j, batch_size, k, results[j]);
   }
+}
 
+digit MlpNetwork::classify (const Matrix &input, float min_confidence) const
+{
+  if (layers.back ().get_activation ().kind != activation::Kind::SOFTMAX)
+  {
+    return (*this) (input); // The logit gap bound only holds for softmax
+  }
+  Matrix output = logits (input);
+  int max_index = output.argmax ();
+  float max_value = output[max_index];
 
-  int max_index = 0;
-  float max_value = current_output(0, 0);
-  for (int i = 1; i < current_output.get_rows(); ++i) {
-    if (current_output(i, 0) > max_value) {
-      max_value = current_output(i, 0);
-      max_index = i;
+  float second_value = -INFINITY;
+  for (int i = 0; i < DIGITS_COUNT; ++i)
+  {
+    if (i != max_index)
+    {
+      second_value = std::max (second_value, output[i]);
     }
   }
 
-  // Return the digit with the associated probability
-  return {static_cast<unsigned int>(max_index), max_value};
+  // Every other logit is at most max - gap, so the winner's probability is
+  // at least 1 / (1 + (DIGITS_COUNT - 1) * e^-gap).
+  float lower_bound = 1.0F / (1.0F + (DIGITS_COUNT - 1)
+                                     * std::exp (second_value - max_value));
+  if (lower_bound >= min_confidence)
+  {
+    return {static_cast<unsigned int>(max_index), lower_bound};
+  }
+
+  Matrix probabilities = activation::softmax (output);
+  return {static_cast<unsigned int>(max_index), probabilities[max_index]};
 }
@@ -3,8 +3,10 @@
 #define MLPNETWORK_H
 
 #include "Dense.h"
+#include <vector>
 
 #define MLP_SIZE 4
+#define DIGITS_COUNT 10
 
 /**
  * @struct digit
@@ -19,6 +21,21 @@ typedef struct digit
     float probability;
 } digit;
 
+/**
+ * @struct prediction
+ * @brief Full network output for one image, sized so that results can be
+ *        written into caller-provided arrays without allocating.
+ * @var top - the k most probable digits, most probable first
+ * @var k - number of valid entries in top
+ * @var probabilities - probability of every digit, indexed by digit value
+ */
+typedef struct prediction
+{
+    digit top[DIGITS_COUNT];
+    unsigned int k;
+    float probabilities[DIGITS_COUNT];
+} prediction;
+
 const matrix_dims img_dims = {28, 28};
 const matrix_dims weights_dims[] = {{128, 784},
                                     {64,  128},
@@ -33,7 +50,11 @@ const matrix_dims bias_dims[] = {{128, 1},
 class MlpNetwork
 {
  private:
-  Dense layers[MLP_SIZE]; // Array of Dense layers
+  std::vector<Dense> layers; // Dense layers, input layer first
+
+  void check_dims () const;
+  // Runs the first count layers, each under a perf::Scope
+  Matrix run_layers (const Matrix &input, size_t count) const;
 
  public:
   /**
@@ -43,12 +64,112 @@ class MlpNetwork
  */
   MlpNetwork (const Matrix weights[], const Matrix biases[]);
 
+  /**
+ * Constructs an MLP network sharing existing parameters; nothing is copied.
+ * @param weights Array of weight matrices for the network layers.
+ * @param biases Array of bias vectors for the network layers.
+ * @throws std::exception if a parameter is empty or has wrong dimensions.
+ */
+  MlpNetwork (const std::shared_ptr<const Matrix> weights[],
+              const std::shared_ptr<const Matrix> biases[]);
+
+  /**
+ * Constructs an MLP network of arbitrary depth and activations, such as
+ * one described by a model file (see loadModel).
+ * @param layers The layers, input layer first.
+ * @throws std::exception if there are no layers, the first layer does not
+ *         take an image, a layer's input does not match the previous
+ *         layer's output, a bias is not a column vector of the layer's
+ *         output size or the last layer does not output DIGITS_COUNT values.
+ */
+  explicit MlpNetwork (std::vector<Dense> layers);
+
+  /**
+  * @return Number of layers in the network.
+  */
+  int layer_count () const;
+
+  /**
+  * Gets one of the network's layers.
+  * @param layer Index of the layer, between 0 and layer_count () - 1.
+  * @return Reference to the layer.
+  * @throws std::exception if layer is out of range.
+  */
+  const Dense &get_layer (int layer) const;
+
+  /**
+  * Gives the network private copies of all its parameters, which copies of
+  * the network otherwise share.
+  */
+  void detach ();
+
   /**
   * Predicts the digit from the input matrix.
   * @param input Matrix representing an image.
   * @return digit struct with the predicted digit and its probability.
   */
   digit operator() (const Matrix &input) const;
+
+  /**
+  * Selects the weight storage of one layer.
+  * @param layer Index of the layer, between 0 and layer_count () - 1.
+  * @param storage The storage the layer should multiply with.
+  * @throws std::exception if layer is out of range.
+  */
+  void set_storage (int layer, WeightStorage storage);
+
+  /**
+  * Runs every layer but the final activation.
+  * @param input Matrix representing an image, or a batch of images with
+  *        one image per column.
+  * @return The output layer's logits, one column per image.
+  */
+  Matrix logits (const Matrix &input) const;
+
+  /**
+  * Predicts the k most probable digits along with the full distribution.
+  * The distribution is the last layer's activation output, which is a
+  * probability distribution when that activation is softmax.
+  * @param input Matrix representing an image.
+  * @param k Number of top digits to report, between 1 and DIGITS_COUNT.
+  * @return prediction struct for the image.
+  * @throws std::exception if k is out of range.
+  */
+  prediction predict (const Matrix &input, unsigned int k) const;
+
+  /**
+  * Predicts a batch of images at once.
+  * @param images Matrix holding one vectorized image per column.
+  * @param results Caller-provided array with room for one prediction per
+  *        column of images.
+  * @param k Number of top digits to report, between 1 and DIGITS_COUNT.
+  * @throws std::exception if k is out of range.
+  */
+  void predict_batch (const Matrix &images, prediction results[],
+                      unsigned int k) const;
+
+  /**
+  * Predicts the most probable digit, skipping the softmax when the gap
+  * between the two largest logits already guarantees min_confidence.
+  * In that case the returned probability is the guaranteed lower bound
+  * 1 / (1 + 9 * e^-gap) rather than the exact value. Networks whose last
+  * activation is not softmax always run the full forward pass.
+  * @param input Matrix representing an image.
+  * @param min_confidence Probability the answer must be known to reach
+  *        for the softmax to be skipped; 0 always skips it.
+  * @return digit struct with the predicted digit and its probability.
+  */
+  digit classify (const Matrix &input, float min_confidence) const;
 };
 
+/**
+ * Fills a prediction from a column of DIGITS_COUNT probabilities.
+ * @param probabilities The probability of digit 0.
+ * @param stride Distance between the probabilities of consecutive digits.
+ * @param k Number of top digits to report, between 1 and DIGITS_COUNT.
+ * @param result The prediction to fill.
+ */
+void fill_prediction (const float *probabilities, int stride, unsigned int k,
+                      prediction &result);
+
 #endif // MLPNETWORK_H
\ No newline at end of file
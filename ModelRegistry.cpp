@@ -0,0 +1,212 @@
+// ModelRegistry.cpp
+#include "ModelRegistry.h"
+#include "MlpIO.h"
+#include <climits>
+#include <cstring>
+#include <mutex>
+#include <set>
+
+#define FNV_OFFSET 1469598103934665603ULL
+#define FNV_PRIME 1099511628211ULL
+
+// FNV-1a over the dimensions and the raw element bytes.
+static uint64_t hashTensor (const Matrix &tensor)
+{
+  int dims[2] = {tensor.get_rows (), tensor.get_cols ()};
+  uint64_t hash = FNV_OFFSET;
+  auto mix = [&hash] (const unsigned char *bytes, size_t size)
+  {
+    for (size_t i = 0; i < size; ++i)
+    {
+      hash = (hash ^ bytes[i]) * FNV_PRIME;
+    }
+  };
+  mix (reinterpret_cast<const unsigned char *> (dims), sizeof (dims));
+  mix (reinterpret_cast<const unsigned char *> (tensor.data ()),
+       size_t (dims[0]) * dims[1] * sizeof (float));
+  return hash;
+}
+
+static size_t tensorBytes (const Matrix &tensor)
+{
+  return size_t (tensor.get_rows ()) * tensor.get_cols () * sizeof (float);
+}
+
+std::shared_ptr<const Matrix>
+ModelRegistry::intern_locked (const Matrix &tensor)
+{
+  uint64_t hash = hashTensor (tensor);
+  auto range = tensors.equal_range (hash);
+  for (auto it = range.first; it != range.second;)
+  {
+    std::shared_ptr<const Matrix> existing = it->second.lock ();
+    if (!existing)
+    {
+      it = tensors.erase (it); // Its last network is gone
+      continue;
+    }
+    // A hash match is only a candidate: confirm byte for byte
+    if (existing->get_rows () == tensor.get_rows ()
+        && existing->get_cols () == tensor.get_cols ()
+        && std::memcmp (existing->data (), tensor.data (),
+                        tensorBytes (tensor)) == 0)
+    {
+      return existing;
+    }
+    ++it;
+  }
+  std::shared_ptr<const Matrix> added = std::make_shared<const Matrix> (tensor);
+  tensors.emplace (hash, added);
+  return added;
+}
+
+std::shared_ptr<const Matrix> ModelRegistry::intern (const Matrix &tensor)
+{
+  std::lock_guard<std::shared_timed_mutex> lock (mutex);
+  return intern_locked (tensor);
+}
+
+unsigned int ModelRegistry::add (const std::string &id,
+                                 const Matrix weights[],
+                                 const Matrix biases[])
+{
+  std::lock_guard<std::shared_timed_mutex> lock (mutex);
+  std::shared_ptr<const Matrix> sharedWeights[MLP_SIZE];
+  std::shared_ptr<const Matrix> sharedBiases[MLP_SIZE];
+  for (int i = 0; i < MLP_SIZE; ++i)
+  {
+    sharedWeights[i] = intern_locked (weights[i]);
+    sharedBiases[i] = intern_locked (biases[i]);
+  }
+  std::shared_ptr<const MlpNetwork> network
+      = std::make_shared<const MlpNetwork> (sharedWeights, sharedBiases);
+
+  versions &model = models[id];
+  unsigned int version = model.empty () ? 1 : model.rbegin ()->first + 1;
+  model[version] = network;
+  active[id] = version;
+  return version;
+}
+
+unsigned int ModelRegistry::load (const std::string &id,
+                                  char *paths[MLP_SIZE * 2])
+{
+  Matrix weights[MLP_SIZE];
+  Matrix biases[MLP_SIZE];
+  loadParameters (paths, weights, biases);
+  return add (id, weights, biases);
+}
+
+bool ModelRegistry::activate (const std::string &id, unsigned int version)
+{
+  std::lock_guard<std::shared_timed_mutex> lock (mutex);
+  auto model = models.find (id);
+  if (model == models.end () || model->second.count (version) == 0)
+  {
+    return false;
+  }
+  active[id] = version;
+  return true;
+}
+
+bool ModelRegistry::remove (const std::string &id, unsigned int version)
+{
+  std::lock_guard<std::shared_timed_mutex> lock (mutex);
+  auto model = models.find (id);
+  if (model == models.end () || model->second.erase (version) == 0)
+  {
+    return false;
+  }
+  if (model->second.empty ())
+  {
+    models.erase (model);
+    active.erase (id);
+  }
+  else if (active[id] == version)
+  {
+    active[id] = model->second.rbegin ()->first;
+  }
+  return true;
+}
+
+std::shared_ptr<const MlpNetwork>
+ModelRegistry::get (const std::string &id) const
+{
+  std::shared_lock<std::shared_timed_mutex> lock (mutex);
+  auto version = active.find (id);
+  if (version == active.end ())
+  {
+    return nullptr;
+  }
+  return models.at (id).at (version->second);
+}
+
+std::shared_ptr<const MlpNetwork>
+ModelRegistry::get (const std::string &id, unsigned int version) const
+{
+  std::shared_lock<std::shared_timed_mutex> lock (mutex);
+  auto model = models.find (id);
+  if (model == models.end ())
+  {
+    return nullptr;
+  }
+  auto network = model->second.find (version);
+  return network == model->second.end () ? nullptr : network->second;
+}
+
+std::shared_ptr<const MlpNetwork>
+ModelRegistry::resolve (const std::string &route) const
+{
+  size_t at = route.rfind ('@');
+  if (at == std::string::npos)
+  {
+    return get (route);
+  }
+  const std::string version = route.substr (at + 1);
+  if (version.empty ()
+      || version.find_first_not_of ("0123456789") != std::string::npos)
+  {
+    return nullptr;
+  }
+  // Digit by digit, so that versions past UINT_MAX miss instead of
+  // throwing or wrapping around onto a small version
+  unsigned long number = 0;
+  for (char digit : version)
+  {
+    number = number * 10 + static_cast<unsigned long> (digit - '0');
+    if (number > UINT_MAX)
+    {
+      return nullptr;
+    }
+  }
+  return get (route.substr (0, at), static_cast<unsigned int> (number));
+}
+
+registry_stats ModelRegistry::stats () const
+{
+  std::shared_lock<std::shared_timed_mutex> lock (mutex);
+  registry_stats result = {0, 0, 0, 0};
+  std::set<const Matrix *> distinct;
+  for (const auto &model : models)
+  {
+    for (const auto &version : model.second)
+    {
+      ++result.models;
+      for (int i = 0; i < version.second->layer_count (); ++i)
+      {
+        const Dense &layer = version.second->get_layer (i);
+        for (const Matrix *tensor : {&layer.get_weights (),
+                                     &layer.get_bias ()})
+        {
+          result.logical_bytes += tensorBytes (*tensor);
+          if (distinct.insert (tensor).second)
+          {
+            result.tensor_bytes += tensorBytes (*tensor);
+          }
+        }
+      }
+    }
+  }
+  result.tensors = distinct.size ();
+  return result;
+}
@@ -0,0 +1,123 @@
+// ModelRegistry.h
+#ifndef MODELREGISTRY_H
+#define MODELREGISTRY_H
+
+#include "MlpNetwork.h"
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+
+/**
+ * Memory accounting of a registry.
+ * @var models - registered (id, version) pairs
+ * @var tensors - distinct parameter tensors of the registered models
+ * @var tensor_bytes - bytes held by those tensors
+ * @var logical_bytes - bytes the models would hold without sharing
+ */
+typedef struct registry_stats
+{
+    size_t models;
+    size_t tensors;
+    size_t tensor_bytes;
+    size_t logical_bytes;
+} registry_stats;
+
+/**
+ * Serves several networks side by side, each registered under an id with
+ * increasing versions. Parameter tensors are interned: a layer identical to
+ * one already registered (same dimensions and bytes) reuses it, so a new
+ * variant only costs the layers that actually differ. Networks are
+ * immutable once registered and are handed out as shared pointers; a
+ * network stays alive while any caller holds it, even after removal.
+ * All member functions are thread-safe.
+ */
+class ModelRegistry
+{
+ private:
+  typedef std::map<unsigned int, std::shared_ptr<const MlpNetwork>> versions;
+
+  std::unordered_multimap<uint64_t, std::weak_ptr<const Matrix>> tensors;
+  std::map<std::string, versions> models;
+  std::map<std::string, unsigned int> active;
+  mutable std::shared_timed_mutex mutex;
+
+  std::shared_ptr<const Matrix> intern_locked (const Matrix &tensor);
+
+ public:
+  /**
+ * Returns the registered tensor equal to the given one, registering a copy
+ * if there is none.
+ * @param tensor The tensor to look up.
+ * @return Shared immutable tensor equal to tensor.
+ */
+  std::shared_ptr<const Matrix> intern (const Matrix &tensor);
+
+/**
+ * Registers a network as the next version of a model, and makes it the
+ * model's active version.
+ * @param id The model id.
+ * @param weights Array of weight matrices for the network layers.
+ * @param biases Array of bias vectors for the network layers.
+ * @return The version assigned, starting at 1 for each id.
+ * @throws std::exception if the parameters have wrong dimensions.
+ */
+  unsigned int add (const std::string &id, const Matrix weights[],
+                    const Matrix biases[]);
+
+/**
+ * Loads a parameter set and registers it like add.
+ * @param id The model id.
+ * @param paths MLP_SIZE weights paths followed by MLP_SIZE biases paths.
+ * @return The version assigned.
+ * @throw std::invalid_argument in case of problem with a parameter file
+ */
+  unsigned int load (const std::string &id, char *paths[MLP_SIZE * 2]);
+
+/**
+ * Routes new requests for a model to one of its versions, e.g. to roll
+ * back or to keep a challenger registered without serving it by default.
+ * @param id The model id.
+ * @param version A registered version of the model.
+ * @return false if the version is not registered.
+ */
+  bool activate (const std::string &id, unsigned int version);
+
+/**
+ * Unregisters a version. Tensors no other network uses are freed once the
+ * last holder of the network releases it. Removing the active version
+ * activates the latest remaining one.
+ * @return false if the version is not registered.
+ */
+  bool remove (const std::string &id, unsigned int version);
+
+/**
+ * @param id The model id.
+ * @return The model's active version, or nullptr if the id is unknown.
+ */
+  std::shared_ptr<const MlpNetwork> get (const std::string &id) const;
+
+/**
+ * @param id The model id.
+ * @param version The version wanted.
+ * @return The network, or nullptr if not registered.
+ */
+  std::shared_ptr<const MlpNetwork> get (const std::string &id,
+                                         unsigned int version) const;
+
+/**
+ * Resolves a route of the form "id" (the active version) or "id@version".
+ * @param route The route.
+ * @return The network, or nullptr if nothing matches.
+ */
+  std::shared_ptr<const MlpNetwork> resolve (const std::string &route) const;
+
+/**
+ * @return Memory accounting of the registered models.
+ */
+  registry_stats stats () const;
+};
+
+#endif //MODELREGISTRY_H
\ No newline at end of file
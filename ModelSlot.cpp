@@ -0,0 +1,176 @@
+// ModelSlot.cpp
+#include "ModelSlot.h"
+#include "MlpIO.h"
+#include <chrono>
+#include <cmath>
+#include <thread>
+
+using slot_clock = std::chrono::steady_clock;
+
+ModelSlot::Reader::Reader (const ModelSlot *slot, const MlpNetwork *network,
+                           int parity)
+    : slot (slot), network (network), parity (parity)
+{}
+
+ModelSlot::Reader::Reader (Reader &&other) noexcept
+    : slot (other.slot), network (other.network), parity (other.parity)
+{
+  other.slot = nullptr;
+}
+
+ModelSlot::Reader::~Reader ()
+{
+  if (slot != nullptr)
+  {
+    slot->readers[parity].fetch_sub (1);
+  }
+}
+
+const MlpNetwork &ModelSlot::Reader::operator* () const
+{
+  return *network;
+}
+
+const MlpNetwork *ModelSlot::Reader::operator-> () const
+{
+  return network;
+}
+
+ModelSlot::ModelSlot (std::unique_ptr<const MlpNetwork> initial)
+    : current (initial.get ()), current_version (1), epoch (0),
+      readers {{0}, {0}}
+{
+  if (!initial)
+  {
+    throw std::exception ();
+  }
+  initial.release ();
+}
+
+ModelSlot::~ModelSlot ()
+{
+  delete current.load ();
+}
+
+ModelSlot::Reader ModelSlot::acquire () const
+{
+  // All operations are sequentially consistent: the counter increment must
+  // be ordered before the pointer load, and swap relies on it
+  while (true)
+  {
+    int parity = static_cast<int> (epoch.load () & 1);
+    readers[parity].fetch_add (1);
+    if (static_cast<int> (epoch.load () & 1) == parity)
+    {
+      return Reader (this, current.load (), parity);
+    }
+    readers[parity].fetch_sub (1); // A swap flipped the epoch; retry
+  }
+}
+
+unsigned long ModelSlot::version () const
+{
+  return current_version.load ();
+}
+
+void ModelSlot::wait_for_readers (int parity) const
+{
+  for (int spins = 0; readers[parity].load () != 0; ++spins)
+  {
+    if (spins < 64)
+    {
+      std::this_thread::yield ();
+    }
+    else
+    {
+      std::this_thread::sleep_for (std::chrono::microseconds (50));
+    }
+  }
+}
+
+swap_report ModelSlot::swap (std::unique_ptr<const MlpNetwork> next)
+{
+  if (!next)
+  {
+    throw std::exception ();
+  }
+  std::lock_guard<std::mutex> lock (swap_mutex);
+  auto start = slot_clock::now ();
+
+  const MlpNetwork *old = current.exchange (next.release ());
+  unsigned long version = current_version.fetch_add (1) + 1;
+  auto published = slot_clock::now ();
+  long in_flight = readers[0].load () + readers[1].load ();
+
+  // Readers of the old network sit in either counter: stragglers of the
+  // previous epoch in the other parity, everyone else in the current one
+  unsigned long old_epoch = epoch.load ();
+  wait_for_readers (static_cast<int> ((old_epoch + 1) & 1));
+  epoch.store (old_epoch + 1);
+  wait_for_readers (static_cast<int> (old_epoch & 1));
+  delete old;
+
+  std::chrono::duration<double, std::micro> publish = published - start;
+  std::chrono::duration<double, std::micro> retire
+      = slot_clock::now () - published;
+  return {true, version, 0.0, publish.count (), retire.count (), in_flight};
+}
+
+// Rejects networks that turn a blank image into NaNs or infinities.
+static bool producesFiniteOutput (const MlpNetwork &candidate)
+{
+  Matrix blank (img_dims.rows * img_dims.cols, 1);
+  prediction result = candidate.predict (blank, 1);
+  for (float probability : result.probabilities)
+  {
+    if (!std::isfinite (probability))
+    {
+      return false;
+    }
+  }
+  return true;
+}
+
+std::future<swap_report> ModelSlot::reload (std::vector<std::string> paths,
+                                            Validator validate)
+{
+  return std::async (std::launch::async, [this, paths, validate] ()
+  {
+    auto start = slot_clock::now ();
+    swap_report failed = {false, version (), 0.0, 0.0, 0.0, 0};
+    if (paths.size () != MLP_SIZE * 2)
+    {
+      return failed;
+    }
+    std::vector<char *> pathArgs;
+    for (const std::string &path : paths)
+    {
+      pathArgs.push_back (const_cast<char *> (path.c_str ()));
+    }
+
+    std::unique_ptr<const MlpNetwork> candidate;
+    try
+    {
+      Matrix weights[MLP_SIZE];
+      Matrix biases[MLP_SIZE];
+      loadParameters (pathArgs.data (), weights, biases);
+      candidate.reset (new MlpNetwork (weights, biases));
+    }
+    catch (const std::exception &)
+    {
+      return failed;
+    }
+    std::chrono::duration<double, std::milli> loaded
+        = slot_clock::now () - start;
+    failed.load_ms = loaded.count ();
+    if (!producesFiniteOutput (*candidate)
+        || (validate && !validate (*candidate)))
+    {
+      return failed;
+    }
+
+    swap_report report = swap (std::move (candidate));
+    report.load_ms = loaded.count ();
+    return report;
+  });
+}
@@ -0,0 +1,137 @@
+// ModelSlot.h
+#ifndef MODELSLOT_H
+#define MODELSLOT_H
+
+#include "MlpNetwork.h"
+#include <atomic>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/**
+ * Outcome of one model swap.
+ * @var swapped - false if loading or validation failed; the old model stays
+ * @var version - version serving requests after the call
+ * @var load_ms - milliseconds spent loading and validating (reload only)
+ * @var publish_us - microseconds until new readers saw the new model
+ * @var retire_us - microseconds spent waiting for readers of the old model
+ * @var in_flight - readers holding a model when the new one was published
+ */
+typedef struct swap_report
+{
+    bool swapped;
+    unsigned long version;
+    double load_ms;
+    double publish_us;
+    double retire_us;
+    long in_flight;
+} swap_report;
+
+/**
+ * Holds the network currently serving requests and replaces it while
+ * requests are running.
+ * Readers never lock: acquire () adds the reader to one of two counters
+ * selected by the current epoch. A swap publishes the new network first,
+ * then waits until the counter of the other parity drains, flips the epoch
+ * and waits until the old parity drains. After that no reader can still
+ * hold the old network, and it is deleted. Readers that arrive during a
+ * swap already get the new network, so a swap never blocks on new traffic.
+ * Swaps are serialized among themselves.
+ */
+class ModelSlot
+{
+ public:
+  /**
+ * Decides whether a freshly loaded network may replace the current one.
+ */
+  typedef std::function<bool (const MlpNetwork &candidate)> Validator;
+
+  /**
+ * Keeps the network it was acquired with alive until destroyed.
+ * Move-only, and meant to be held for the length of one request.
+ */
+  class Reader
+  {
+   private:
+    const ModelSlot *slot;
+    const MlpNetwork *network;
+    int parity;
+
+    friend class ModelSlot;
+    Reader (const ModelSlot *slot, const MlpNetwork *network, int parity);
+
+   public:
+    Reader (Reader &&other) noexcept;
+    Reader (const Reader &) = delete;
+    Reader &operator= (const Reader &) = delete;
+    Reader &operator= (Reader &&) = delete;
+    ~Reader ();
+
+    const MlpNetwork &operator* () const;
+    const MlpNetwork *operator-> () const;
+  };
+
+ private:
+  std::atomic<const MlpNetwork *> current;
+  std::atomic<unsigned long> current_version;
+  mutable std::atomic<unsigned long> epoch;
+  mutable std::atomic<long> readers[2];
+  std::mutex swap_mutex;
+
+  void wait_for_readers (int parity) const;
+
+ public:
+  /**
+ * @param initial The first network to serve, as version 1.
+ * @throws std::exception if initial is empty.
+ */
+  explicit ModelSlot (std::unique_ptr<const MlpNetwork> initial);
+
+/**
+ * Deletes the current network. No Reader may outlive the slot.
+ */
+  ~ModelSlot ();
+
+  ModelSlot (const ModelSlot &) = delete;
+  ModelSlot &operator= (const ModelSlot &) = delete;
+
+/**
+ * Takes a reference to the current network; wait-free apart from a retry
+ * when a swap flips the epoch in between.
+ * @return Reader keeping the network alive.
+ */
+  Reader acquire () const;
+
+/**
+ * @return The version of the current network, counting swaps from 1.
+ */
+  unsigned long version () const;
+
+/**
+ * Replaces the current network and deletes the old one once its last
+ * reader is done. Blocks until then.
+ * @param next The network to serve from now on.
+ * @return Report of the swap.
+ * @throws std::exception if next is empty.
+ */
+  swap_report swap (std::unique_ptr<const MlpNetwork> next);
+
+/**
+ * Loads a parameter set on a background thread, validates it and swaps it
+ * in. Requests keep being served by the current network meanwhile.
+ * A network is always checked to produce a finite distribution on a blank
+ * image; validate can add checks of its own (e.g. accuracy on a hold-out
+ * set).
+ * @param paths MLP_SIZE weights paths followed by MLP_SIZE biases paths.
+ * @param validate Optional extra check of the loaded network.
+ * @return Future receiving the report; swapped is false if the files could
+ *         not be loaded or validation failed.
+ */
+  std::future<swap_report> reload (std::vector<std::string> paths,
+                                   Validator validate = Validator ());
+};
+
+#endif //MODELSLOT_H
\ No newline at end of file
@@ -0,0 +1,195 @@
+// NumaTopology.cpp
+#include "NumaTopology.h"
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <thread>
+
+#include <pthread.h>
+#include <sched.h>
+
+#define NODE_SYSFS "/sys/devices/system/node/node"
+#define MAX_NODES 1024
+
+// CPUs this process is allowed to run on, in increasing order.
+static std::vector<int> allowedCpus ()
+{
+  std::vector<int> cpus;
+  cpu_set_t set;
+  CPU_ZERO (&set);
+  if (sched_getaffinity (0, sizeof (set), &set) == 0)
+  {
+    for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+    {
+      if (CPU_ISSET (cpu, &set))
+      {
+        cpus.push_back (cpu);
+      }
+    }
+  }
+  return cpus;
+}
+
+// Parses a sysfs CPU list such as "0-3,8,10-11".
+static std::vector<int> parseCpuList (const std::string &list)
+{
+  std::vector<int> cpus;
+  std::stringstream ranges (list);
+  std::string range;
+  while (std::getline (ranges, range, ','))
+  {
+    int first, last;
+    char dash;
+    std::stringstream in (range);
+    if (!(in >> first))
+    {
+      continue;
+    }
+    last = (in >> dash >> last && dash == '-') ? last : first;
+    for (int cpu = first; cpu <= last; ++cpu)
+    {
+      cpus.push_back (cpu);
+    }
+  }
+  return cpus;
+}
+
+NumaTopology::NumaTopology () : node_cpus (1), simulated (false)
+{}
+
+NumaTopology NumaTopology::detect ()
+{
+  const char *simulatedNodes = std::getenv (NUMA_SIMULATE_ENV);
+  if (simulatedNodes != nullptr && std::atoi (simulatedNodes) > 0)
+  {
+    return simulate (std::atoi (simulatedNodes));
+  }
+
+  std::vector<int> allowed = allowedCpus ();
+  NumaTopology topology;
+  topology.node_cpus.clear ();
+  for (int node = 0; node < MAX_NODES; ++node)
+  {
+    std::ifstream cpuList (NODE_SYSFS + std::to_string (node) + "/cpulist");
+    std::string list;
+    if (!cpuList || !std::getline (cpuList, list))
+    {
+      continue; // Node ids may have gaps
+    }
+    std::vector<int> cpus;
+    for (int cpu : parseCpuList (list))
+    {
+      if (std::binary_search (allowed.begin (), allowed.end (), cpu))
+      {
+        cpus.push_back (cpu);
+      }
+    }
+    if (!cpus.empty ()) // Memory-only nodes have no workers to serve
+    {
+      topology.node_cpus.push_back (cpus);
+    }
+  }
+  if (topology.node_cpus.empty ())
+  {
+    topology.node_cpus.push_back (allowed);
+  }
+  return topology;
+}
+
+NumaTopology NumaTopology::simulate (int nodes)
+{
+  if (nodes <= 0)
+  {
+    throw std::exception ();
+  }
+  std::vector<int> allowed = allowedCpus ();
+  NumaTopology topology;
+  topology.simulated = true;
+  topology.node_cpus.assign (nodes, std::vector<int> ());
+  int count = static_cast<int> (allowed.size ());
+  if (count == 0)
+  {
+    return topology;
+  }
+  if (count < nodes)
+  {
+    for (int node = 0; node < nodes; ++node)
+    {
+      topology.node_cpus[node].push_back (allowed[node % count]);
+    }
+    return topology;
+  }
+  for (int i = 0; i < count; ++i)
+  {
+    topology.node_cpus[i * nodes / count].push_back (allowed[i]);
+  }
+  return topology;
+}
+
+int NumaTopology::node_count () const
+{
+  return static_cast<int> (node_cpus.size ());
+}
+
+const std::vector<int> &NumaTopology::cpus (int node) const
+{
+  if (node < 0 || node >= node_count ())
+  {
+    throw std::exception ();
+  }
+  return node_cpus[node];
+}
+
+bool NumaTopology::is_simulated () const
+{
+  return simulated;
+}
+
+bool NumaTopology::pin_to_node (int node) const
+{
+  const std::vector<int> &node_set = cpus (node);
+  if (node_set.empty ())
+  {
+    return false;
+  }
+  cpu_set_t set;
+  CPU_ZERO (&set);
+  for (int cpu : node_set)
+  {
+    CPU_SET (cpu, &set);
+  }
+  return pthread_setaffinity_np (pthread_self (), sizeof (set), &set) == 0;
+}
+
+std::vector<std::unique_ptr<const MlpNetwork>>
+NumaTopology::replicate (const MlpNetwork &mlp) const
+{
+  std::vector<std::unique_ptr<const MlpNetwork>> replicas (node_count ());
+  for (int node = 0; node < node_count (); ++node)
+  {
+    // One node at a time: copies are small, and a failed copy can rethrow
+    std::exception_ptr error;
+    std::thread copier ([&, node] ()
+                        {
+                          try
+                          {
+                            pin_to_node (node);
+                            std::unique_ptr<MlpNetwork> replica (
+                                new MlpNetwork (mlp));
+                            replica->detach ();
+                            replicas[node] = std::move (replica);
+                          }
+                          catch (...)
+                          {
+                            error = std::current_exception ();
+                          }
+                        });
+    copier.join ();
+    if (error)
+    {
+      std::rethrow_exception (error);
+    }
+  }
+  return replicas;
+}
@@ -0,0 +1,88 @@
+// NumaTopology.h
+#ifndef NUMATOPOLOGY_H
+#define NUMATOPOLOGY_H
+
+#include "MlpNetwork.h"
+#include <memory>
+#include <vector>
+
+// Environment variable that replaces the detected topology with a
+// simulated one of the given number of nodes, for single-socket testing
+#define NUMA_SIMULATE_ENV "MLP_NUMA_NODES"
+
+/**
+ * The NUMA nodes of the host and the CPUs this process may run on in each.
+ * Pinning a thread to a node's CPUs makes the kernel's default first-touch
+ * policy place whatever that thread allocates and writes in the node's
+ * memory; replicate() relies on this to give each node its own copy of
+ * the network parameters.
+ */
+class NumaTopology
+{
+ private:
+  std::vector<std::vector<int>> node_cpus;
+  bool simulated;
+
+ public:
+  /**
+ * A single node with unknown CPUs; pinning to it does nothing.
+ */
+  NumaTopology ();
+
+/**
+ * Reads the topology from /sys/devices/system/node, keeping only nodes with
+ * CPUs in this process's affinity mask. Falls back to a single node when
+ * sysfs is unavailable. When NUMA_SIMULATE_ENV is set to a positive number,
+ * returns simulate () of that many nodes instead.
+ * @return The host's topology.
+ */
+  static NumaTopology detect ();
+
+/**
+ * Splits the CPUs this process may run on into contiguous groups posing as
+ * nodes. With fewer CPUs than nodes, nodes share CPUs. Memory is not
+ * actually local to any group, but every code path of a multi-node host
+ * (replication, pinning, routing) is exercised.
+ * @param nodes Number of nodes to simulate.
+ * @return The simulated topology.
+ * @throws std::exception if nodes is not positive.
+ */
+  static NumaTopology simulate (int nodes);
+
+/**
+ * @return Number of nodes, at least 1.
+ */
+  int node_count () const;
+
+/**
+ * @param node Index of the node.
+ * @return The CPUs of the node; empty if unknown.
+ * @throws std::exception if node is out of range.
+ */
+  const std::vector<int> &cpus (int node) const;
+
+/**
+ * @return true if the topology came from simulate ().
+ */
+  bool is_simulated () const;
+
+/**
+ * Restricts the calling thread to the CPUs of a node.
+ * @param node Index of the node.
+ * @return true if the thread was pinned.
+ * @throws std::exception if node is out of range.
+ */
+  bool pin_to_node (int node) const;
+
+/**
+ * Copies the network once per node, each copy made by a thread pinned to
+ * its node and detached from the shared parameters so that the copied
+ * parameters are first touched there.
+ * @param mlp The network to copy.
+ * @return One replica per node, indexed by node.
+ */
+  std::vector<std::unique_ptr<const MlpNetwork>>
+  replicate (const MlpNetwork &mlp) const;
+};
+
+#endif //NUMATOPOLOGY_H
\ No newline at end of file
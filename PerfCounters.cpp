@@ -0,0 +1,301 @@
+// PerfCounters.cpp
+#include "PerfCounters.h"
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <iomanip>
+#include <map>
+#include <mutex>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#define MEMORY_BOUND_STALLS 0.5
+#define MEMORY_BOUND_MPKI 1.0
+
+namespace
+{
+    std::atomic<bool> profiling (false);
+    std::atomic<unsigned int> opened_events (0); // Bit i: Event i opened
+
+    struct totals
+    {
+        long calls;
+        long samples;
+        double seconds;
+        uint64_t events[PERF_EVENT_COUNT];
+    };
+
+    std::mutex totals_mutex;
+    std::map<std::string, totals> &all_totals ()
+    {
+      static std::map<std::string, totals> instance;
+      return instance;
+    }
+
+    const uint64_t event_configs[PERF_EVENT_COUNT] = {
+        PERF_COUNT_HW_CPU_CYCLES,
+        PERF_COUNT_HW_INSTRUCTIONS,
+        PERF_COUNT_HW_CACHE_MISSES,
+        PERF_COUNT_HW_STALLED_CYCLES_BACKEND
+    };
+
+    /**
+   * The calling thread's counters: one group, read with a single read ().
+   * Events that cannot be opened are left out of the group.
+   */
+    class CounterGroup
+    {
+     private:
+      int fds[PERF_EVENT_COUNT];
+      int positions[PERF_EVENT_COUNT]; // Index in the group's read, or -1
+      int members;
+
+     public:
+      CounterGroup () : members (0)
+      {
+        for (int e = 0; e < PERF_EVENT_COUNT; ++e)
+        {
+          fds[e] = -1;
+          positions[e] = -1;
+          int leader = e == 0 ? -1 : fds[0];
+          if (e > 0 && leader < 0)
+          {
+            continue; // Without cycles there is no group to join
+          }
+          perf_event_attr attr;
+          std::memset (&attr, 0, sizeof (attr));
+          attr.size = sizeof (attr);
+          attr.type = PERF_TYPE_HARDWARE;
+          attr.config = event_configs[e];
+          attr.read_format = PERF_FORMAT_GROUP;
+          attr.disabled = e == 0;
+          attr.exclude_kernel = 1;
+          attr.exclude_hv = 1;
+          fds[e] = static_cast<int> (syscall (__NR_perf_event_open, &attr, 0,
+                                              -1, leader, 0));
+          if (fds[e] >= 0)
+          {
+            positions[e] = members++;
+            opened_events.fetch_or (1U << e);
+          }
+        }
+        if (fds[0] >= 0)
+        {
+          ioctl (fds[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+        }
+      }
+
+      ~CounterGroup ()
+      {
+        for (int fd : fds)
+        {
+          if (fd >= 0)
+          {
+            close (fd);
+          }
+        }
+      }
+
+      CounterGroup (const CounterGroup &) = delete;
+      CounterGroup &operator= (const CounterGroup &) = delete;
+
+      // Current values, zero for events that are not counted
+      void read_values (uint64_t values[PERF_EVENT_COUNT]) const
+      {
+        uint64_t buffer[1 + PERF_EVENT_COUNT] = {};
+        if (members == 0
+            || ::read (fds[0], buffer, sizeof (buffer))
+               < static_cast<ssize_t> (sizeof (uint64_t) * (1 + members)))
+        {
+          std::fill (values, values + PERF_EVENT_COUNT, 0);
+          return;
+        }
+        for (int e = 0; e < PERF_EVENT_COUNT; ++e)
+        {
+          values[e] = positions[e] < 0 ? 0 : buffer[1 + positions[e]];
+        }
+      }
+    };
+
+    const CounterGroup &thread_counters ()
+    {
+      thread_local CounterGroup group;
+      return group;
+    }
+
+    const char *storage_suffix (WeightStorage storage)
+    {
+      switch (storage)
+      {
+        case WeightStorage::CSR:
+          return " csr";
+        case WeightStorage::CSC:
+          return " csc";
+        default:
+          return "";
+      }
+    }
+}
+
+namespace perf
+{
+    void enable (bool on)
+    {
+      profiling.store (on);
+    }
+
+    bool enabled ()
+    {
+      return profiling.load (std::memory_order_relaxed);
+    }
+
+    bool available (Event event)
+    {
+      return (opened_events.load () >> static_cast<int> (event)) & 1U;
+    }
+
+    std::vector<profile> profiles ()
+    {
+      std::lock_guard<std::mutex> lock (totals_mutex);
+      std::vector<profile> result;
+      for (const auto &entry : all_totals ())
+      {
+        profile p {entry.first, entry.second.calls, entry.second.samples,
+                   entry.second.seconds, {}};
+        std::copy (entry.second.events, entry.second.events + PERF_EVENT_COUNT,
+                   p.events);
+        result.push_back (p);
+      }
+      return result;
+    }
+
+    void reset ()
+    {
+      std::lock_guard<std::mutex> lock (totals_mutex);
+      all_totals ().clear ();
+    }
+
+    void print (std::ostream &out)
+    {
+      auto event = [] (const profile &p, Event e)
+      { return static_cast<double> (p.events[static_cast<int> (e)]); };
+      bool cycles = available (Event::CYCLES);
+      bool instructions = available (Event::INSTRUCTIONS);
+      bool misses = available (Event::LLC_MISSES);
+      bool stalls = available (Event::BACKEND_STALLS);
+
+      out << "perf counters:" << (cycles ? "" : " unavailable, wall time only")
+          << std::endl << std::left << std::setw (20) << "shape" << std::right
+          << std::setw (9) << "calls" << std::setw (12) << "us/image"
+          << std::setw (14) << "cycles/image" << std::setw (7) << "IPC"
+          << std::setw (9) << "LLC MPKI" << std::setw (10) << "stalled%"
+          << std::setw (9) << "bound" << std::endl;
+      std::ios::fmtflags flags = out.flags ();
+      out << std::fixed << std::setprecision (2);
+      for (const profile &p : profiles ())
+      {
+        double samples = static_cast<double> (std::max (p.samples, 1L));
+        double ipc = event (p, Event::INSTRUCTIONS)
+                     / std::max (event (p, Event::CYCLES), 1.0);
+        double mpki = 1000.0 * event (p, Event::LLC_MISSES)
+                      / std::max (event (p, Event::INSTRUCTIONS), 1.0);
+        double stalled = event (p, Event::BACKEND_STALLS)
+                         / std::max (event (p, Event::CYCLES), 1.0);
+        out << std::left << std::setw (20) << p.shape << std::right
+            << std::setw (9) << p.calls << std::setw (12)
+            << p.seconds * 1e6 / samples;
+        if (cycles)
+        {
+          out << std::setw (14) << event (p, Event::CYCLES) / samples;
+        }
+        else
+        {
+          out << std::setw (14) << "-";
+        }
+        if (cycles && instructions)
+        {
+          out << std::setw (7) << ipc;
+        }
+        else
+        {
+          out << std::setw (7) << "-";
+        }
+        if (instructions && misses)
+        {
+          out << std::setw (9) << mpki;
+        }
+        else
+        {
+          out << std::setw (9) << "-";
+        }
+        if (cycles && stalls)
+        {
+          const char *bound = stalled <= MEMORY_BOUND_STALLS ? "compute"
+                              : misses && mpki >= MEMORY_BOUND_MPKI
+                                ? "memory" : "backend";
+          out << std::setw (10) << stalled * 100.0 << std::setw (9) << bound;
+        }
+        else
+        {
+          out << std::setw (10) << "-" << std::setw (9) << "-";
+        }
+        out << std::endl;
+      }
+      out.flags (flags);
+    }
+
+    Scope::Scope (const Dense &layer, int samples)
+        : active (enabled ())
+    {
+      if (active)
+      {
+        const Matrix &weights = layer.get_weights ();
+        key = std::to_string (weights.get_rows ()) + "x"
+              + std::to_string (weights.get_cols ()) + " "
+              + layer.get_activation ().name
+              + storage_suffix (layer.get_storage ());
+        open (samples);
+      }
+    }
+
+    Scope::Scope (const char *name, int samples)
+        : active (enabled ())
+    {
+      if (active)
+      {
+        key = name;
+        open (samples);
+      }
+    }
+
+    void Scope::open (int scope_samples)
+    {
+      samples = scope_samples;
+      start = std::chrono::steady_clock::now ();
+      thread_counters ().read_values (begin);
+    }
+
+    Scope::~Scope ()
+    {
+      if (!active)
+      {
+        return;
+      }
+      uint64_t end[PERF_EVENT_COUNT];
+      thread_counters ().read_values (end);
+      std::chrono::duration<double> elapsed =
+          std::chrono::steady_clock::now () - start;
+
+      std::lock_guard<std::mutex> lock (totals_mutex);
+      totals &total = all_totals ()[key];
+      ++total.calls;
+      total.samples += samples;
+      total.seconds += elapsed.count ();
+      for (int e = 0; e < PERF_EVENT_COUNT; ++e)
+      {
+        total.events[e] += end[e] - begin[e];
+      }
+    }
+}
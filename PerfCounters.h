@@ -0,0 +1,129 @@
+// PerfCounters.h
+#ifndef PERFCOUNTERS_H
+#define PERFCOUNTERS_H
+
+#include "Dense.h"
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#define PERF_EVENT_COUNT 4
+
+/**
+ * Optional profiling of layer kernels with Linux hardware counters.
+ * While enabled, every Scope reads cycles, instructions, last-level cache
+ * misses and backend-stalled cycles of the calling thread (user space
+ * only) through perf_event_open, and the differences are summed per key:
+ * one key per layer shape, weight storage and activation, plus "network"
+ * for whole forward passes. Counters the host does not offer (e.g. in VMs
+ * or under a restrictive perf_event_paranoid) are reported as unavailable,
+ * and wall-clock time is still recorded. Disabled, a Scope costs one
+ * relaxed atomic load.
+ */
+namespace perf
+{
+    /**
+ * The counted events, in the order of profile::events.
+ */
+    enum class Event
+    {
+        CYCLES,
+        INSTRUCTIONS,
+        LLC_MISSES,
+        BACKEND_STALLS
+    };
+
+/**
+ * @struct profile
+ * @brief Totals of every scope with the same key.
+ * @var shape - the key, e.g. "128x784 relu"
+ * @var calls - number of scopes
+ * @var samples - images processed by those scopes
+ * @var seconds - wall-clock time
+ * @var events - counter totals, indexed by Event
+ */
+    typedef struct profile
+    {
+        std::string shape;
+        long calls;
+        long samples;
+        double seconds;
+        uint64_t events[PERF_EVENT_COUNT];
+    } profile;
+
+/**
+ * Turns profiling on or off for every thread.
+ */
+    void enable (bool on);
+
+/**
+ * @return true while profiling is on.
+ */
+    bool enabled ();
+
+/**
+ * @param event A counted event.
+ * @return true if some thread could open the event's counter.
+ */
+    bool available (Event event);
+
+/**
+ * @return The totals collected so far, ordered by key.
+ */
+    std::vector<profile> profiles ();
+
+/**
+ * Discards the totals collected so far.
+ */
+    void reset ();
+
+/**
+ * Prints one line per key: time and cycles per image, instructions per
+ * cycle, LLC misses per 1000 instructions, the backend-stalled share of
+ * cycles and a rough verdict. A key is "memory" bound when over half its
+ * cycles stall in the backend with at least one LLC miss per 1000
+ * instructions, "backend" bound when they stall without missing the LLC
+ * (cache latency or execution port pressure) and "compute" bound
+ * otherwise.
+ */
+    void print (std::ostream &out);
+
+/**
+ * Counts the events from construction to destruction, on the calling
+ * thread, into the totals of its key. Inactive unless profiling is on.
+ */
+    class Scope
+    {
+     private:
+      bool active;
+      std::string key;
+      int samples;
+      std::chrono::steady_clock::time_point start;
+      uint64_t begin[PERF_EVENT_COUNT];
+
+      void open (int samples);
+
+     public:
+      /**
+     * Profiles a layer's kernel, keyed by the layer's shape.
+     * @param layer The layer about to run.
+     * @param samples Number of images (columns) it runs on.
+     */
+      Scope (const Dense &layer, int samples);
+
+      /**
+     * @param name Key of the scope.
+     * @param samples Number of images processed inside the scope.
+     */
+      Scope (const char *name, int samples);
+
+      ~Scope ();
+
+      Scope (const Scope &) = delete;
+      Scope &operator= (const Scope &) = delete;
+    };
+}
+
+#endif //PERFCOUNTERS_H
\ No newline at end of file
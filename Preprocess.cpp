@@ -0,0 +1,316 @@
+// Preprocess.cpp
+#include "Preprocess.h"
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+#include <vector>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// Longer side of the digit's bounding box after scaling, as in MNIST
+#define FIT_BOX 20
+#define MAX_PIXEL 255.0F
+// Shears flatter than this are left alone
+#define MIN_SKEW 0.01F
+
+namespace
+{
+    // Averages factor x factor blocks (the last block of a row or column may
+    // be smaller), so bilinear sampling never skips strokes on large sources.
+    std::vector<float> box_shrink (const std::vector<float> &src, int width,
+                                   int height, int factor, int &out_width,
+                                   int &out_height)
+    {
+      out_width = (width + factor - 1) / factor;
+      out_height = (height + factor - 1) / factor;
+      std::vector<float> dst (size_t (out_width) * out_height, 0.0F);
+      std::vector<int> counts (dst.size (), 0);
+      for (int y = 0; y < height; ++y)
+      {
+        float *dst_row = dst.data () + (y / factor) * out_width;
+        int *count_row = counts.data () + (y / factor) * out_width;
+        const float *src_row = src.data () + size_t (y) * width;
+        for (int x = 0; x < width; ++x)
+        {
+          dst_row[x / factor] += src_row[x];
+          ++count_row[x / factor];
+        }
+      }
+      for (size_t i = 0; i < dst.size (); ++i)
+      {
+        dst[i] /= float (counts[i]);
+      }
+      return dst;
+    }
+
+    // Bilinear resize with pixel centers aligned (half-pixel convention).
+    // Each output row first blends its two source rows, a straight
+    // element-wise loop the compiler vectorizes, then interpolates along x.
+    std::vector<float> bilinear_resize (const std::vector<float> &src,
+                                        int width, int height, int out_width,
+                                        int out_height)
+    {
+      std::vector<float> dst (size_t (out_width) * out_height);
+      std::vector<int> x0 (out_width), x1 (out_width);
+      std::vector<float> fx (out_width);
+      float x_scale = float (width) / float (out_width);
+      float y_scale = float (height) / float (out_height);
+      for (int x = 0; x < out_width; ++x)
+      {
+        float sx = std::min (std::max ((float (x) + 0.5F) * x_scale - 0.5F,
+                                       0.0F), float (width - 1));
+        x0[x] = int (sx);
+        x1[x] = std::min (x0[x] + 1, width - 1);
+        fx[x] = sx - float (x0[x]);
+      }
+
+      std::vector<float> blended (width);
+      for (int y = 0; y < out_height; ++y)
+      {
+        float sy = std::min (std::max ((float (y) + 0.5F) * y_scale - 0.5F,
+                                       0.0F), float (height - 1));
+        int y0 = int (sy);
+        int y1 = std::min (y0 + 1, height - 1);
+        float fy = sy - float (y0);
+        const float *row0 = src.data () + size_t (y0) * width;
+        const float *row1 = src.data () + size_t (y1) * width;
+        for (int x = 0; x < width; ++x)
+        {
+          blended[x] = row0[x] + fy * (row1[x] - row0[x]);
+        }
+        float *dst_row = dst.data () + size_t (y) * out_width;
+        for (int x = 0; x < out_width; ++x)
+        {
+          dst_row[x] = blended[x0[x]]
+                       + fx[x] * (blended[x1[x]] - blended[x0[x]]);
+        }
+      }
+      return dst;
+    }
+
+    // Center of mass of an image; false when it has no ink at all.
+    bool center_of_mass (const float *pixels, int width, int height,
+                         float &cx, float &cy)
+    {
+      double mass = 0.0, sx = 0.0, sy = 0.0;
+      for (int y = 0; y < height; ++y)
+      {
+        for (int x = 0; x < width; ++x)
+        {
+          double w = pixels[y * width + x];
+          mass += w;
+          sx += w * x;
+          sy += w * y;
+        }
+      }
+      if (mass <= 0.0)
+      {
+        return false;
+      }
+      cx = float (sx / mass);
+      cy = float (sy / mass);
+      return true;
+    }
+
+    // Shears the canvas horizontally about its center of mass so that the
+    // covariance of x and y vanishes, i.e. the digit stands upright.
+    void deskew (std::vector<float> &canvas, int width, int height)
+    {
+      float cx, cy;
+      if (!center_of_mass (canvas.data (), width, height, cx, cy))
+      {
+        return;
+      }
+      double mu11 = 0.0, mu02 = 0.0;
+      for (int y = 0; y < height; ++y)
+      {
+        for (int x = 0; x < width; ++x)
+        {
+          double w = canvas[y * width + x];
+          mu11 += w * (x - cx) * (y - cy);
+          mu02 += w * (y - cy) * (y - cy);
+        }
+      }
+      float skew = mu02 > 0.0 ? float (mu11 / mu02) : 0.0F;
+      if (std::abs (skew) < MIN_SKEW)
+      {
+        return;
+      }
+
+      std::vector<float> sheared (canvas.size (), 0.0F);
+      for (int y = 0; y < height; ++y)
+      {
+        float shift = skew * (float (y) - cy);
+        const float *src_row = canvas.data () + y * width;
+        for (int x = 0; x < width; ++x)
+        {
+          float sx = float (x) + shift;
+          float floor_x = std::floor (sx);
+          int x0 = int (floor_x);
+          float f = sx - floor_x;
+          float left = (x0 >= 0 && x0 < width) ? src_row[x0] : 0.0F;
+          float right = (x0 + 1 >= 0 && x0 + 1 < width) ? src_row[x0 + 1]
+                                                        : 0.0F;
+          sheared[y * width + x] = left + f * (right - left);
+        }
+      }
+      canvas.swap (sheared);
+    }
+}
+
+namespace preprocess
+{
+    void to_unit_floats (const unsigned char *src, int count, float *dst,
+                         bool invert)
+    {
+      int i = 0;
+#if defined(__SSE2__)
+      const __m128i zero = _mm_setzero_si128 ();
+      const __m128i ones = _mm_set1_epi8 (-1);
+      const __m128 max = _mm_set1_ps (MAX_PIXEL);
+      for (; i + 16 <= count; i += 16)
+      {
+        __m128i bytes = _mm_loadu_si128 (
+            reinterpret_cast<const __m128i *> (src + i));
+        if (invert)
+        {
+          bytes = _mm_sub_epi8 (ones, bytes); // 255 - p, no borrow possible
+        }
+        __m128i lo = _mm_unpacklo_epi8 (bytes, zero);
+        __m128i hi = _mm_unpackhi_epi8 (bytes, zero);
+        // Division (not a reciprocal multiply) keeps results identical to
+        // the scalar tail and to float (p) / 255
+        _mm_storeu_ps (dst + i, _mm_div_ps (
+            _mm_cvtepi32_ps (_mm_unpacklo_epi16 (lo, zero)), max));
+        _mm_storeu_ps (dst + i + 4, _mm_div_ps (
+            _mm_cvtepi32_ps (_mm_unpackhi_epi16 (lo, zero)), max));
+        _mm_storeu_ps (dst + i + 8, _mm_div_ps (
+            _mm_cvtepi32_ps (_mm_unpacklo_epi16 (hi, zero)), max));
+        _mm_storeu_ps (dst + i + 12, _mm_div_ps (
+            _mm_cvtepi32_ps (_mm_unpackhi_epi16 (hi, zero)), max));
+      }
+#endif
+      for (; i < count; ++i)
+      {
+        int pixel = invert ? 255 - src[i] : src[i];
+        dst[i] = float (pixel) / MAX_PIXEL;
+      }
+    }
+
+    bool light_background (const unsigned char *pixels, int width,
+                           int height)
+    {
+      long sum = 0, count = 0;
+      for (int y = 0; y < height; ++y)
+      {
+        const unsigned char *row = pixels + size_t (y) * width;
+        if (y == 0 || y == height - 1)
+        {
+          sum += std::accumulate (row, row + width, 0L);
+          count += width;
+        }
+        else
+        {
+          sum += row[0] + (width > 1 ? row[width - 1] : 0);
+          count += width > 1 ? 2 : 1;
+        }
+      }
+      return count > 0 && sum > count * 127;
+    }
+
+    void to_network_input (const unsigned char *pixels, int width, int height,
+                           float *dst, int stride, const options &opts)
+    {
+      // In size_t, so hostile dimensions cannot overflow before the check
+      size_t pixel_count = size_t (width) * size_t (height);
+      if (width <= 0 || height <= 0
+          || pixel_count > size_t (MAX_INPUT_PIXELS))
+      {
+        throw std::exception ();
+      }
+      const int out_rows = img_dims.rows, out_cols = img_dims.cols;
+      std::vector<float> canvas (size_t (out_rows) * out_cols, 0.0F);
+
+      std::vector<float> image (pixel_count);
+      to_unit_floats (pixels, int (pixel_count), image.data (), opts.invert);
+
+      // Bounding box of the ink
+      int top = height, bottom = -1, left = width, right = -1;
+      for (int y = 0; y < height; ++y)
+      {
+        const float *row = image.data () + size_t (y) * width;
+        for (int x = 0; x < width; ++x)
+        {
+          if (row[x] > opts.threshold)
+          {
+            top = std::min (top, y);
+            bottom = y;
+            left = std::min (left, x);
+            right = std::max (right, x);
+          }
+        }
+      }
+
+      if (bottom >= 0)
+      {
+        int box_width = right - left + 1, box_height = bottom - top + 1;
+        std::vector<float> box (size_t (box_width) * box_height);
+        for (int y = 0; y < box_height; ++y)
+        {
+          std::copy_n (image.data () + size_t (top + y) * width + left,
+                       box_width, box.data () + size_t (y) * box_width);
+        }
+
+        // Keep the aspect ratio; the longer side becomes FIT_BOX pixels
+        int longer = std::max (box_width, box_height);
+        int fit_width = std::max (1, int (std::lround (
+            float (box_width) * FIT_BOX / float (longer))));
+        int fit_height = std::max (1, int (std::lround (
+            float (box_height) * FIT_BOX / float (longer))));
+        int factor = longer / FIT_BOX;
+        if (factor > 1)
+        {
+          box = box_shrink (box, box_width, box_height, factor, box_width,
+                            box_height);
+        }
+        std::vector<float> fitted = bilinear_resize (box, box_width,
+                                                     box_height, fit_width,
+                                                     fit_height);
+
+        // Shift the center of mass to the middle of the canvas, as far as
+        // the canvas allows without clipping the digit
+        float cx = float (fit_width - 1) / 2.0F;
+        float cy = float (fit_height - 1) / 2.0F;
+        center_of_mass (fitted.data (), fit_width, fit_height, cx, cy);
+        int offset_x = int (std::lround (float (out_cols - 1) / 2.0F - cx));
+        int offset_y = int (std::lround (float (out_rows - 1) / 2.0F - cy));
+        offset_x = std::min (std::max (offset_x, 0), out_cols - fit_width);
+        offset_y = std::min (std::max (offset_y, 0), out_rows - fit_height);
+        for (int y = 0; y < fit_height; ++y)
+        {
+          std::copy_n (fitted.data () + size_t (y) * fit_width, fit_width,
+                       canvas.data () + (y + offset_y) * out_cols + offset_x);
+        }
+
+        if (opts.deskew)
+        {
+          deskew (canvas, out_cols, out_rows);
+        }
+      }
+
+      for (size_t i = 0; i < canvas.size (); ++i)
+      {
+        dst[i * stride] = canvas[i];
+      }
+    }
+
+    Matrix to_network_input (const unsigned char *pixels, int width,
+                             int height, const options &opts)
+    {
+      Matrix result (img_dims.rows, img_dims.cols);
+      to_network_input (pixels, width, height, result.data (), 1, opts);
+      return result;
+    }
+}
@@ -0,0 +1,82 @@
+// Preprocess.h
+#ifndef PREPROCESS_H
+#define PREPROCESS_H
+
+#include "MlpNetwork.h"
+
+// Largest accepted source image, in pixels (8192 x 8192)
+#define MAX_INPUT_PIXELS (1 << 26)
+
+/**
+ * Turns 8-bit grayscale images of any size into network input, the way the
+ * MNIST set itself was prepared: the digit's bounding box is scaled so its
+ * longer side fits a 20x20 box, then placed on the img_dims canvas with its
+ * center of mass in the middle.
+ */
+namespace preprocess
+{
+    /**
+   * Preprocessing switches.
+   * @var invert - source is dark ink on a light background (paper scans);
+   *               MNIST digits are light on dark
+   * @var deskew - shear the digit upright using its second-order moments
+   * @var threshold - pixels at or below this value (after conversion to
+   *                  [0, 1]) are background when finding the bounding box
+   */
+    struct options
+    {
+        bool invert = false;
+        bool deskew = false;
+        float threshold = 0.1F;
+    };
+
+/**
+ * Converts 8-bit pixels to floats in [0, 1] (SSE2 when available).
+ * @param src The source pixels.
+ * @param count Number of pixels.
+ * @param dst Receives count floats.
+ * @param invert Map 0 to 1 and 255 to 0 instead.
+ */
+    void to_unit_floats (const unsigned char *src, int count, float *dst,
+                         bool invert = false);
+
+/**
+ * Guesses whether an image is dark ink on a light background, from the
+ * average brightness of its border pixels.
+ * @param pixels Row-major grayscale pixels.
+ * @param width Image width.
+ * @param height Image height.
+ * @return true if the options for this image should set invert.
+ */
+    bool light_background (const unsigned char *pixels, int width,
+                           int height);
+
+/**
+ * Runs the full pipeline on one image, writing img_dims.rows * img_dims.cols
+ * floats in row-major order. Elements are stride floats apart, so an
+ * image can be written straight into a column of a batch matrix
+ * (dst = batch.data () + column, stride = batch.get_cols ()).
+ * A blank image yields all zeros.
+ * @param pixels Row-major grayscale pixels.
+ * @param width Image width.
+ * @param height Image height.
+ * @param dst Destination of the first element.
+ * @param stride Distance between consecutive destination elements.
+ * @param opts Preprocessing switches.
+ * @throws std::exception if width or height is not positive, or their
+ *         product exceeds MAX_INPUT_PIXELS.
+ */
+    void to_network_input (const unsigned char *pixels, int width, int height,
+                           float *dst, int stride = 1,
+                           const options &opts = options ());
+
+/**
+ * Convenience overload producing an img_dims-shaped matrix.
+ * @throws std::exception if width or height is not positive, or their
+ *         product exceeds MAX_INPUT_PIXELS.
+ */
+    Matrix to_network_input (const unsigned char *pixels, int width,
+                             int height, const options &opts = options ());
+}
+
+#endif //PREPROCESS_H
\ No newline at end of file
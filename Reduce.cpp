@@ -0,0 +1,198 @@
+// Reduce.cpp
+#include "Reduce.h"
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// Elements per leaf of the reproducible tree
+#define REDUCE_BLOCK 1024
+// Lanes per leaf; fixed, whatever the SIMD width
+#define REDUCE_LANES 8
+// Below this many elements threads cost more than they save
+#define PARALLEL_MIN (1 << 18)
+
+namespace
+{
+    std::atomic<reduce::Mode> default_mode (reduce::Mode::REPRODUCIBLE);
+
+    struct identity
+    {
+        static float apply (float x)
+        { return x; }
+
+#if defined(__SSE2__)
+        static __m128 apply (__m128 x)
+        { return x; }
+#endif
+    };
+
+    struct square
+    {
+        static float apply (float x)
+        { return x * x; }
+
+#if defined(__SSE2__)
+        static __m128 apply (__m128 x)
+        { return _mm_mul_ps (x, x); }
+#endif
+    };
+
+    // One leaf: lane k adds elements k, k + 8, k + 16, ... in order, then
+    // the lanes are combined pairwise. The SSE body and the scalar tail
+    // feed the same lanes in the same order.
+    template <typename F>
+    float block_sum (const float *x, size_t n)
+    {
+      float lanes[REDUCE_LANES] = {};
+      size_t i = 0;
+#if defined(__SSE2__)
+      __m128 lo = _mm_setzero_ps ();
+      __m128 hi = _mm_setzero_ps ();
+      for (; i + REDUCE_LANES <= n; i += REDUCE_LANES)
+      {
+        lo = _mm_add_ps (lo, F::apply (_mm_loadu_ps (x + i)));
+        hi = _mm_add_ps (hi, F::apply (_mm_loadu_ps (x + i + 4)));
+      }
+      _mm_storeu_ps (lanes, lo);
+      _mm_storeu_ps (lanes + 4, hi);
+#endif
+      for (; i < n; ++i)
+      {
+        lanes[i % REDUCE_LANES] += F::apply (x[i]);
+      }
+      return ((lanes[0] + lanes[1]) + (lanes[2] + lanes[3]))
+             + ((lanes[4] + lanes[5]) + (lanes[6] + lanes[7]));
+    }
+
+    // Pairwise tree over blocks [first, first + count); the split point
+    // depends on count only.
+    template <typename F>
+    float tree_sum (const float *x, size_t n, size_t first, size_t count,
+                    int threads)
+    {
+      if (count == 1)
+      {
+        size_t begin = first * REDUCE_BLOCK;
+        size_t length = std::min (n - begin, size_t (REDUCE_BLOCK));
+        return block_sum<F> (x + begin, length);
+      }
+      size_t half = count / 2;
+      if (threads > 1)
+      {
+        float left = 0.0F;
+        std::thread helper ([&] ()
+                            {
+                              left = tree_sum<F> (x, n, first, half,
+                                                  threads / 2);
+                            });
+        float right = tree_sum<F> (x, n, first + half, count - half,
+                                   threads - threads / 2);
+        helper.join ();
+        return left + right;
+      }
+      return tree_sum<F> (x, n, first, half, 1)
+             + tree_sum<F> (x, n, first + half, count - half, 1);
+    }
+
+    // Straight accumulation in four SSE registers.
+    template <typename F>
+    float fast_sum (const float *x, size_t n)
+    {
+      size_t i = 0;
+      float sum = 0.0F;
+#if defined(__SSE2__)
+      __m128 acc[4] = {_mm_setzero_ps (), _mm_setzero_ps (),
+                       _mm_setzero_ps (), _mm_setzero_ps ()};
+      for (; i + 16 <= n; i += 16)
+      {
+        for (int k = 0; k < 4; ++k)
+        {
+          __m128 v = F::apply (_mm_loadu_ps (x + i + 4 * k));
+          acc[k] = _mm_add_ps (acc[k], v);
+        }
+      }
+      float lanes[4];
+      _mm_storeu_ps (lanes, _mm_add_ps (_mm_add_ps (acc[0], acc[1]),
+                                        _mm_add_ps (acc[2], acc[3])));
+      sum = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+#endif
+      for (; i < n; ++i)
+      {
+        sum += F::apply (x[i]);
+      }
+      return sum;
+    }
+
+    template <typename F>
+    float reduce_with (const float *x, size_t n, reduce::Mode mode,
+                       int threads)
+    {
+      if (n == 0)
+      {
+        return 0.0F;
+      }
+      if (n < PARALLEL_MIN)
+      {
+        threads = 1;
+      }
+      if (mode == reduce::Mode::REPRODUCIBLE)
+      {
+        size_t blocks = (n + REDUCE_BLOCK - 1) / REDUCE_BLOCK;
+        return tree_sum<F> (x, n, 0, blocks, threads);
+      }
+      if (threads <= 1)
+      {
+        return fast_sum<F> (x, n);
+      }
+
+      // Even contiguous chunks, partial sums added in chunk order
+      std::vector<float> partials (threads);
+      std::vector<std::thread> workers;
+      size_t chunk = (n + threads - 1) / threads;
+      for (int t = 0; t < threads; ++t)
+      {
+        size_t begin = std::min (n, t * chunk);
+        size_t end = std::min (n, begin + chunk);
+        workers.emplace_back ([&partials, x, t, begin, end] ()
+                              {
+                                partials[t] = fast_sum<F> (x + begin,
+                                                           end - begin);
+                              });
+      }
+      float sum = 0.0F;
+      for (int t = 0; t < threads; ++t)
+      {
+        workers[t].join ();
+        sum += partials[t];
+      }
+      return sum;
+    }
+}
+
+namespace reduce
+{
+    void set_mode (Mode mode)
+    {
+      default_mode.store (mode);
+    }
+
+    Mode get_mode ()
+    {
+      return default_mode.load ();
+    }
+
+    float sum (const float *x, size_t n, Mode mode, int threads)
+    {
+      return reduce_with<identity> (x, n, mode, threads);
+    }
+
+    float sum_squares (const float *x, size_t n, Mode mode, int threads)
+    {
+      return reduce_with<square> (x, n, mode, threads);
+    }
+}
@@ -0,0 +1,62 @@
+// Reduce.h
+#ifndef REDUCE_H
+#define REDUCE_H
+
+#include <cstddef>
+
+/**
+ * Summation kernels shared by Matrix::sum, Matrix::norm and the softmax
+ * denominators.
+ * FAST accumulates in as many SIMD lanes and threads as are available, so
+ * the rounding (and thus the result's last bits) depends on the build and
+ * on the thread count.
+ * REPRODUCIBLE always adds in the same order: each block of
+ * REDUCE_BLOCK elements is summed in 8 interleaved lanes that are combined
+ * pairwise, and blocks are combined by a fixed pairwise tree. Threads only
+ * compute subtrees of that tree, so results are bit-identical for any
+ * thread count and SIMD width, and the error grows with log(n) instead of n.
+ */
+namespace reduce
+{
+    enum class Mode
+    {
+        FAST,
+        REPRODUCIBLE
+    };
+
+/**
+ * Selects the mode used when a call does not name one. Applies to the
+ * whole process; meant to be set once at startup.
+ * @param mode The new default mode.
+ */
+    void set_mode (Mode mode);
+
+/**
+ * @return The default mode, REPRODUCIBLE unless set_mode changed it.
+ */
+    Mode get_mode ();
+
+/**
+ * Sums a contiguous vector.
+ * @param x The elements.
+ * @param n Number of elements.
+ * @param mode The summation mode.
+ * @param threads Most threads to use; large vectors only.
+ * @return The sum, 0 for an empty vector.
+ */
+    float sum (const float *x, size_t n, Mode mode = get_mode (),
+               int threads = 1);
+
+/**
+ * Sums the squares of a contiguous vector's elements.
+ * @param x The elements.
+ * @param n Number of elements.
+ * @param mode The summation mode.
+ * @param threads Most threads to use; large vectors only.
+ * @return The sum of squares, 0 for an empty vector.
+ */
+    float sum_squares (const float *x, size_t n, Mode mode = get_mode (),
+                       int threads = 1);
+}
+
+#endif //REDUCE_H
\ No newline at end of file
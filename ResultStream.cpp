@@ -0,0 +1,229 @@
+// ResultStream.cpp
+#include "ResultStream.h"
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <new>
+#include <thread>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+result_record make_record (uint64_t image_id, const prediction &result)
+{
+  result_record record;
+  record.image_id = image_id;
+  record.value = result.top[0].value;
+  record.probability = result.top[0].probability;
+  std::memcpy (record.probabilities, result.probabilities,
+               sizeof (record.probabilities));
+  return record;
+}
+
+ResultWriter::ResultWriter (std::ostream &out, bool full)
+    : out (out), record_size (full ? RESULT_FULL_SIZE : RESULT_COMPACT_SIZE)
+{
+  result_stream_header streamHeader = {RESULT_MAGIC, record_size};
+  out.write (reinterpret_cast<const char *> (&streamHeader),
+             sizeof (streamHeader));
+}
+
+bool ResultWriter::write (const result_record &record)
+{
+  out.write (reinterpret_cast<const char *> (&record), record_size);
+  return static_cast<bool> (out);
+}
+
+static uint64_t roundUpToPowerOfTwo (size_t value)
+{
+  uint64_t result = 1;
+  while (result < value)
+  {
+    result <<= 1;
+  }
+  return result;
+}
+
+// Whether the named segment is a complete ring whose producer has exited.
+// Anything else (a live producer, one still initializing, a foreign
+// object) is left alone.
+static bool isStaleRing (const std::string &name)
+{
+  int fd = shm_open (name.c_str (), O_RDONLY, 0);
+  if (fd < 0)
+  {
+    return false;
+  }
+  struct stat info;
+  void *memory = MAP_FAILED;
+  if (fstat (fd, &info) == 0
+      && size_t (info.st_size) >= sizeof (ResultRing::header))
+  {
+    memory = mmap (nullptr, sizeof (ResultRing::header), PROT_READ,
+                   MAP_SHARED, fd, 0);
+  }
+  close (fd);
+  if (memory == MAP_FAILED)
+  {
+    return false;
+  }
+  const ResultRing::header *ring =
+      static_cast<const ResultRing::header *> (memory);
+  bool stale = ring->magic.load (std::memory_order_acquire) == RESULT_MAGIC
+               && ring->producer_pid > 0 && kill (ring->producer_pid, 0) != 0
+               && errno == ESRCH;
+  munmap (memory, sizeof (ResultRing::header));
+  return stale;
+}
+
+ResultRing::ResultRing (const std::string &name, size_t capacity, bool full)
+    : name (name), producer (true), mapped_size (0), ring (nullptr),
+      slots (nullptr), slot_size (0), slot_count (0), cached_head (0),
+      cached_tail (0)
+{
+  if (capacity == 0 || !std::atomic<uint64_t> ().is_lock_free ())
+  {
+    throw std::exception ();
+  }
+  uint64_t slotCount = roundUpToPowerOfTwo (capacity);
+  uint32_t recordSize = full ? RESULT_FULL_SIZE : RESULT_COMPACT_SIZE;
+  mapped_size = sizeof (header) + slotCount * recordSize;
+
+  int fd = shm_open (name.c_str (), O_CREAT | O_EXCL | O_RDWR, 0600);
+  if (fd < 0 && errno == EEXIST && isStaleRing (name))
+  {
+    shm_unlink (name.c_str ()); // Left behind by a crashed producer
+    fd = shm_open (name.c_str (), O_CREAT | O_EXCL | O_RDWR, 0600);
+  }
+  if (fd < 0)
+  {
+    throw std::exception ();
+  }
+  void *memory = MAP_FAILED;
+  if (ftruncate (fd, off_t (mapped_size)) == 0)
+  {
+    memory = mmap (nullptr, mapped_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                   fd, 0);
+  }
+  close (fd);
+  if (memory == MAP_FAILED)
+  {
+    shm_unlink (name.c_str ());
+    throw std::exception ();
+  }
+
+  ring = new (memory) header;
+  ring->magic.store (0);
+  ring->record_size = recordSize;
+  ring->capacity = slotCount;
+  ring->producer_pid = int32_t (getpid ());
+  ring->head.store (0);
+  ring->tail.store (0);
+  slots = static_cast<unsigned char *> (memory) + sizeof (header);
+  slot_size = recordSize;
+  slot_count = slotCount;
+  // Written last: a consumer attaching early rejects the segment until then
+  ring->magic.store (RESULT_MAGIC, std::memory_order_release);
+}
+
+ResultRing::ResultRing (const std::string &name)
+    : name (name), producer (false), mapped_size (0), ring (nullptr),
+      slots (nullptr), slot_size (0), slot_count (0), cached_head (0),
+      cached_tail (0)
+{
+  int fd = shm_open (name.c_str (), O_RDWR, 0);
+  if (fd < 0)
+  {
+    throw std::exception ();
+  }
+  struct stat info;
+  void *memory = MAP_FAILED;
+  if (fstat (fd, &info) == 0 && size_t (info.st_size) >= sizeof (header))
+  {
+    mapped_size = size_t (info.st_size);
+    memory = mmap (nullptr, mapped_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                   fd, 0);
+  }
+  close (fd);
+  if (memory == MAP_FAILED)
+  {
+    throw std::exception ();
+  }
+  ring = static_cast<header *> (memory);
+  slots = static_cast<unsigned char *> (memory) + sizeof (header);
+  // Read the geometry once and trust only the copies from here on
+  bool ready = ring->magic.load (std::memory_order_acquire) == RESULT_MAGIC;
+  slot_size = ring->record_size;
+  slot_count = ring->capacity;
+  if (!ready
+      || (slot_size != RESULT_COMPACT_SIZE && slot_size != RESULT_FULL_SIZE)
+      || slot_count == 0 || (slot_count & (slot_count - 1)) != 0
+      || slot_count > (mapped_size - sizeof (header)) / slot_size
+      || mapped_size != sizeof (header) + slot_count * slot_size)
+  {
+    munmap (memory, mapped_size);
+    throw std::exception ();
+  }
+  cached_head = ring->tail.load (std::memory_order_relaxed);
+}
+
+ResultRing::~ResultRing ()
+{
+  munmap (ring, mapped_size);
+  if (producer)
+  {
+    shm_unlink (name.c_str ());
+  }
+}
+
+uint32_t ResultRing::record_size () const
+{
+  return slot_size;
+}
+
+bool ResultRing::try_push (const result_record &record)
+{
+  // Only the producer writes head, so a relaxed load sees its own value
+  uint64_t head = ring->head.load (std::memory_order_relaxed);
+  if (head - cached_tail == slot_count)
+  {
+    // Looks full: refresh the consumer's position, a shared cache line
+    cached_tail = ring->tail.load (std::memory_order_acquire);
+    if (head - cached_tail == slot_count)
+    {
+      return false;
+    }
+  }
+  std::memcpy (slots + (head & (slot_count - 1)) * slot_size, &record,
+               slot_size);
+  ring->head.store (head + 1, std::memory_order_release);
+  return true;
+}
+
+void ResultRing::push (const result_record &record)
+{
+  while (!try_push (record))
+  {
+    std::this_thread::yield ();
+  }
+}
+
+bool ResultRing::try_pop (result_record &record)
+{
+  uint64_t tail = ring->tail.load (std::memory_order_relaxed);
+  if (tail == cached_head)
+  {
+    cached_head = ring->head.load (std::memory_order_acquire);
+    if (tail == cached_head)
+    {
+      return false;
+    }
+  }
+  std::memset (&record, 0, sizeof (record));
+  std::memcpy (&record, slots + (tail & (slot_count - 1)) * slot_size,
+               slot_size);
+  ring->tail.store (tail + 1, std::memory_order_release);
+  return true;
+}
@@ -0,0 +1,171 @@
+// ResultStream.h
+#ifndef RESULTSTREAM_H
+#define RESULTSTREAM_H
+
+#include "MlpNetwork.h"
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <string>
+
+#define RESULT_MAGIC 0x52504C4DU // "MLPR" on little-endian hosts
+// Bytes of a record without, and with, the full distribution
+#define RESULT_COMPACT_SIZE 16
+#define RESULT_FULL_SIZE (RESULT_COMPACT_SIZE + DIGITS_COUNT * 4)
+
+/**
+ * @struct result_record
+ * @brief Binary form of one result, in host byte order. Compact streams
+ *        hold only the first RESULT_COMPACT_SIZE bytes of each record.
+ * @var image_id - caller-assigned id of the image, e.g. its input position
+ * @var value - predicted digit
+ * @var probability - probability of the predicted digit
+ * @var probabilities - probability of every digit (full records only)
+ */
+typedef struct result_record
+{
+    uint64_t image_id;
+    uint32_t value;
+    float probability;
+    float probabilities[DIGITS_COUNT];
+} result_record;
+
+static_assert (sizeof (result_record) == RESULT_FULL_SIZE,
+               "result_record must not be padded");
+
+/**
+ * Header opening a binary result stream.
+ * @var magic - RESULT_MAGIC
+ * @var record_size - RESULT_COMPACT_SIZE or RESULT_FULL_SIZE
+ */
+typedef struct result_stream_header
+{
+    uint32_t magic;
+    uint32_t record_size;
+} result_stream_header;
+
+/**
+ * Builds the record of a prediction.
+ * @param image_id The image's id.
+ * @param result The prediction; top[0] gives the digit.
+ * @return The record, with the full distribution filled in.
+ */
+result_record make_record (uint64_t image_id, const prediction &result);
+
+/**
+ * Writes a header followed by fixed-size records to a binary stream.
+ */
+class ResultWriter
+{
+ private:
+  std::ostream &out;
+  uint32_t record_size;
+
+ public:
+  /**
+ * Writes the stream header.
+ * @param out The stream to write to, opened in binary mode.
+ * @param full Whether records carry the full distribution.
+ */
+  ResultWriter (std::ostream &out, bool full);
+
+/**
+ * Appends one record.
+ * @param record The record to write.
+ * @return false if the stream failed.
+ */
+  bool write (const result_record &record);
+};
+
+/**
+ * Single-producer/single-consumer ring of result records in POSIX shared
+ * memory. The segment starts with a header holding the record size,
+ * the capacity and the producer (head) and consumer (tail) positions, each
+ * on its own cache line; records follow. Positions only grow, and a slot's
+ * record is published by a release store of head and released by a release
+ * store of tail, so neither side makes a system call once mapped.
+ * The producer creates and (on destruction) unlinks the segment, and
+ * records its pid there so a later producer can tell a crashed owner's
+ * segment from a live one.
+ */
+class ResultRing
+{
+ public:
+  struct header
+  {
+      std::atomic<uint32_t> magic; // Set once the rest is initialized
+      uint32_t record_size;
+      uint64_t capacity;
+      int32_t producer_pid;
+      alignas (64) std::atomic<uint64_t> head;
+      alignas (64) std::atomic<uint64_t> tail;
+  };
+
+ private:
+  std::string name;
+  bool producer;
+  size_t mapped_size;
+  header *ring;
+  unsigned char *slots;
+  uint32_t slot_size; // Validated copies of the header's geometry
+  uint64_t slot_count;
+  uint64_t cached_head; // Last head seen by the consumer
+  uint64_t cached_tail; // Last tail seen by the producer
+
+ public:
+  /**
+ * Creates the segment as its producer. A segment of the same name is only
+ * replaced when it is a ring whose producer process no longer exists.
+ * @param name Shared memory name, starting with '/'.
+ * @param capacity Number of records; rounded up to a power of two.
+ * @param full Whether records carry the full distribution.
+ * @throws std::exception if the segment cannot be created or mapped, or
+ *         the name is in use by a live producer or another object.
+ */
+  ResultRing (const std::string &name, size_t capacity, bool full);
+
+/**
+ * Attaches to an existing segment as its consumer. The record size and
+ * capacity are checked once here and cached.
+ * @param name Shared memory name the producer created.
+ * @throws std::exception if the segment is missing or not a result ring:
+ *         wrong magic, a record size other than RESULT_COMPACT_SIZE or
+ *         RESULT_FULL_SIZE, a capacity that is not a power of two, or a
+ *         size that does not match them.
+ */
+  explicit ResultRing (const std::string &name);
+
+/**
+ * Unmaps the segment; the producer also unlinks it.
+ */
+  ~ResultRing ();
+
+  ResultRing (const ResultRing &) = delete;
+  ResultRing &operator= (const ResultRing &) = delete;
+
+/**
+ * @return Bytes per record, RESULT_COMPACT_SIZE or RESULT_FULL_SIZE.
+ */
+  uint32_t record_size () const;
+
+/**
+ * Producer: appends a record unless the ring is full.
+ * @return false if the ring is full.
+ */
+  bool try_push (const result_record &record);
+
+/**
+ * Producer: appends a record, yielding while the ring is full.
+ */
+  void push (const result_record &record);
+
+/**
+ * Consumer: takes the oldest record unless the ring is empty. Fields a
+ * compact ring does not carry are zeroed.
+ * @return false if the ring is empty.
+ */
+  bool try_pop (result_record &record);
+};
+
+#endif //RESULTSTREAM_H
\ No newline at end of file
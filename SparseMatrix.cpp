@@ -0,0 +1,160 @@
+// SparseMatrix.cpp
+#include "SparseMatrix.h"
+
+SparseMatrix::SparseMatrix () : dimensions {1, 1}, row_start (2, 0)
+{}
+
+SparseMatrix::SparseMatrix (const Matrix &m, float threshold)
+    : dimensions {m.get_rows (), m.get_cols ()}
+{
+  const float *in = m.data ();
+  row_start.reserve (dimensions.rows + 1);
+  row_start.push_back (0);
+  for (int i = 0; i < dimensions.rows; ++i)
+  {
+    for (int j = 0; j < dimensions.cols; ++j)
+    {
+      float value = in[i * dimensions.cols + j];
+      if (std::abs (value) > threshold)
+      {
+        col_index.push_back (j);
+        values.push_back (value);
+      }
+    }
+    row_start.push_back (static_cast<int> (values.size ()));
+  }
+}
+
+int SparseMatrix::get_rows () const
+{
+  return dimensions.rows;
+}
+
+int SparseMatrix::get_cols () const
+{
+  return dimensions.cols;
+}
+
+int SparseMatrix::non_zeros () const
+{
+  return static_cast<int> (values.size ());
+}
+
+SparseMatrix SparseMatrix::transposed () const
+{
+  SparseMatrix result;
+  result.dimensions = {dimensions.cols, dimensions.rows};
+  result.row_start.assign (dimensions.cols + 1, 0);
+  result.col_index.resize (values.size ());
+  result.values.resize (values.size ());
+
+  // Count the elements of every column, then prefix-sum into offsets
+  for (int col : col_index)
+  {
+    ++result.row_start[col + 1];
+  }
+  for (int j = 0; j < dimensions.cols; ++j)
+  {
+    result.row_start[j + 1] += result.row_start[j];
+  }
+
+  // Scatter, walking rows in order so each new row stays sorted
+  std::vector<int> next (result.row_start.begin (),
+                         result.row_start.end () - 1);
+  for (int i = 0; i < dimensions.rows; ++i)
+  {
+    for (int k = row_start[i]; k < row_start[i + 1]; ++k)
+    {
+      int position = next[col_index[k]]++;
+      result.col_index[position] = i;
+      result.values[position] = values[k];
+    }
+  }
+  return result;
+}
+
+Matrix SparseMatrix::to_dense () const
+{
+  Matrix result (dimensions.rows, dimensions.cols);
+  float *out = result.data ();
+  for (int i = 0; i < dimensions.rows; ++i)
+  {
+    for (int k = row_start[i]; k < row_start[i + 1]; ++k)
+    {
+      out[i * dimensions.cols + col_index[k]] = values[k];
+    }
+  }
+  return result;
+}
+
+Matrix SparseMatrix::operator* (const Matrix &rhs) const
+{
+  if (dimensions.cols != rhs.get_rows ())
+  {
+    throw std::exception ();
+  }
+  int batch = rhs.get_cols ();
+  Matrix result (dimensions.rows, batch);
+  const float *in = rhs.data ();
+  float *out = result.data ();
+
+  if (batch == 1)
+  {
+    // GEMV: one gathered dot product per row
+    for (int i = 0; i < dimensions.rows; ++i)
+    {
+      float sum = 0.0F;
+      for (int k = row_start[i]; k < row_start[i + 1]; ++k)
+      {
+        sum += values[k] * in[col_index[k]];
+      }
+      out[i] = sum;
+    }
+    return result;
+  }
+
+  // GEMM: every stored element scales a whole contiguous row of rhs
+  for (int i = 0; i < dimensions.rows; ++i)
+  {
+    float *dst = out + i * batch;
+    for (int k = row_start[i]; k < row_start[i + 1]; ++k)
+    {
+      const float *src = in + col_index[k] * batch;
+      float w = values[k];
+      for (int j = 0; j < batch; ++j)
+      {
+        dst[j] += w * src[j];
+      }
+    }
+  }
+  return result;
+}
+
+Matrix SparseMatrix::transposed_multiply (const Matrix &rhs) const
+{
+  if (dimensions.rows != rhs.get_rows ())
+  {
+    throw std::exception ();
+  }
+  int batch = rhs.get_cols ();
+  Matrix result (dimensions.cols, batch);
+  const float *in = rhs.data ();
+  float *out = result.data ();
+
+  for (int i = 0; i < dimensions.rows; ++i)
+  {
+    for (int s = 0; s < batch; ++s)
+    {
+      float x = in[i * batch + s];
+      if (x == 0.0F)
+      {
+        continue; // Blank input: the whole stored row contributes nothing
+      }
+      for (int k = row_start[i]; k < row_start[i + 1]; ++k)
+      {
+        out[col_index[k] * batch + s] += values[k] * x;
+      }
+    }
+  }
+  return result;
+}
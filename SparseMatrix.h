@@ -0,0 +1,87 @@
+// SparseMatrix.h
+#ifndef SPARSEMATRIX_H
+#define SPARSEMATRIX_H
+
+#include "Matrix.h"
+#include <vector>
+
+/**
+ * Immutable matrix in compressed sparse row (CSR) form.
+ * Only the non-zero elements are stored: for row i, the column indices and
+ * values live in col_index / values at positions
+ * [row_start[i], row_start[i + 1]).
+ */
+class SparseMatrix
+{
+ private:
+  matrix_dims dimensions;
+  std::vector<int> row_start;
+  std::vector<int> col_index;
+  std::vector<float> values;
+
+ public:
+  /**
+ * Constructs an empty 1x1 sparse matrix.
+ */
+  SparseMatrix ();
+
+/**
+ * Compresses a dense matrix, dropping every element whose magnitude is
+ * not above the threshold.
+ * @param m The dense matrix to compress.
+ * @param threshold Elements with |value| <= threshold are dropped.
+ */
+  explicit SparseMatrix (const Matrix &m, float threshold = 0.0F);
+
+/**
+ * Returns the number of rows in the matrix.
+ * @return The number of rows.
+ */
+  int get_rows () const;
+
+/**
+ * Returns the number of columns in the matrix.
+ * @return The number of columns.
+ */
+  int get_cols () const;
+
+/**
+ * Returns the number of stored (non-zero) elements.
+ * @return The number of non-zeros.
+ */
+  int non_zeros () const;
+
+/**
+ * Returns the stored elements as a transposed sparse matrix, i.e. this
+ * matrix in compressed sparse column (CSC) form.
+ * @return The transpose, in CSR form.
+ */
+  SparseMatrix transposed () const;
+
+/**
+ * Expands the matrix back into dense form.
+ * @return A dense copy of the matrix.
+ */
+  Matrix to_dense () const;
+
+/**
+ * Sparse-dense product (GEMV when rhs has one column, GEMM otherwise).
+ * @param rhs The dense right-hand side matrix.
+ * @return A new dense matrix that is the product of this matrix and rhs.
+ * @throws std::exception if the inner dimensions differ.
+ */
+  Matrix operator* (const Matrix &rhs) const;
+
+/**
+ * Computes this^T * rhs, skipping zero elements of rhs. Called on the
+ * transposed() form of a weight matrix it multiplies by the original
+ * weights while touching only the columns that meet a non-zero input,
+ * which suits mostly-blank input images.
+ * @param rhs The dense right-hand side matrix.
+ * @return A new dense matrix that is the product of this^T and rhs.
+ * @throws std::exception if the inner dimensions differ.
+ */
+  Matrix transposed_multiply (const Matrix &rhs) const;
+};
+
+#endif //SPARSEMATRIX_H
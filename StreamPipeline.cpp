@@ -0,0 +1,231 @@
+// StreamPipeline.cpp
+#include "StreamPipeline.h"
+#include "MlpIO.h"
+#include <atomic>
+#include <exception>
+#include <thread>
+
+#define IMG_SIZE (img_dims.rows * img_dims.cols)
+
+namespace
+{
+    struct stream_item
+    {
+        uint64_t id;
+        Matrix image; // Column vector
+    };
+}
+
+StreamPipeline::StreamPipeline (const ModelSlot &slot, int workers,
+                                int max_batch, int window)
+    : slot (&slot), worker_count (workers), max_batch (max_batch),
+      window (window)
+{
+  if (workers <= 0 || max_batch <= 0 || window < max_batch)
+  {
+    throw std::exception ();
+  }
+}
+
+uint64_t StreamPipeline::run (std::istream &in, Format format,
+                              const Emit &emit) const noexcept (false)
+{
+  BoundedQueue<stream_item> images (max_batch * worker_count);
+  BoundedQueue<result_record> results (window);
+
+  // Admission window: the reader waits while window images are unemitted
+  std::mutex window_mutex;
+  std::condition_variable window_open;
+  uint64_t emitted = 0;
+  bool stopping = false;
+  std::string error;
+  std::exception_ptr failure; // First exception of any stage
+
+  // Records an exception and winds every stage down, so that run can join
+  // its threads before rethrowing it
+  auto abort_run = [&] (std::exception_ptr exception)
+  {
+    {
+      std::lock_guard<std::mutex> lock (window_mutex);
+      if (!failure)
+      {
+        failure = exception;
+      }
+      stopping = true;
+      window_open.notify_all ();
+    }
+    images.close ();
+    results.close ();
+  };
+
+  std::thread reader ([&]
+  {
+    try
+    {
+      std::string path;
+      uint64_t id = 0;
+      while (true)
+      {
+        // Each image is read into its own matrix, which moves into the queue
+        Matrix img (img_dims.rows, img_dims.cols);
+        if (format == Format::PATHS)
+        {
+          if (!std::getline (in, path))
+          {
+            break;
+          }
+          if (path.empty ())
+          {
+            continue;
+          }
+          if (!readImageToMatrix (path, img))
+          {
+            error = ERROR_STREAM_IMAGE + path;
+            break;
+          }
+        }
+        else
+        {
+          in.read (reinterpret_cast<char *> (img.data ()),
+                   IMG_SIZE * sizeof (float));
+          if (in.gcount () == 0)
+          {
+            break;
+          }
+          if (in.gcount () != static_cast<std::streamsize> (IMG_SIZE
+                                                            * sizeof (float)))
+          {
+            error = ERROR_STREAM_RECORD + std::to_string (id);
+            break;
+          }
+        }
+
+        {
+          std::unique_lock<std::mutex> lock (window_mutex);
+          window_open.wait (lock, [&]
+          { return stopping || id - emitted < uint64_t (window); });
+          if (stopping)
+          {
+            break;
+          }
+        }
+        img.vectorize ();
+        if (!images.push ({id++, std::move (img)}))
+        {
+          break;
+        }
+      }
+    }
+    catch (...)
+    {
+      abort_run (std::current_exception ());
+    }
+    images.close ();
+  });
+
+  std::atomic<int> running (worker_count);
+  std::vector<std::thread> workers;
+  for (int w = 0; w < worker_count; ++w)
+  {
+    workers.emplace_back ([&]
+    {
+      std::vector<stream_item> batch;
+      std::vector<const float *> columns;
+      Matrix stacked;
+      std::vector<prediction> predictions (max_batch);
+      try
+      {
+        while (images.pop (batch, max_batch))
+        {
+          // Stack the images as the columns of one matrix
+          int count = static_cast<int> (batch.size ());
+          columns.clear ();
+          for (const stream_item &item : batch)
+          {
+            columns.push_back (item.image.data ());
+          }
+          Matrix::stack_columns (columns.data (), count, IMG_SIZE, stacked);
+          {
+            ModelSlot::Reader model = slot->acquire ();
+            model->predict_batch (stacked, predictions.data (), 1);
+          }
+          for (int j = 0; j < count; ++j)
+          {
+            results.push (make_record (batch[j].id, predictions[j]));
+          }
+          batch.clear ();
+        }
+      }
+      catch (...)
+      {
+        abort_run (std::current_exception ());
+      }
+      if (--running == 0)
+      {
+        results.close ();
+      }
+    });
+  }
+
+  // Results arrive in any order; ids in flight span less than window, so
+  // id % window gives every pending result its own reorder slot
+  std::vector<result_record> reorder (window);
+  std::vector<bool> present (window, false);
+  std::vector<result_record> arrived;
+  uint64_t next = 0;
+  bool failed = false;
+  try
+  {
+    while (results.pop (arrived, window))
+    {
+      for (const result_record &record : arrived)
+      {
+        reorder[record.image_id % window] = record;
+        present[record.image_id % window] = true;
+      }
+      arrived.clear ();
+
+      uint64_t first = next;
+      while (!failed && present[next % window])
+      {
+        present[next % window] = false;
+        failed = !emit (reorder[next % window]);
+        ++next;
+      }
+      if (next != first || failed)
+      {
+        std::lock_guard<std::mutex> lock (window_mutex);
+        emitted = next;
+        stopping = stopping || failed;
+        window_open.notify_one ();
+      }
+      if (failed)
+      {
+        images.close (); // Workers finish their batches, then stop
+      }
+    }
+  }
+  catch (...)
+  {
+    abort_run (std::current_exception ());
+  }
+
+  reader.join ();
+  for (std::thread &worker : workers)
+  {
+    worker.join ();
+  }
+  if (failure)
+  {
+    std::rethrow_exception (failure);
+  }
+  if (failed)
+  {
+    throw std::invalid_argument (ERROR_STREAM_OUTPUT);
+  }
+  if (!error.empty ())
+  {
+    throw std::invalid_argument (error);
+  }
+  return next;
+}
@@ -0,0 +1,153 @@
+// StreamPipeline.h
+#ifndef STREAMPIPELINE_H
+#define STREAMPIPELINE_H
+
+#include "ModelSlot.h"
+#include "ResultStream.h"
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <istream>
+#include <mutex>
+#include <vector>
+
+#define ERROR_STREAM_IMAGE "Error: invalid image path or size: "
+#define ERROR_STREAM_RECORD "Error: truncated raw image record "
+#define ERROR_STREAM_OUTPUT "Error: failed to write results. Exiting.."
+
+/**
+ * Blocking FIFO of at most capacity elements, shared by producer and
+ * consumer threads. Once closed, push fails and pop drains what is left.
+ */
+template <typename T>
+class BoundedQueue
+{
+ private:
+  std::deque<T> items;
+  size_t capacity;
+  bool closed;
+  std::mutex mutex;
+  std::condition_variable not_full;
+  std::condition_variable not_empty;
+
+ public:
+  explicit BoundedQueue (size_t capacity) : capacity (capacity), closed (false)
+  {}
+
+  /**
+ * Waits for room, then appends the item.
+ * @return false, dropping the item, if the queue is closed.
+ */
+  bool push (T item)
+  {
+    std::unique_lock<std::mutex> lock (mutex);
+    not_full.wait (lock, [this]
+    { return closed || items.size () < capacity; });
+    if (closed)
+    {
+      return false;
+    }
+    items.push_back (std::move (item));
+    not_empty.notify_one ();
+    return true;
+  }
+
+  /**
+ * Waits for an item, then moves out up to max_count items.
+ * @return false once the queue is closed and empty.
+ */
+  bool pop (std::vector<T> &out, size_t max_count)
+  {
+    std::unique_lock<std::mutex> lock (mutex);
+    not_empty.wait (lock, [this]
+    { return closed || !items.empty (); });
+    if (items.empty ())
+    {
+      return false;
+    }
+    while (!items.empty () && out.size () < max_count)
+    {
+      out.push_back (std::move (items.front ()));
+      items.pop_front ();
+    }
+    not_full.notify_all ();
+    return true;
+  }
+
+  /**
+ * Wakes every waiter; later pushes fail.
+ */
+  void close ()
+  {
+    std::lock_guard<std::mutex> lock (mutex);
+    closed = true;
+    not_full.notify_all ();
+    not_empty.notify_all ();
+  }
+};
+
+/**
+ * Three-stage streaming inference: a reader thread parses images from an
+ * input stream, worker threads run them in coalesced batches, and the
+ * calling thread emits the results in input order.
+ * At most window images are in flight between reading and emitting, so a
+ * slow consumer (or a slow image) stalls the reader instead of growing
+ * any buffer: memory stays bounded whatever the input size.
+ * Each batch runs on whichever network the slot holds when it starts.
+ */
+class StreamPipeline
+{
+ public:
+  /**
+ * Input formats.
+ * PATHS - one image path per line, read by readImageToMatrix
+ * RAW - back-to-back records of img_dims floats, the format of
+ *       readFileToMatrix
+ */
+  enum class Format
+  {
+      PATHS,
+      RAW
+  };
+
+  /**
+ * Receives each result, in input order, on the thread that called run.
+ * Returning false stops the pipeline.
+ */
+  typedef std::function<bool (const result_record &record)> Emit;
+
+ private:
+  const ModelSlot *slot;
+  int worker_count;
+  int max_batch;
+  int window;
+
+ public:
+  /**
+ * @param slot Slot holding the network; it must outlive the pipeline.
+ * @param workers Number of inference threads, at least 1.
+ * @param max_batch Largest number of images run in one pass.
+ * @param window Largest number of images in flight, at least max_batch.
+ * @throws std::exception if a count is not positive or window is smaller
+ *         than max_batch.
+ */
+  StreamPipeline (const ModelSlot &slot, int workers, int max_batch,
+                  int window);
+
+/**
+ * Streams every image of in through the network. Image ids count the
+ * records from 0.
+ * @param in The input stream.
+ * @param format How in is laid out.
+ * @param emit Receives the results.
+ * @return Number of images emitted.
+ * @throw std::invalid_argument on an unreadable image or truncated record
+ *        (after emitting every result before it) or when emit fails.
+ *        An exception thrown by emit or by the model stops every stage
+ *        and is rethrown once the threads are joined.
+ */
+  uint64_t run (std::istream &in, Format format, const Emit &emit) const
+  noexcept (false);
+};
+
+#endif //STREAMPIPELINE_H
\ No newline at end of file
@@ -0,0 +1,557 @@
+// distill.cpp
+#include "MlpNetwork.h"
+#include "MlpIO.h"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <numeric>
+#include <random>
+#include <sstream>
+
+#define USAGE_MSG "Usage:\n" \
+                  "\t./distill [options] out_dir [w1 w2 w3 w4 b1 b2 b3 b4] " \
+                  "idx_images idx_labels\n" \
+                  "\tout_dir - existing directory for the student's " \
+                  "parameters and model descriptor\n" \
+                  "\tw1..b4 - the teacher network, unless given by --model\n" \
+                  "\tidx_images, idx_labels - MNIST IDX files; the teacher " \
+                  "labels the training part, the labels score the held-out " \
+                  "part\n" \
+                  "Options:\n" \
+                  "\t--hidden N[,N...] - student hidden layer sizes " \
+                  "(default 32)\n" \
+                  "\t--epochs N - passes over the training part (default 10)\n" \
+                  "\t--batch N - images per SGD step (default 64)\n" \
+                  "\t--rate R - learning rate (default 0.05)\n" \
+                  "\t--temperature T - softmax temperature of the targets " \
+                  "(default 2)\n" \
+                  "\t--holdout F - fraction of the images held out " \
+                  "(default 0.2)\n" \
+                  "\t--seed N - initialization and shuffling seed (default 1)\n" \
+                  "\t--model descriptor - load the teacher from a model file"
+#define USAGE_ERR "Error: wrong arguments."
+#define IMG_SIZE (img_dims.rows * img_dims.cols)
+#define MOMENTUM 0.9F
+#define MIN_BENCH_SECONDS 0.2
+
+/**
+ * Command line options of the distillation run.
+ */
+struct options
+{
+    std::vector<int> hidden;
+    int epochs;
+    int batch;
+    float rate;
+    float temperature;
+    float holdout;
+    unsigned int seed;
+    std::string model;
+};
+
+/**
+ * A student layer under training, with its SGD state.
+ */
+struct student_layer
+{
+    Matrix weights;
+    Matrix bias;
+    Matrix weights_velocity;
+    Matrix bias_velocity;
+};
+
+/**
+ * Parses a comma-separated list of positive layer sizes.
+ * @return boolean status
+ */
+static bool parseSizes (const std::string &list, std::vector<int> &sizes)
+{
+  sizes.clear ();
+  std::istringstream fields (list);
+  std::string field;
+  while (std::getline (fields, field, ','))
+  {
+    int size = std::atoi (field.c_str ());
+    if (size <= 0)
+    {
+      return false;
+    }
+    sizes.push_back (size);
+  }
+  return !sizes.empty ();
+}
+
+/**
+ * Parses the leading --options, leaving argIdx on out_dir.
+ * @return boolean status
+ */
+static bool parseOptions (int argc, char **argv, int &argIdx, options &opts)
+{
+  opts = {{32}, 10, 64, 0.05F, 2.0F, 0.2F, 1, ""};
+  for (argIdx = 1; argIdx < argc && std::strncmp (argv[argIdx], "--", 2) == 0;
+       ++argIdx)
+  {
+    std::string opt (argv[argIdx]);
+    if (argIdx + 1 >= argc)
+    {
+      return false;
+    }
+    std::string value (argv[++argIdx]);
+    if (opt == "--hidden")
+    {
+      if (!parseSizes (value, opts.hidden))
+      {
+        return false;
+      }
+    }
+    else if (opt == "--epochs" || opt == "--batch")
+    {
+      int count = std::atoi (value.c_str ());
+      if (count <= 0)
+      {
+        return false;
+      }
+      (opt == "--epochs" ? opts.epochs : opts.batch) = count;
+    }
+    else if (opt == "--rate" || opt == "--temperature")
+    {
+      float number = std::strtof (value.c_str (), nullptr);
+      if (!(number > 0.0F))
+      {
+        return false;
+      }
+      (opt == "--rate" ? opts.rate : opts.temperature) = number;
+    }
+    else if (opt == "--holdout")
+    {
+      opts.holdout = std::strtof (value.c_str (), nullptr);
+      if (!(opts.holdout > 0.0F && opts.holdout < 1.0F))
+      {
+        return false;
+      }
+    }
+    else if (opt == "--seed")
+    {
+      opts.seed = static_cast<unsigned int> (std::atoi (value.c_str ()));
+    }
+    else if (opt == "--model")
+    {
+      opts.model = value;
+    }
+    else
+    {
+      return false;
+    }
+  }
+  // out_dir, the teacher's parameters (unless --model), images and labels
+  int expected = 3 + (opts.model.empty () ? MLP_SIZE * 2 : 0);
+  return argc - argIdx == expected;
+}
+
+/**
+ * Copies images into the columns of a batch.
+ * @param images one image per row
+ * @param order row indices to copy, batch.get_cols () of them
+ * @param batch IMG_SIZE x count destination
+ */
+static void gatherColumns (const Matrix &images, const int *order,
+                           Matrix &batch)
+{
+  int count = batch.get_cols ();
+  float *dst = batch.data ();
+  for (int j = 0; j < count; ++j)
+  {
+    const float *src = images.row (order[j]);
+    for (int i = 0; i < IMG_SIZE; ++i)
+    {
+      dst[i * count + j] = src[i];
+    }
+  }
+}
+
+/**
+ * Computes the teacher's softened distribution of every image.
+ * @return DIGITS_COUNT x image count targets, one image per column
+ */
+static Matrix teacherTargets (const MlpNetwork &teacher, const Matrix &images,
+                              int count, float temperature, int batchSize)
+{
+  Matrix targets (DIGITS_COUNT, count);
+  std::vector<int> order (count);
+  std::iota (order.begin (), order.end (), 0);
+  for (int first = 0; first < count; first += batchSize)
+  {
+    int size = std::min (batchSize, count - first);
+    Matrix batch (IMG_SIZE, size);
+    gatherColumns (images, order.data () + first, batch);
+    Matrix logits = teacher.logits (batch);
+    Matrix soft = activation::softmax (logits * (1.0F / temperature));
+    for (int d = 0; d < DIGITS_COUNT; ++d)
+    {
+      std::copy (soft.row (d), soft.row (d) + size,
+                 targets.row (d) + first);
+    }
+  }
+  return targets;
+}
+
+/**
+ * He-initializes the student layers for the given layer sizes.
+ */
+static std::vector<student_layer> initStudent (const std::vector<int> &sizes,
+                                               std::mt19937 &random)
+{
+  std::vector<student_layer> layers;
+  for (size_t l = 1; l < sizes.size (); ++l)
+  {
+    student_layer layer {Matrix (sizes[l], sizes[l - 1]),
+                         Matrix (sizes[l], 1),
+                         Matrix (sizes[l], sizes[l - 1]),
+                         Matrix (sizes[l], 1)};
+    std::normal_distribution<float> normal (
+        0.0F, std::sqrt (2.0F / static_cast<float> (sizes[l - 1])));
+    float *w = layer.weights.data ();
+    for (int i = 0; i < sizes[l] * sizes[l - 1]; ++i)
+    {
+      w[i] = normal (random);
+    }
+    layers.push_back (std::move (layer));
+  }
+  return layers;
+}
+
+/**
+ * One SGD step on the distillation loss: cross entropy between the
+ * student's and the teacher's softmax at the given temperature, scaled by
+ * temperature^2 so gradients keep their magnitude across temperatures.
+ * @param layers the student, updated in place
+ * @param batch IMG_SIZE x size input
+ * @param targets DIGITS_COUNT x size teacher distributions
+ */
+static void trainStep (std::vector<student_layer> &layers, const Matrix &batch,
+                       const Matrix &targets, const options &opts)
+{
+  int size = batch.get_cols ();
+  size_t depth = layers.size ();
+
+  // Forward, keeping every layer's activations
+  std::vector<Matrix> outputs (depth + 1);
+  outputs[0] = batch;
+  for (size_t l = 0; l < depth; ++l)
+  {
+    const student_layer &layer = layers[l];
+    Matrix z (layer.weights.get_rows (), size);
+    Matrix::gemm (layer.weights.data (), outputs[l].data (), z.data (),
+                  z.get_rows (), layer.weights.get_cols (), size, false);
+    for (int i = 0; i < z.get_rows (); ++i)
+    {
+      float *row = z.row (i);
+      for (int j = 0; j < size; ++j)
+      {
+        row[j] += layer.bias[i];
+        if (l + 1 < depth && row[j] < 0.0F)
+        {
+          row[j] = 0.0F; // ReLU on hidden layers
+        }
+      }
+    }
+    outputs[l + 1] = z;
+  }
+  Matrix probabilities = activation::softmax (
+      outputs[depth] * (1.0F / opts.temperature));
+
+  // d(T^2 * loss) / d(logits) = T * (student - teacher), averaged
+  Matrix delta (DIGITS_COUNT, size);
+  float scale = opts.temperature / static_cast<float> (size);
+  for (int i = 0; i < DIGITS_COUNT * size; ++i)
+  {
+    delta[i] = (probabilities[i] - targets[i]) * scale;
+  }
+
+  Matrix transposed;
+  for (size_t l = depth; l-- > 0;)
+  {
+    student_layer &layer = layers[l];
+    int rows = layer.weights.get_rows (), cols = layer.weights.get_cols ();
+
+    // Gradient of the layer input, through the previous ReLU
+    Matrix previous_delta;
+    if (l > 0)
+    {
+      previous_delta = Matrix (cols, size);
+      layer.weights.transpose_to (transposed);
+      Matrix::gemm (transposed.data (), delta.data (), previous_delta.data (),
+                    cols, rows, size, false);
+      const float *activations = outputs[l].data ();
+      float *d = previous_delta.data ();
+      for (int i = 0; i < cols * size; ++i)
+      {
+        d[i] = activations[i] > 0.0F ? d[i] : 0.0F;
+      }
+    }
+
+    Matrix gradient (rows, cols);
+    outputs[l].transpose_to (transposed);
+    Matrix::gemm (delta.data (), transposed.data (), gradient.data (), rows,
+                  size, cols, false);
+    for (int i = 0; i < rows * cols; ++i)
+    {
+      layer.weights_velocity[i] = MOMENTUM * layer.weights_velocity[i]
+                                  - opts.rate * gradient[i];
+      layer.weights[i] += layer.weights_velocity[i];
+    }
+    for (int i = 0; i < rows; ++i)
+    {
+      const float *row = delta.row (i);
+      float sum = std::accumulate (row, row + size, 0.0F);
+      layer.bias_velocity[i] = MOMENTUM * layer.bias_velocity[i]
+                               - opts.rate * sum;
+      layer.bias[i] += layer.bias_velocity[i];
+    }
+    delta = previous_delta;
+  }
+}
+
+/**
+ * Wraps the trained parameters into a network: ReLU hidden layers and a
+ * softmax output.
+ */
+static MlpNetwork toNetwork (const std::vector<student_layer> &layers)
+{
+  std::vector<Dense> dense;
+  for (size_t l = 0; l < layers.size (); ++l)
+  {
+    dense.emplace_back (layers[l].weights, layers[l].bias,
+                        activation::kernel (l + 1 < layers.size ()
+                                            ? activation::Kind::RELU
+                                            : activation::Kind::SOFTMAX));
+  }
+  return MlpNetwork (std::move (dense));
+}
+
+/**
+ * Fraction of images from first on whose top digit matches the reference.
+ * @param reference labels, or nullptr to compare against other
+ * @param other predictions to compare against when reference is null
+ */
+static double agreement (const MlpNetwork &mlp, const Matrix &images,
+                         int first, int count,
+                         const std::vector<unsigned int> *reference,
+                         const MlpNetwork *other)
+{
+  std::vector<int> order (count);
+  std::iota (order.begin (), order.end (), first);
+  Matrix batch (IMG_SIZE, count);
+  gatherColumns (images, order.data (), batch);
+  std::vector<prediction> results (count), otherResults (count);
+  mlp.predict_batch (batch, results.data (), 1);
+  if (other != nullptr)
+  {
+    other->predict_batch (batch, otherResults.data (), 1);
+  }
+  long matches = 0;
+  for (int j = 0; j < count; ++j)
+  {
+    unsigned int expected = reference != nullptr ? (*reference)[first + j]
+                                                 : otherResults[j].top[0].value;
+    matches += results[j].top[0].value == expected;
+  }
+  return static_cast<double> (matches) / count;
+}
+
+/**
+ * Times single-image inference and batched passes over the images, each
+ * repeated until MIN_BENCH_SECONDS have elapsed. An untimed batched pass
+ * first warms the caches and the batch buffers.
+ * @param single receives microseconds per image, one image at a time
+ * @param batched receives microseconds per image in one batch
+ */
+static void timeNetwork (const MlpNetwork &mlp, const Matrix &images,
+                         int first, int count, double &single,
+                         double &batched)
+{
+  using clock = std::chrono::steady_clock;
+  Matrix image (IMG_SIZE, 1);
+  long runs = 0;
+  auto start = clock::now ();
+  std::chrono::duration<double> elapsed (0);
+  while (elapsed.count () < MIN_BENCH_SECONDS)
+  {
+    std::copy (images.row (first + runs % count),
+               images.row (first + runs % count) + IMG_SIZE, image.data ());
+    mlp (image);
+    ++runs;
+    elapsed = clock::now () - start;
+  }
+  single = elapsed.count () * 1e6 / static_cast<double> (runs);
+
+  std::vector<int> order (count);
+  std::iota (order.begin (), order.end (), first);
+  Matrix batch (IMG_SIZE, count);
+  gatherColumns (images, order.data (), batch);
+  std::vector<prediction> results (count);
+  mlp.predict_batch (batch, results.data (), 1);
+  runs = 0;
+  start = clock::now ();
+  elapsed = std::chrono::duration<double> (0);
+  while (elapsed.count () < MIN_BENCH_SECONDS)
+  {
+    mlp.predict_batch (batch, results.data (), 1);
+    ++runs;
+    elapsed = clock::now () - start;
+  }
+  batched = elapsed.count () * 1e6 / (static_cast<double> (runs) * count);
+}
+
+/**
+ * Prints one row of the teacher / student comparison.
+ */
+static void reportNetwork (const std::string &name, const MlpNetwork &mlp,
+                           const Matrix &images, int first, int count,
+                           const std::vector<unsigned int> &labels)
+{
+  long parameters = 0;
+  std::string shape = std::to_string (IMG_SIZE);
+  for (int l = 0; l < mlp.layer_count (); ++l)
+  {
+    const Matrix &weights = mlp.get_layer (l).get_weights ();
+    parameters += (weights.get_cols () + 1L) * weights.get_rows ();
+    shape += "-" + std::to_string (weights.get_rows ());
+  }
+  double single, batched;
+  timeNetwork (mlp, images, first, count, single, batched);
+  std::cout << name << " " << shape << ": " << parameters << " parameters, "
+            << "accuracy " << agreement (mlp, images, first, count, &labels,
+                                         nullptr)
+            << ", " << single << " us/image single, " << batched
+            << " us/image batched" << std::endl;
+}
+
+/**
+ * Writes the student's parameters and a model descriptor loading them.
+ * @return boolean status
+ */
+static bool exportStudent (const std::string &outDir,
+                           const std::vector<student_layer> &layers)
+{
+  std::ofstream descriptor (outDir + "/model");
+  descriptor << "# Distilled student; load with loadModel or evaluate --model"
+             << std::endl;
+  for (size_t l = 0; l < layers.size (); ++l)
+  {
+    std::string index = std::to_string (l + 1);
+    if (!(writeMatrixToFile (outDir + "/w" + index, layers[l].weights)
+          && writeMatrixToFile (outDir + "/b" + index, layers[l].bias)))
+    {
+      return false;
+    }
+    descriptor << "dense " << layers[l].weights.get_rows () << " "
+               << layers[l].weights.get_cols () << " w" << index << " b"
+               << index << " "
+               << (l + 1 < layers.size () ? "relu" : "softmax") << std::endl;
+  }
+  return static_cast<bool> (descriptor);
+}
+
+/**
+ * Program's main
+ * @param argc count of args
+ * @param argv args values
+ * @return program exit status code
+ */
+int main (int argc, char **argv)
+{
+  int argIdx;
+  options opts;
+  if (!parseOptions (argc, argv, argIdx, opts))
+  {
+    std::cerr << USAGE_ERR << std::endl << USAGE_MSG << std::endl;
+    return EXIT_FAILURE;
+  }
+  std::string outDir (argv[argIdx++]);
+
+  std::unique_ptr<MlpNetwork> teacher;
+  try
+  {
+    if (!opts.model.empty ())
+    {
+      teacher.reset (new MlpNetwork (loadModel (opts.model)));
+    }
+    else
+    {
+      Matrix weights[MLP_SIZE];
+      Matrix biases[MLP_SIZE];
+      loadParameters (argv + argIdx, weights, biases);
+      teacher.reset (new MlpNetwork (weights, biases));
+      argIdx += MLP_SIZE * 2;
+    }
+  }
+  catch (const std::invalid_argument &invalidArgument)
+  {
+    std::cerr << invalidArgument.what () << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  Matrix images;
+  std::vector<unsigned int> labels;
+  if (!(readIdxImages (argv[argIdx], images)
+        && readIdxLabels (argv[argIdx + 1], labels)
+        && labels.size () == size_t (images.get_rows ())))
+  {
+    return EXIT_FAILURE;
+  }
+  int count = images.get_rows ();
+  int trainCount = static_cast<int> (count * (1.0F - opts.holdout));
+  int testCount = count - trainCount;
+  if (trainCount < 1 || testCount < 1)
+  {
+    std::cerr << USAGE_ERR << std::endl << USAGE_MSG << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  Matrix targets = teacherTargets (*teacher, images, trainCount,
+                                   opts.temperature, opts.batch);
+  std::vector<int> sizes {IMG_SIZE};
+  sizes.insert (sizes.end (), opts.hidden.begin (), opts.hidden.end ());
+  sizes.push_back (DIGITS_COUNT);
+  std::mt19937 random (opts.seed);
+  std::vector<student_layer> student = initStudent (sizes, random);
+
+  std::vector<int> order (trainCount);
+  std::iota (order.begin (), order.end (), 0);
+  for (int epoch = 1; epoch <= opts.epochs; ++epoch)
+  {
+    std::shuffle (order.begin (), order.end (), random);
+    for (int first = 0; first < trainCount; first += opts.batch)
+    {
+      int size = std::min (opts.batch, trainCount - first);
+      Matrix batch (IMG_SIZE, size);
+      gatherColumns (images, order.data () + first, batch);
+      Matrix batchTargets (DIGITS_COUNT, size);
+      for (int d = 0; d < DIGITS_COUNT; ++d)
+      {
+        for (int j = 0; j < size; ++j)
+        {
+          batchTargets (d, j) = targets (d, order[first + j]);
+        }
+      }
+      trainStep (student, batch, batchTargets, opts);
+    }
+    MlpNetwork current = toNetwork (student);
+    std::cout << "epoch " << epoch << ": held-out agreement with teacher "
+              << agreement (current, images, trainCount, testCount, nullptr,
+                            teacher.get ())
+              << std::endl;
+  }
+
+  MlpNetwork distilled = toNetwork (student);
+  if (!exportStudent (outDir, student))
+  {
+    return EXIT_FAILURE;
+  }
+  std::cout << "held-out images: " << testCount << std::endl;
+  reportNetwork ("teacher", *teacher, images, trainCount, testCount, labels);
+  reportNetwork ("student", distilled, images, trainCount, testCount, labels);
+  return EXIT_SUCCESS;
+}
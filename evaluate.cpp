@@ -0,0 +1,546 @@
+// evaluate.cpp
+#include "Ensemble.h"
+#include "KernelCheck.h"
+#include "MlpNetwork.h"
+#include "MlpIO.h"
+#include "NumaTopology.h"
+#include "PerfCounters.h"
+#include "Reduce.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <iomanip>
+#include <thread>
+
+#define USAGE_MSG "Usage:\n" \
+                  "\t./evaluate [options] (w1 w2 w3 w4 b1 b2 b3 b4 | " \
+                  "--model descriptor) labels | (idx_images idx_labels)\n" \
+                  "\t./evaluate --verify N (w1 w2 w3 w4 b1 b2 b3 b4 | " \
+                  "--model descriptor)\n" \
+                  "\tlabels - label list of raw image files\n" \
+                  "\tidx_images, idx_labels - MNIST IDX files\n" \
+                  "\tdescriptor - model file selecting layers and " \
+                  "activations (see parameters/model)\n" \
+                  "Options:\n" \
+                  "\t--threads N - worker threads (default: all cores)\n" \
+                  "\t--batch N - images per forward pass (default 64)\n" \
+                  "\t--sparse - run on the sparse (CSC/CSR) kernels\n" \
+                  "\t--compare - also run the scalar double precision " \
+                  "reference and report disagreements\n" \
+                  "\t--numa - replicate the network per NUMA node and pin " \
+                  "threads (set " NUMA_SIMULATE_ENV "=N to simulate N nodes)\n" \
+                  "\t--reduce fast|reproducible - summation mode of sums " \
+                  "and softmax (default reproducible)\n" \
+                  "\t--tta - average over shifted and rotated copies of " \
+                  "each image\n" \
+                  "\t--ensemble descriptor - average with another model " \
+                  "(repeatable; not with --numa)\n" \
+                  "\t--perf - report hardware counters per layer shape\n" \
+                  "\t--verify N - check the kernels against scalar " \
+                  "references on N random cases each, instead of evaluating"
+#define USAGE_ERR "Error: wrong arguments."
+#define DEFAULT_BATCH 64
+#define VERIFY_SEED 12345U
+#define IMG_SIZE (img_dims.rows * img_dims.cols)
+
+/**
+ * Command line options of the evaluation run.
+ */
+struct options
+{
+    int threads;
+    int batch;
+    bool sparse;
+    bool compare;
+    bool numa;
+    std::string model;
+    bool tta;
+    std::vector<std::string> members;
+    int verify;
+};
+
+/**
+ * Timings of one pass over the dataset.
+ * @var seconds - wall-clock time of the whole pass
+ * @var latencies - seconds per forward pass, one entry per batch
+ */
+struct run_stats
+{
+    double seconds;
+    std::vector<double> latencies;
+};
+
+/**
+ * Parses the leading --options, leaving argIdx on the first parameter path.
+ * @return boolean status
+ */
+static bool parseOptions (int argc, char **argv, int &argIdx, options &opts)
+{
+  opts = {static_cast<int> (std::thread::hardware_concurrency ()),
+          DEFAULT_BATCH, false, false, false, "", false, {}, 0};
+  opts.threads = std::max (opts.threads, 1);
+  for (argIdx = 1; argIdx < argc && std::strncmp (argv[argIdx], "--", 2) == 0;
+       ++argIdx)
+  {
+    std::string opt (argv[argIdx]);
+    if ((opt == "--threads" || opt == "--batch" || opt == "--verify")
+        && argIdx + 1 < argc)
+    {
+      int value = std::atoi (argv[++argIdx]);
+      if (value <= 0)
+      {
+        return false;
+      }
+      (opt == "--threads" ? opts.threads
+                          : opt == "--batch" ? opts.batch : opts.verify) = value;
+    }
+    else if (opt == "--sparse")
+    {
+      opts.sparse = true;
+    }
+    else if (opt == "--compare")
+    {
+      opts.compare = true;
+    }
+    else if (opt == "--numa")
+    {
+      opts.numa = true;
+    }
+    else if (opt == "--perf")
+    {
+      perf::enable (true);
+    }
+    else if (opt == "--tta")
+    {
+      opts.tta = true;
+    }
+    else if (opt == "--ensemble" && argIdx + 1 < argc)
+    {
+      opts.members.push_back (argv[++argIdx]);
+    }
+    else if (opt == "--model" && argIdx + 1 < argc)
+    {
+      opts.model = argv[++argIdx];
+    }
+    else if (opt == "--reduce" && argIdx + 1 < argc)
+    {
+      std::string mode (argv[++argIdx]);
+      if (mode != "fast" && mode != "reproducible")
+      {
+        return false;
+      }
+      reduce::set_mode (mode == "fast" ? reduce::Mode::FAST
+                                       : reduce::Mode::REPRODUCIBLE);
+    }
+    else
+    {
+      return false;
+    }
+  }
+  if (opts.numa && (opts.tta || !opts.members.empty ()))
+  {
+    return false;
+  }
+  int datasetArgs = argc - argIdx - (opts.model.empty () ? MLP_SIZE * 2 : 0);
+  if (opts.verify > 0)
+  {
+    return datasetArgs == 0; // Verification needs no dataset
+  }
+  return datasetArgs == 1 || datasetArgs == 2;
+}
+
+/**
+ * Loads the labeled images, one image per row.
+ * @param paths one label list path, or IDX image and label paths
+ * @param pathCount 1 or 2
+ * @return boolean status
+ */
+static bool loadDataset (char **paths, int pathCount, Matrix &images,
+                         std::vector<unsigned int> &labels)
+{
+  if (pathCount == 2)
+  {
+    return readIdxImages (paths[0], images) && readIdxLabels (paths[1], labels)
+           && labels.size () == size_t (images.get_rows ());
+  }
+
+  std::vector<std::string> imagePaths;
+  if (!readLabelList (paths[0], imagePaths, labels) || imagePaths.empty ())
+  {
+    return false;
+  }
+  images = Matrix (static_cast<int> (imagePaths.size ()), IMG_SIZE);
+  Matrix img (img_dims.rows, img_dims.cols);
+  for (size_t i = 0; i < imagePaths.size (); ++i)
+  {
+    if (!readImageToMatrix (imagePaths[i], img))
+    {
+      return false;
+    }
+    std::copy (img.data (), img.data () + IMG_SIZE,
+               images.data () + i * IMG_SIZE);
+  }
+  return true;
+}
+
+/**
+ * Runs a network (or ensemble) over every image, batches spread across
+ * threads. With --numa, thread t is pinned to node t % node_count and runs
+ * networks[node].
+ * @param networks one network per node of topology
+ * @param images one image per row
+ * @param results receives one prediction per image
+ * @return timings of the pass
+ */
+template <typename Network>
+static run_stats runBatches (const std::vector<const Network *> &networks,
+                             const NumaTopology &topology,
+                             const Matrix &images, const options &opts,
+                             std::vector<prediction> &results)
+{
+  using clock = std::chrono::steady_clock;
+  int count = images.get_rows ();
+  int batches = (count + opts.batch - 1) / opts.batch;
+  results.resize (count);
+  std::vector<double> latencies (batches);
+  std::atomic<int> nextBatch (0);
+
+  auto worker = [&] (int thread)
+  {
+    int node = thread % topology.node_count ();
+    if (opts.numa)
+    {
+      topology.pin_to_node (node);
+    }
+    const Network &network = *networks[node];
+    Matrix batch;
+    for (int b = nextBatch++; b < batches; b = nextBatch++)
+    {
+      int first = b * opts.batch;
+      int size = std::min (opts.batch, count - first);
+      auto start = clock::now ();
+
+      // Rows of the dataset become the columns of the batch
+      if (batch.get_rows () != IMG_SIZE || batch.get_cols () != size)
+      {
+        batch = Matrix (IMG_SIZE, size);
+      }
+      Matrix::transpose_copy (images.data () + first * IMG_SIZE, size,
+                              IMG_SIZE, batch.data ());
+      network.predict_batch (batch, results.data () + first, 1);
+
+      std::chrono::duration<double> elapsed = clock::now () - start;
+      latencies[b] = elapsed.count ();
+    }
+  };
+
+  auto start = clock::now ();
+  // Pinned workers all get their own thread, leaving the caller unpinned
+  std::vector<std::thread> threads;
+  for (int t = opts.numa ? 0 : 1; t < opts.threads; ++t)
+  {
+    threads.emplace_back (worker, t);
+  }
+  if (!opts.numa)
+  {
+    worker (0);
+  }
+  for (std::thread &thread : threads)
+  {
+    thread.join ();
+  }
+  std::chrono::duration<double> elapsed = clock::now () - start;
+  return {elapsed.count (), latencies};
+}
+
+/**
+ * Runs the network over every image; with --numa, on per-node replicas.
+ */
+static run_stats runNetwork (const MlpNetwork &mlp, const Matrix &images,
+                             const options &opts,
+                             std::vector<prediction> &results)
+{
+  if (!opts.numa)
+  {
+    return runBatches<MlpNetwork> ({&mlp}, NumaTopology (), images, opts,
+                                   results);
+  }
+  NumaTopology topology = NumaTopology::detect ();
+  std::vector<std::unique_ptr<const MlpNetwork>> replicas =
+      topology.replicate (mlp);
+  std::vector<const MlpNetwork *> networks;
+  for (const auto &replica : replicas)
+  {
+    networks.push_back (replica.get ());
+  }
+  return runBatches (networks, topology, images, opts, results);
+}
+
+/**
+ * Prints accuracy, confusion matrix, per-class precision/recall and speed.
+ */
+static void report (const std::string &title,
+                    const std::vector<prediction> &results,
+                    const std::vector<unsigned int> &labels,
+                    run_stats stats, const options &opts)
+{
+  long confusion[DIGITS_COUNT][DIGITS_COUNT] = {};
+  long correct = 0;
+  for (size_t i = 0; i < results.size (); ++i)
+  {
+    unsigned int predicted = results[i].top[0].value;
+    ++confusion[labels[i]][predicted];
+    correct += predicted == labels[i];
+  }
+  double count = static_cast<double> (results.size ());
+
+  std::cout << "== " << title << std::endl
+            << "accuracy: " << correct / count << " (" << correct << " / "
+            << results.size () << ")" << std::endl
+            << "confusion (rows: label, cols: predicted):" << std::endl;
+  for (int i = 0; i < DIGITS_COUNT; ++i)
+  {
+    std::cout << std::setw (3) << i << ":";
+    for (int j = 0; j < DIGITS_COUNT; ++j)
+    {
+      std::cout << std::setw (6) << confusion[i][j];
+    }
+    std::cout << std::endl;
+  }
+
+  std::cout << "class  precision  recall" << std::endl;
+  for (int c = 0; c < DIGITS_COUNT; ++c)
+  {
+    long predicted = 0, actual = 0;
+    for (int k = 0; k < DIGITS_COUNT; ++k)
+    {
+      predicted += confusion[k][c];
+      actual += confusion[c][k];
+    }
+    std::cout << std::setw (5) << c << std::setw (11)
+              << (predicted ? double (confusion[c][c]) / predicted : 0.0)
+              << std::setw (8)
+              << (actual ? double (confusion[c][c]) / actual : 0.0)
+              << std::endl;
+  }
+
+  std::sort (stats.latencies.begin (), stats.latencies.end ());
+  auto percentile = [&stats] (double p)
+  {
+    size_t idx = static_cast<size_t> (p * (stats.latencies.size () - 1));
+    return stats.latencies[idx] * 1e6;
+  };
+  std::cout << "throughput: " << count / stats.seconds << " images/sec ("
+            << opts.threads << " threads, batch " << opts.batch << ")"
+            << std::endl
+            << "batch latency us: p50 " << percentile (0.5) << " p90 "
+            << percentile (0.9) << " p99 " << percentile (0.99) << " max "
+            << percentile (1.0) << std::endl;
+}
+
+/**
+ * The scalar double precision forward pass of kernel_check, behind the
+ * predict_batch interface runBatches drives. It shares no kernel with
+ * MlpNetwork, so --compare checks the dense path as well as the sparse one.
+ */
+class ScalarReference
+{
+ public:
+  explicit ScalarReference (const MlpNetwork &mlp) : mlp (&mlp)
+  {}
+
+  void predict_batch (const Matrix &images, prediction results[],
+                      unsigned int k) const
+  {
+    Matrix probabilities = kernel_check::forward (*mlp, images);
+    for (int j = 0; j < probabilities.get_cols (); ++j)
+    {
+      fill_prediction (probabilities.data () + j, probabilities.get_cols (),
+                       k, results[j]);
+    }
+  }
+
+ private:
+  const MlpNetwork *mlp;
+};
+
+/**
+ * Reports how far a variant strays from the reference predictions.
+ */
+static void compareResults (const std::vector<prediction> &reference,
+                            const std::vector<prediction> &variant)
+{
+  long disagreements = 0;
+  float maxDiff = 0.0F;
+  for (size_t i = 0; i < reference.size (); ++i)
+  {
+    disagreements += reference[i].top[0].value != variant[i].top[0].value;
+    for (int d = 0; d < DIGITS_COUNT; ++d)
+    {
+      maxDiff = std::max (maxDiff, std::abs (reference[i].probabilities[d]
+                                             - variant[i].probabilities[d]));
+    }
+  }
+  std::cout << "== reference vs variant" << std::endl
+            << "disagreements: " << disagreements << " / " << reference.size ()
+            << std::endl << "max probability difference: " << maxDiff
+            << std::endl;
+}
+
+/**
+ * Runs the differential kernel checks and prints one line per kernel.
+ * @return true if every case was within tolerance
+ */
+static bool verifyKernels (const MlpNetwork &mlp, int cases)
+{
+  std::vector<kernel_check::result> results =
+      kernel_check::run (cases, VERIFY_SEED, mlp);
+  long failures = 0;
+  std::cout << "== kernel check (seed " << VERIFY_SEED << ")" << std::endl
+            << std::left << std::setw (20) << "kernel" << std::right
+            << std::setw (8) << "cases" << std::setw (10) << "failures"
+            << std::setw (12) << "max ulp" << std::setw (14) << "max error"
+            << std::endl;
+  for (const kernel_check::result &result : results)
+  {
+    std::cout << std::left << std::setw (20) << result.kernel << std::right
+              << std::setw (8) << result.cases << std::setw (10)
+              << result.failures << std::setw (12) << result.max_ulp
+              << std::setw (14) << result.max_error << std::endl;
+    failures += result.failures;
+  }
+  std::cout << (failures ? "FAILED" : "passed") << std::endl;
+  return failures == 0;
+}
+
+/**
+ * Program's main
+ * @param argc count of args
+ * @param argv args values
+ * @return program exit status code
+ */
+int main (int argc, char **argv)
+{
+  int argIdx;
+  options opts;
+  if (!parseOptions (argc, argv, argIdx, opts))
+  {
+    std::cerr << USAGE_ERR << std::endl << USAGE_MSG << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  std::unique_ptr<MlpNetwork> reference;
+  int datasetIdx = argIdx;
+  try
+  {
+    if (!opts.model.empty ())
+    {
+      reference.reset (new MlpNetwork (loadModel (opts.model)));
+    }
+    else
+    {
+      Matrix weights[MLP_SIZE];
+      Matrix biases[MLP_SIZE];
+      loadParameters (argv + argIdx, weights, biases);
+      reference.reset (new MlpNetwork (weights, biases));
+      datasetIdx += MLP_SIZE * 2;
+    }
+  }
+  catch (const std::invalid_argument &invalidArgument)
+  {
+    std::cerr << invalidArgument.what () << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  if (opts.verify > 0)
+  {
+    return verifyKernels (*reference, opts.verify) ? EXIT_SUCCESS
+                                                   : EXIT_FAILURE;
+  }
+
+  Matrix images;
+  std::vector<unsigned int> labels;
+  if (!loadDataset (argv + datasetIdx, argc - datasetIdx, images, labels))
+  {
+    return EXIT_FAILURE;
+  }
+
+  MlpNetwork variant = *reference; // Shares the parameters
+  if (opts.sparse)
+  {
+    variant.set_storage (0, WeightStorage::CSC);
+    for (int i = 1; i < variant.layer_count (); ++i)
+    {
+      variant.set_storage (i, WeightStorage::CSR);
+    }
+  }
+
+  std::unique_ptr<Ensemble> ensemble;
+  if (opts.tta || !opts.members.empty ())
+  {
+    std::vector<std::shared_ptr<const MlpNetwork>> members {
+        std::make_shared<const MlpNetwork> (variant)};
+    try
+    {
+      for (const std::string &member : opts.members)
+      {
+        members.push_back (std::make_shared<const MlpNetwork> (
+            loadModel (member)));
+      }
+    }
+    catch (const std::invalid_argument &invalidArgument)
+    {
+      std::cerr << invalidArgument.what () << std::endl;
+      return EXIT_FAILURE;
+    }
+    ensemble.reset (new Ensemble (
+        members, opts.tta ? Ensemble::default_augmentations ()
+                          : std::vector<augmentation> {{0, 0, 0.0F}}));
+  }
+
+  if (opts.numa)
+  {
+    NumaTopology topology = NumaTopology::detect ();
+    std::cout << "numa: " << topology.node_count ()
+              << (topology.is_simulated () ? " simulated" : "") << " node(s)"
+              << std::endl;
+  }
+
+  std::vector<prediction> variantResults;
+  run_stats stats;
+  if (ensemble)
+  {
+    stats = runBatches<Ensemble> ({ensemble.get ()}, NumaTopology (), images,
+                                  opts, variantResults);
+    report ("ensemble of " + std::to_string (ensemble->member_count ())
+            + " x " + std::to_string (ensemble->augmentation_count ())
+            + " variants", variantResults, labels, stats, opts);
+  }
+  else
+  {
+    stats = runNetwork (variant, images, opts, variantResults);
+    report (opts.sparse ? "sparse" : "dense", variantResults, labels, stats,
+            opts);
+  }
+  if (perf::enabled ())
+  {
+    perf::print (std::cout);
+    perf::reset ();
+  }
+
+  if (opts.compare)
+  {
+    std::vector<prediction> referenceResults;
+    ScalarReference scalar (*reference);
+    stats = runBatches<ScalarReference> ({&scalar}, NumaTopology (), images,
+                                         opts, referenceResults);
+    report ("scalar reference", referenceResults, labels, stats, opts);
+    if (perf::enabled ())
+    {
+      perf::print (std::cout);
+    }
+    compareResults (referenceResults, variantResults);
+  }
+  return EXIT_SUCCESS;
+}
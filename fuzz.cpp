@@ -0,0 +1,58 @@
+// fuzz.cpp
+// libFuzzer entry point for the parameter and image loaders: the first
+// input byte picks the loader, the rest is the file it reads. Build with
+// `make fuzz` (clang) and run ./fuzz [corpus_dir]. Crashes, sanitizer
+// reports and loader contract violations (see kernel_check::feed_loader)
+// all stop the fuzzer. Built with -DFUZZ_STANDALONE instead, the binary
+// replays the input files given on its command line, with any compiler.
+#include "KernelCheck.h"
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+
+extern "C" int LLVMFuzzerInitialize (int *, char ***)
+{
+  std::cerr.rdbuf (nullptr); // Rejections are expected, keep them quiet
+  return 0;
+}
+
+extern "C" int LLVMFuzzerTestOneInput (const uint8_t *data, size_t size)
+{
+  if (size == 0)
+  {
+    return 0;
+  }
+  kernel_check::Loader loader = static_cast<kernel_check::Loader> (
+      data[0] % static_cast<int> (kernel_check::Loader::COUNT));
+  std::string bytes (reinterpret_cast<const char *> (data + 1), size - 1);
+  if (!kernel_check::feed_loader (loader, bytes))
+  {
+    std::abort ();
+  }
+  return 0;
+}
+
+#ifdef FUZZ_STANDALONE
+/**
+ * Replays saved inputs, e.g. crash files written by libFuzzer.
+ * @param argc count of args
+ * @param argv input file paths
+ * @return program exit status code
+ */
+int main (int argc, char **argv)
+{
+  LLVMFuzzerInitialize (&argc, &argv);
+  for (int i = 1; i < argc; ++i)
+  {
+    std::ifstream inFile (argv[i], std::ios::binary);
+    std::stringstream contents;
+    contents << inFile.rdbuf ();
+    std::string input = contents.str ();
+    LLVMFuzzerTestOneInput (
+        reinterpret_cast<const uint8_t *> (input.data ()), input.size ());
+    std::cout << argv[i] << ": ok" << std::endl;
+  }
+  return EXIT_SUCCESS;
+}
+#endif
@@ -3,108 +3,188 @@
 #include "Activation.h"
 #include "Dense.h"
 #include "MlpNetwork.h"
-#include <fstream>
+#include "MlpIO.h"
+#include "ModelSlot.h"
+#include "PerfCounters.h"
+#include "ResultStream.h"
+#include "StreamPipeline.h"
+#include <csignal>
+#include <thread>
 
 #define QUIT "q"
 #define INSERT_IMAGE_PATH "Please insert image path:"
-#define ERROR_INAVLID_PARAMETER "Error: invalid Parameters file for layer: "
 #define ERROR_INVALID_INPUT "Error: Failed to retrieve input. Exiting.."
 #define ERROR_INVALID_IMG "Error: invalid image path or size: "
+#define ERROR_INVALID_OUTPUT "Error: failed to write results. Exiting.."
+#define ERROR_INVALID_RING "Error: could not create result ring: "
 #define USAGE_MSG "Usage:\n" \
-                  "\t./mlpnetwork w1 w2 w3 w4 b1 b2 b3 b4\n" \
+                  "\t./mlpnetwork w1 w2 w3 w4 b1 b2 b3 b4 [options]\n" \
                   "\twi - the i'th layer's weights\n" \
-                  "\tbi - the i'th layer's biases"
+                  "\tbi - the i'th layer's biases\n" \
+                  "Options:\n" \
+                  "\t--binary - write binary records to stdout instead " \
+                  "of text\n" \
+                  "\t--full - records carry the full distribution\n" \
+                  "\t--ring NAME - also publish records to a shared " \
+                  "memory ring\n" \
+                  "\t--perf - report hardware counters per layer shape " \
+                  "to stderr on exit\n" \
+                  "\t--stream paths|raw - pipelined mode: read image paths " \
+                  "(one per line) or raw float images from stdin until EOF, " \
+                  "print \"id digit probability\" lines in input order\n" \
+                  "\t--threads N - inference threads of --stream " \
+                  "(default: all cores)"
 #define USAGE_ERR "Error: wrong number of arguments."
 #define ARGS_START_IDX 1
 #define ARGS_COUNT (ARGS_START_IDX + (MLP_SIZE * 2))
-#define WEIGHTS_START_IDX ARGS_START_IDX
-#define BIAS_START_IDX (ARGS_START_IDX + MLP_SIZE)
+// Records the ring holds before the CLI waits for its consumer
+#define RING_CAPACITY 65536
+// Images per forward pass, and images in flight, of --stream
+#define STREAM_BATCH 64
+#define STREAM_WINDOW 1024
 
 /**
- * Prints program usage to stdout.
- * @param argc number of arguments given in the program
- * @throw std::domain_error in case of wrong number of arguments
+ * Where results go, besides (or instead of) the text output.
+ * @var binary - result records on stdout, and no text at all
+ * @var full - records carry the full distribution
+ * @var ring - name of the shared memory ring to publish to, if any
+ * @var stream - "paths" or "raw" for the pipelined mode, empty otherwise
+ * @var threads - inference threads of the pipelined mode
  */
-void usage (int argc) noexcept (false)
+struct cli_output
+{
+    bool binary;
+    bool full;
+    std::string ring;
+    std::string stream;
+    int threads;
+};
+
+// Set by SIGHUP; the reload starts when the next image is read
+static volatile std::sig_atomic_t reloadRequested = 0;
+
+static void requestReload (int)
 {
-  if (argc != ARGS_COUNT)
+  reloadRequested = 1;
+}
+
+/**
+ * Starts a background reload when one was requested, and reports on
+ * stderr a reload that has finished.
+ * @param slot slot holding the served network
+ * @param paths parameter paths to reload from
+ * @param pending the reload in progress, if any
+ */
+static void serviceReload (ModelSlot &slot,
+						   const std::vector<std::string> &paths,
+						   std::future<swap_report> &pending)
+{
+  if (pending.valid () && pending.wait_for (std::chrono::seconds (0))
+						  == std::future_status::ready)
   {
-	throw std::domain_error (USAGE_ERR);
+	swap_report report = pending.get ();
+	if (report.swapped)
+	{
+	  std::cerr << "Reloaded parameters as version " << report.version
+				<< ": load " << report.load_ms << " ms, publish "
+				<< report.publish_us << " us, retire " << report.retire_us
+				<< " us, " << report.in_flight << " in flight" << std::endl;
+	}
+	else
+	{
+	  std::cerr << "Reload failed; still serving version "
+				<< report.version << std::endl;
+	}
+  }
+  if (reloadRequested && !pending.valid ())
+  {
+	reloadRequested = 0;
+	pending = slot.reload (paths);
   }
-  std::cout << USAGE_MSG << std::endl;
 }
 
 /**
- * Given a binary file path and a matrix,
- * reads the content of the file into the matrix.
- * file must match matrix in size in order to read successfully.
- * @param filePath - path of the binary file to read
- * @param mat -  matrix to read the file into.
- * @return boolean status
- *          true - success
- *          false - failure
+ * Parses the options following the parameter paths, then prints program
+ * usage to stdout unless the output is binary or streamed.
+ * @param argc number of arguments given in the program
+ * @param argv args values
+ * @param output receives the parsed options
+ * @throw std::domain_error in case of wrong number of arguments
  */
-bool readFileToMatrix(const std::string &filePath, Matrix &mat) {
-  std::ifstream inFile(filePath, std::ios::binary);
-  if (!inFile) {
-    std::cerr << "Could not open file for reading: " << filePath << std::endl;
-    return false;
+void usage (int argc, char **argv, cli_output &output) noexcept (false)
+{
+  if (argc < ARGS_COUNT)
+  {
+	throw std::domain_error (USAGE_ERR);
   }
-
-  // Calculate the expected size based on matrix dimensions and size of a single float
-  std::streamsize expectedSize = mat.get_rows() * mat.get_cols() * sizeof(float);
-
-  // Go to the end of the file to check its size
-  inFile.seekg(0, std::ios::end);
-  std::streamsize fileSize = inFile.tellg();
-  inFile.seekg(0, std::ios::beg);  // Seek back to the beginning of the file
-
-  if (fileSize != expectedSize) {
-    std::cerr << "File size does not match matrix dimensions." << std::endl;
-    return false;
+  output = {false, false, "", "",
+			std::max (1, static_cast<int> (std::thread::hardware_concurrency ()))};
+  for (int i = ARGS_COUNT; i < argc; ++i)
+  {
+	std::string opt (argv[i]);
+	if (opt == "--binary")
+	{
+	  output.binary = true;
+	}
+	else if (opt == "--full")
+	{
+	  output.full = true;
+	}
+	else if (opt == "--perf")
+	{
+	  perf::enable (true);
+	}
+	else if (opt == "--ring" && i + 1 < argc)
+	{
+	  output.ring = argv[++i];
+	}
+	else if (opt == "--stream" && i + 1 < argc)
+	{
+	  output.stream = argv[++i];
+	  if (output.stream != "paths" && output.stream != "raw")
+	  {
+		throw std::domain_error (USAGE_ERR);
+	  }
+	}
+	else if (opt == "--threads" && i + 1 < argc)
+	{
+	  output.threads = std::atoi (argv[++i]);
+	  if (output.threads <= 0)
+	  {
+		throw std::domain_error (USAGE_ERR);
+	  }
+	}
+	else
+	{
+	  throw std::domain_error (USAGE_ERR);
+	}
   }
-
-  // Use the overloaded operator>> to read the file into the matrix
-  inFile >> mat;
-
-  if (!inFile) {
-    std::cerr << "Error reading matrix data from file." << std::endl;
-    return false;
+  if (!output.binary && output.stream.empty ())
+  {
+	std::cout << USAGE_MSG << std::endl;
   }
-
-  return true;
 }
 
 /**
- * Loads MLP parameters from weights & biases paths
- * to Weights[] and Biases[].
- * Throws an exception upon failures.
- * @param paths array of programs arguments, expected to be mlp parameters
- *        path.
- * @param weights array of matrix, weigths[i] is the i'th layer weights matrix
- * @param biases array of matrix, biases[i] is the i'th layer bias matrix
- *          (which is actually a vector)
- *  @throw std::invalid_argument in case of problem with a certain argument
+ * Opens the shared memory ring requested by the options, if any.
+ * @throw std::invalid_argument if the ring cannot be created
  */
-void loadParameters (char *paths[ARGS_COUNT], Matrix weights[MLP_SIZE],
-					 Matrix biases[MLP_SIZE]) noexcept (false)
+static std::unique_ptr<ResultRing> openRing (const cli_output &output)
+noexcept (false)
 {
-  for (int i = 0; i < MLP_SIZE; i++)
+  std::unique_ptr<ResultRing> ring;
+  if (!output.ring.empty ())
   {
-	weights[i] = Matrix (weights_dims[i].rows, weights_dims[i].cols);
-	biases[i] = Matrix (bias_dims[i].rows, bias_dims[i].cols);
-
-	std::string weightsPath (paths[WEIGHTS_START_IDX + i]);
-	std::string biasPath (paths[BIAS_START_IDX + i]);
-
-	if (!(readFileToMatrix (weightsPath, weights[i]) &&
-		  readFileToMatrix (biasPath, biases[i])))
+	try
 	{
-	  auto msg = ERROR_INAVLID_PARAMETER + std::to_string (i + 1);
-	  throw std::invalid_argument (msg);
+	  ring.reset (new ResultRing (output.ring, RING_CAPACITY, output.full));
+	}
+	catch (const std::exception &)
+	{
+	  throw std::invalid_argument (ERROR_INVALID_RING + output.ring);
 	}
-
   }
+  return ring;
 }
 
 /**
@@ -115,15 +195,34 @@ void loadParameters (char *paths[ARGS_COUNT], Matrix weights[MLP_SIZE],
  *                  print image & netowrk prediction
  *             }
  * Throws an exception on fatal errors: unable to read user input path.
- * @param mlp MlpNetwork to use in order to predict img.
+ * On SIGHUP the parameter files are reloaded in the background once the
+ * next image is read, and used for the images read after the new network
+ * is ready; the loop is never interrupted.
+ * Results can also be emitted as binary records (see ResultStream.h), whose
+ * image id is the position of the image in the input, starting at 0.
+ * @param slot ModelSlot holding the MlpNetwork used to predict img.
+ * @param paths The parameter paths the network was loaded from.
+ * @param output Where to send results.
  * @throw std::invalid_argument in case of problem with the user input path
  */
-void mlpCli (MlpNetwork &mlp) noexcept (false)
+void mlpCli (ModelSlot &slot, const std::vector<std::string> &paths,
+			 const cli_output &output) noexcept (false)
 {
+  std::future<swap_report> pendingReload;
   Matrix img (img_dims.rows, img_dims.cols);
   std::string imgPath;
+  uint64_t imageId = 0;
+  std::unique_ptr<ResultWriter> writer;
+  std::unique_ptr<ResultRing> ring = openRing (output);
+  if (output.binary)
+  {
+	writer.reset (new ResultWriter (std::cout, output.full));
+  }
 
-  std::cout << INSERT_IMAGE_PATH << std::endl;
+  if (!output.binary)
+  {
+	std::cout << INSERT_IMAGE_PATH << std::endl;
+  }
   std::cin >> imgPath;
   if (!std::cin.good ())
   {
@@ -132,21 +231,49 @@ void mlpCli (MlpNetwork &mlp) noexcept (false)
 
   while (imgPath != QUIT)
   {
-	if (readFileToMatrix (imgPath, img))
+	serviceReload (slot, paths, pendingReload);
+	if (readImageToMatrix (imgPath, img))
 	{
 	  Matrix imgVec = img;
-	  digit output = mlp (imgVec.vectorize ());
-	  std::cout << "Image processed:" << std::endl
-				<< img << std::endl;
-	  std::cout << "Mlp result: " << output.value <<
-				" at probability: " << output.probability << std::endl;
+	  if (writer || ring)
+	  {
+		result_record record = make_record (
+			imageId, slot.acquire ()->predict (imgVec.vectorize (), 1));
+		if (writer && !writer->write (record))
+		{
+		  throw std::invalid_argument (ERROR_INVALID_OUTPUT);
+		}
+		if (ring)
+		{
+		  ring->push (record);
+		}
+		if (!output.binary)
+		{
+		  std::cout << "Image processed:" << std::endl
+					<< img << std::endl;
+		  std::cout << "Mlp result: " << record.value <<
+					" at probability: " << record.probability << std::endl;
+		}
+	  }
+	  else
+	  {
+		digit result = (*slot.acquire ()) (imgVec.vectorize ());
+		std::cout << "Image processed:" << std::endl
+				  << img << std::endl;
+		std::cout << "Mlp result: " << result.value <<
+				  " at probability: " << result.probability << std::endl;
+	  }
+	  ++imageId;
 	}
 	else
 	{
 	  throw std::invalid_argument (ERROR_INVALID_IMG + imgPath);
 	}
 
-	std::cout << INSERT_IMAGE_PATH << std::endl;
+	if (!output.binary)
+	{
+	  std::cout << INSERT_IMAGE_PATH << std::endl;
+	}
 	std::cin >> imgPath;
 	if (!std::cin.good ())
 	{
@@ -155,6 +282,50 @@ void mlpCli (MlpNetwork &mlp) noexcept (false)
   }
 }
 
+/**
+ * Pipelined command line interface: images are read from stdin until EOF
+ * on one thread, run in batches on --threads others, and their results
+ * written in input order on this one, as "id digit probability" lines or
+ * binary records. The parameter files are reloaded on SIGHUP as in mlpCli.
+ * @param slot ModelSlot holding the MlpNetwork used to predict.
+ * @param paths The parameter paths the network was loaded from.
+ * @param output Where to send results, and the input format.
+ * @throw std::invalid_argument on an unreadable image or failed output
+ */
+void streamCli (ModelSlot &slot, const std::vector<std::string> &paths,
+				const cli_output &output) noexcept (false)
+{
+  // The reader thread must not flush std::cout, which the emitter owns
+  std::cin.tie (nullptr);
+  std::future<swap_report> pendingReload;
+  std::unique_ptr<ResultWriter> writer;
+  std::unique_ptr<ResultRing> ring = openRing (output);
+  if (output.binary)
+  {
+	writer.reset (new ResultWriter (std::cout, output.full));
+  }
+
+  StreamPipeline pipeline (slot, output.threads, STREAM_BATCH, STREAM_WINDOW);
+  pipeline.run (std::cin, output.stream == "raw" ? StreamPipeline::Format::RAW
+												: StreamPipeline::Format::PATHS,
+				[&] (const result_record &record)
+  {
+	serviceReload (slot, paths, pendingReload);
+	if (ring)
+	{
+	  ring->push (record);
+	}
+	if (writer)
+	{
+	  return writer->write (record);
+	}
+	std::cout << record.image_id << ' ' << record.value << ' '
+			  << record.probability << '\n';
+	return static_cast<bool> (std::cout);
+  });
+  std::cout.flush ();
+}
+
 /**
  * Program's main
  * @param argc count of args
@@ -163,9 +334,10 @@ void mlpCli (MlpNetwork &mlp) noexcept (false)
  */
 int main (int argc, char **argv)
 {
+  cli_output output;
   try
   {
-	usage (argc);
+	usage (argc, argv, output);
   }
   catch (const std::domain_error &domainError)
   {
@@ -179,7 +351,7 @@ int main (int argc, char **argv)
 
   try
   {
-	loadParameters (argv, weights, biases);
+	loadParameters (argv + ARGS_START_IDX, weights, biases);
 
   }
   catch (const std::invalid_argument &invalidArgument)
@@ -188,19 +360,34 @@ int main (int argc, char **argv)
 	return EXIT_FAILURE;
   }
 
-  MlpNetwork mlp (weights, biases);
+  ModelSlot slot (std::unique_ptr<const MlpNetwork> (
+	  new MlpNetwork (weights, biases)));
+  std::vector<std::string> paths (argv + ARGS_START_IDX, argv + ARGS_COUNT);
+  std::signal (SIGHUP, requestReload);
 
+  int status = EXIT_SUCCESS;
   try
   {
-	mlpCli (mlp);
+	if (output.stream.empty ())
+	{
+	  mlpCli (slot, paths, output);
+	}
+	else
+	{
+	  streamCli (slot, paths, output);
+	}
   }
 
   catch (const std::invalid_argument &invalidArgument)
   {
 	std::cerr << invalidArgument.what () << std::endl;
-	return EXIT_FAILURE;
+	status = EXIT_FAILURE;
 
   }
 
-  return EXIT_SUCCESS;
+  if (perf::enabled ())
+  {
+	perf::print (std::cerr);
+  }
+  return status;
 }
@@ -0,0 +1,199 @@
+// prune.cpp
+#include "MlpNetwork.h"
+#include "MlpIO.h"
+#include <algorithm>
+#include <chrono>
+
+#define USAGE_MSG "Usage:\n" \
+                  "\t./prune sparsity out_dir w1 w2 w3 w4 b1 b2 b3 b4 " \
+                  "[labels]\n" \
+                  "\tsparsity - fraction of each layer's weights to zero, " \
+                  "in [0, 1)\n" \
+                  "\tout_dir - existing directory for the pruned w1..w4, " \
+                  "b1..b4\n" \
+                  "\tlabels - optional label list to compare dense and " \
+                  "pruned networks on"
+#define USAGE_ERR "Error: wrong arguments."
+#define SPARSITY_IDX 1
+#define OUT_DIR_IDX 2
+#define PARAMS_START_IDX 3
+#define ARGS_COUNT (PARAMS_START_IDX + (MLP_SIZE * 2))
+#define MIN_BENCH_SECONDS 0.2
+
+/**
+ * Zeros the smallest-magnitude fraction of the matrix elements.
+ * @param m matrix to prune in place
+ * @param sparsity fraction of elements to zero
+ * @return number of elements left non-zero
+ */
+static int pruneMatrix (Matrix &m, float sparsity)
+{
+  int size = m.get_rows () * m.get_cols ();
+  int drop = static_cast<int> (sparsity * static_cast<float> (size));
+  float *values = m.data ();
+  if (drop > 0)
+  {
+    std::vector<float> magnitudes (size);
+    for (int i = 0; i < size; ++i)
+    {
+      magnitudes[i] = std::abs (values[i]);
+    }
+    std::nth_element (magnitudes.begin (), magnitudes.begin () + (drop - 1),
+                      magnitudes.end ());
+    float threshold = magnitudes[drop - 1];
+    for (int i = 0; i < size; ++i)
+    {
+      if (std::abs (values[i]) <= threshold)
+      {
+        values[i] = 0.0F;
+      }
+    }
+  }
+  return static_cast<int> (std::count_if (values, values + size, [] (float v)
+  { return v != 0.0F; }));
+}
+
+/**
+ * Classifies every image, repeating the pass until MIN_BENCH_SECONDS have
+ * elapsed so the per-image time is measurable on small sets.
+ * @param mlp network to run
+ * @param images vectorized images
+ * @param predictions receives one digit per image
+ * @return average microseconds per image
+ */
+static double timeNetwork (const MlpNetwork &mlp,
+                           const std::vector<Matrix> &images,
+                           std::vector<unsigned int> &predictions)
+{
+  using clock = std::chrono::steady_clock;
+  predictions.assign (images.size (), 0);
+  long runs = 0;
+  auto start = clock::now ();
+  std::chrono::duration<double> elapsed (0);
+  while (elapsed.count () < MIN_BENCH_SECONDS)
+  {
+    for (size_t i = 0; i < images.size (); ++i)
+    {
+      predictions[i] = mlp (images[i]).value;
+    }
+    runs += static_cast<long> (images.size ());
+    elapsed = clock::now () - start;
+  }
+  return elapsed.count () * 1e6 / static_cast<double> (runs);
+}
+
+/**
+ * Loads the labeled images and reports accuracy and speed of the dense
+ * network next to the pruned one running on sparse kernels.
+ * @param dense network with the original parameters
+ * @param pruned network with the pruned parameters
+ * @param labelsPath label list of the evaluation images
+ * @return boolean status
+ */
+static bool compareNetworks (const MlpNetwork &dense, MlpNetwork &pruned,
+                             const std::string &labelsPath)
+{
+  std::vector<std::string> paths;
+  std::vector<unsigned int> labels;
+  if (!readLabelList (labelsPath, paths, labels) || paths.empty ())
+  {
+    return false;
+  }
+  std::vector<Matrix> images;
+  for (const std::string &path : paths)
+  {
+    Matrix img (img_dims.rows, img_dims.cols);
+    if (!readImageToMatrix (path, img))
+    {
+      return false;
+    }
+    images.push_back (img.vectorize ());
+  }
+
+  // The first layer also skips blank input pixels; the rest use CSR.
+  pruned.set_storage (0, WeightStorage::CSC);
+  for (int i = 1; i < MLP_SIZE; ++i)
+  {
+    pruned.set_storage (i, WeightStorage::CSR);
+  }
+
+  std::vector<unsigned int> densePredictions, prunedPredictions;
+  double denseTime = timeNetwork (dense, images, densePredictions);
+  double prunedTime = timeNetwork (pruned, images, prunedPredictions);
+
+  size_t denseCorrect = 0, prunedCorrect = 0, agree = 0;
+  for (size_t i = 0; i < images.size (); ++i)
+  {
+    denseCorrect += densePredictions[i] == labels[i];
+    prunedCorrect += prunedPredictions[i] == labels[i];
+    agree += densePredictions[i] == prunedPredictions[i];
+  }
+  double count = static_cast<double> (images.size ());
+  std::cout << "images: " << images.size () << std::endl
+            << "dense  accuracy: " << denseCorrect / count
+            << " time/image: " << denseTime << " us" << std::endl
+            << "pruned accuracy: " << prunedCorrect / count
+            << " time/image: " << prunedTime << " us" << std::endl
+            << "agreement: " << agree / count
+            << " speedup: " << denseTime / prunedTime << "x" << std::endl;
+  return true;
+}
+
+/**
+ * Program's main
+ * @param argc count of args
+ * @param argv args values
+ * @return program exit status code
+ */
+int main (int argc, char **argv)
+{
+  if (argc != ARGS_COUNT && argc != ARGS_COUNT + 1)
+  {
+    std::cerr << USAGE_ERR << std::endl << USAGE_MSG << std::endl;
+    return EXIT_FAILURE;
+  }
+  float sparsity = std::strtof (argv[SPARSITY_IDX], nullptr);
+  if (!(sparsity >= 0.0F && sparsity < 1.0F))
+  {
+    std::cerr << USAGE_ERR << std::endl << USAGE_MSG << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  Matrix weights[MLP_SIZE];
+  Matrix biases[MLP_SIZE];
+  try
+  {
+    loadParameters (argv + PARAMS_START_IDX, weights, biases);
+  }
+  catch (const std::invalid_argument &invalidArgument)
+  {
+    std::cerr << invalidArgument.what () << std::endl;
+    return EXIT_FAILURE;
+  }
+  MlpNetwork dense (weights, biases);
+
+  std::string outDir (argv[OUT_DIR_IDX]);
+  for (int i = 0; i < MLP_SIZE; ++i)
+  {
+    int kept = pruneMatrix (weights[i], sparsity);
+    std::string index = std::to_string (i + 1);
+    if (!(writeMatrixToFile (outDir + "/w" + index, weights[i])
+          && writeMatrixToFile (outDir + "/b" + index, biases[i])))
+    {
+      return EXIT_FAILURE;
+    }
+    std::cout << "layer " << index << ": " << kept << " / "
+              << weights[i].get_rows () * weights[i].get_cols ()
+              << " weights kept" << std::endl;
+  }
+
+  if (argc == ARGS_COUNT + 1)
+  {
+    MlpNetwork pruned (weights, biases);
+    if (!compareNetworks (dense, pruned, argv[ARGS_COUNT]))
+    {
+      return EXIT_FAILURE;
+    }
+  }
+  return EXIT_SUCCESS;
+}